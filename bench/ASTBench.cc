@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cctype>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include "BenchUtils.h"
+#include "BytecodeCollector.h"
+#include "FlatAST.h"
+#include "IncrementalParser.h"
+#include "Parser.h"
+#include "Program.h"
+#include "TokenBuffer.h"
+
+static void compile(const ast::Node& root) {
+  BytecodeCollector collector;
+  if (!root.toByteCode(collector))
+    abort();
+}
+
+static void compile(const ast::FlatTree& tree) {
+  BytecodeCollector collector;
+  if (!tree.toByteCode(collector))
+    abort();
+}
+
+int main(int argc, const char** argv) {
+  std::string input = generateProgram(benchInputSize(argc, argv, 8));
+  BufferReader reader(input);
+  Tokenizer tokenizer(reader);
+  TokenBuffer tokens = TokenBuffer::lexAll(tokenizer);
+  Parser parser(tokens);
+  ast::Node* root = parser.parse();
+  if (!root)
+    abort();
+
+  ast::FlatTree tree = ast::FlatTree::build(*root);
+  std::size_t nodes = tree.size();
+  printf("%zu bytes, %zu nodes\n", input.size(), nodes);
+  printf("%-32s %10.1f bytes/node\n", "pointer tree (arena)",
+         double(parser.arena().capacity()) / nodes);
+  printf("%-32s %10.1f bytes/node\n", "flat tree",
+         double(tree.memoryUsage()) / nodes);
+
+  double seconds = bestOf(5, [&] { ast::FlatTree::build(*root); });
+  reportThroughput("flatten", input.size(), seconds);
+
+  seconds = bestOf(5, [&] { compile(*root); });
+  reportThroughput("codegen (pointer tree)", input.size(), seconds);
+
+  seconds = bestOf(5, [&] { compile(tree); });
+  reportThroughput("codegen (flat tree)", input.size(), seconds);
+
+  // Parsing and compiling from the tokens, either building the whole tree
+  // first or compiling statements as they're parsed.
+  std::size_t arenaBytes = 0;
+  seconds = bestOf(5, [&] {
+    Parser parser(tokens);
+    ast::Node* root = parser.parse();
+    if (!root || !Program::fromAST(*root))
+      abort();
+    arenaBytes = parser.arena().peakCapacity();
+  });
+  reportThroughput("parse + compile", input.size(), seconds);
+  printf("%-32s %10zu KiB arena\n", "", arenaBytes / 1024);
+
+  seconds = bestOf(5, [&] {
+    Parser parser(tokens);
+    if (!Program::compileStreaming(parser))
+      abort();
+    arenaBytes = parser.arena().peakCapacity();
+  });
+  reportThroughput("parse + compile (streaming)", input.size(), seconds);
+  printf("%-32s %10zu KiB arena\n", "", arenaBytes / 1024);
+
+  // Compiling from a cached flat tree instead, which would be mapped from a
+  // file.
+  std::ostringstream stream;
+  tree.write(stream);
+  std::string file = stream.str();
+  std::vector<uint64_t> mapping(file.size() / sizeof(uint64_t) + 1);
+  memcpy(mapping.data(), file.data(), file.size());
+  const char* data = reinterpret_cast<const char*>(mapping.data());
+  printf("%-32s %10zu KiB\n", "flat AST file", file.size() / 1024);
+
+  seconds = bestOf(5, [&] {
+    if (!ast::FlatTree::map(data, file.size()))
+      abort();
+  });
+  printf("%-32s %10.3f ms\n", "map flat AST", seconds * 1000);
+
+  seconds = bestOf(5, [&] {
+    auto mapped = ast::FlatTree::map(data, file.size());
+    if (!mapped || !Program::fromFlatTree(mapped.unwrap()))
+      abort();
+  });
+  reportThroughput("map flat AST + compile", input.size(), seconds);
+
+  // Recompiling after tweaking a constant somewhere in the program.
+  const std::size_t kEdits = 20;
+  BenchRandom random(7);
+  std::vector<std::size_t> digits;
+  for (std::size_t i = 0; i < kEdits; ++i) {
+    // The first digit of a number, rather than of a variable name.
+    std::size_t offset = random.next(input.size());
+    while (!isdigit(input[offset]) || input[offset - 1] != ' ')
+      offset++;
+    digits.push_back(offset);
+  }
+
+  seconds = bestOf(5, [&] {
+    for (std::size_t i = 0; i < kEdits; ++i) {
+      BufferReader reader(input);
+      Tokenizer tokenizer(reader);
+      TokenBuffer tokens = TokenBuffer::lexAll(tokenizer);
+      Parser parser(tokens);
+      ast::Node* root = parser.parse();
+      if (!root)
+        abort();
+      compile(*root);
+    }
+  });
+  printf("%-32s %10.2f ms/edit\n", "recompile from scratch",
+         seconds * 1000 / kEdits);
+
+  IncrementalParser incremental(input);
+  std::size_t reused = 0;
+  std::size_t parsed = 0;
+  double reparseSeconds = bestOf(5, [&] {
+    for (std::size_t offset : digits) {
+      char digit = '0' + random.next(10);
+      if (!incremental.edit(offset, 1, std::string_view(&digit, 1)))
+        abort();
+      reused = incremental.stats().reusedNodes;
+      parsed = incremental.stats().parsedNodes;
+    }
+  });
+  printf("%-32s %10.2f ms/edit\n", "incremental reparse",
+         reparseSeconds * 1000 / kEdits);
+  printf("%-32s %10zu reused, %zu parsed\n", "", reused, parsed);
+
+  seconds = bestOf(5, [&] {
+    for (std::size_t offset : digits) {
+      char digit = '0' + random.next(10);
+      if (!incremental.edit(offset, 1, std::string_view(&digit, 1)))
+        abort();
+      compile(*incremental.root());
+    }
+  });
+  printf("%-32s %10.2f ms/edit\n", "incremental reparse + compile",
+         seconds * 1000 / kEdits);
+}
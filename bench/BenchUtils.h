@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "Tokenizer.h"
+
+// A simple deterministic pseudo-random number generator, so that the
+// generated programs are the same across runs.
+class BenchRandom {
+  uint64_t m_state;
+
+ public:
+  explicit BenchRandom(uint64_t seed) : m_state(seed) {}
+
+  uint32_t next() {
+    m_state = m_state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return m_state >> 33;
+  }
+
+  uint32_t next(uint32_t max) { return next() % max; }
+};
+
+// Generates a big, machine-generated looking program: a block with lots of
+// assignments of arithmetic expressions over a bunch of variables.
+inline std::string generateProgram(std::size_t approximateSize,
+                                   std::size_t variableCount = 64) {
+  BenchRandom random(42);
+  std::string program = "{\n";
+  for (std::size_t i = 0; i < variableCount; ++i)
+    program += "  variable_" + std::to_string(i) + " = " +
+               std::to_string(random.next(1000)) + ";\n";
+
+  const char* kOperators[] = {" + ", " - ", " * "};
+  while (program.size() < approximateSize) {
+    program += "  variable_" + std::to_string(random.next(variableCount)) +
+               " = variable_" + std::to_string(random.next(variableCount));
+    for (uint32_t i = 0, terms = 1 + random.next(4); i < terms; ++i) {
+      program += kOperators[random.next(3)];
+      if (random.next(2))
+        program += std::to_string(random.next(100000));
+      else
+        program += "variable_" + std::to_string(random.next(variableCount));
+    }
+    program += ";\n";
+  }
+  program += "  variable_0\n}\n";
+  return program;
+}
+
+// Runs `callback` a few times, and returns the best time, in seconds.
+template <typename Callback>
+double bestOf(std::size_t runs, Callback callback) {
+  double best = 0;
+  for (std::size_t i = 0; i < runs; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    callback();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (!i || elapsed.count() < best)
+      best = elapsed.count();
+  }
+  return best;
+}
+
+inline void reportThroughput(const char* name,
+                             std::size_t bytes,
+                             double seconds) {
+  printf("%-32s %10.1f MB/s\n", name, bytes / seconds / (1024 * 1024));
+}
+
+// The input size for the benchmark, in megabytes, either from the command
+// line or the default.
+inline std::size_t benchInputSize(int argc,
+                                  const char** argv,
+                                  std::size_t defaultMegabytes) {
+  std::size_t megabytes = defaultMegabytes;
+  if (argc > 1)
+    megabytes = std::max(1l, atol(argv[1]));
+  return megabytes * 1024 * 1024;
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string>
+#include "ASTWalker.h"
+#include "BenchUtils.h"
+#include "Parser.h"
+#include "TokenBuffer.h"
+#include "TokenPipeline.h"
+#include "Tokenizer.h"
+
+static void parseStreaming(const std::string& input) {
+  BufferReader reader(input);
+  Tokenizer tokenizer(reader);
+  Parser parser(tokenizer);
+  if (!parser.parse())
+    abort();
+}
+
+static TokenPipeline::Stats parsePipelined(const std::string& input) {
+  BufferReader reader(input);
+  Tokenizer tokenizer(reader);
+  TokenPipeline pipeline(tokenizer);
+  Parser parser(pipeline);
+  if (!parser.parse())
+    abort();
+  return pipeline.stats();
+}
+
+static TokenBuffer lexIntoBuffer(const std::string& input) {
+  BufferReader reader(input);
+  Tokenizer tokenizer(reader);
+  return TokenBuffer::lexAll(tokenizer);
+}
+
+static void parseFromBuffer(const TokenBuffer& tokens, bool lazy = false) {
+  Parser parser(tokens);
+  parser.setLazyBlocks(lazy);
+  if (!parser.parse())
+    abort();
+}
+
+// Visits every node, which parses all the lazy blocks.
+class ParseEverything final {
+ public:
+  bool visit(const ast::Node& node, uint32_t& step, const ast::Node*& next) {
+    next = ast::nextChild(node, step);
+    return true;
+  }
+};
+
+static void parseAndVisitAll(const TokenBuffer& tokens, bool lazy) {
+  Parser parser(tokens);
+  parser.setLazyBlocks(lazy);
+  ast::Node* root = parser.parse();
+  if (!root)
+    abort();
+  ParseEverything visitor;
+  ast::walk(*root, visitor);
+  if (parser.error())
+    abort();
+}
+
+// Generates statements with long operator chains and deeply nested
+// parentheses, which is where the parser spends most of its time pushing and
+// popping operators.
+static std::string generateExpressionProgram(std::size_t approximateSize) {
+  BenchRandom random(42);
+  const char* kOperators[] = {" + ", " - ", " * ", " < "};
+  std::string program = "{\n";
+  while (program.size() < approximateSize) {
+    std::size_t depth = 1 + random.next(200);
+    program += "  x = ";
+    program.append(depth, '(');
+    program += "x";
+    for (std::size_t i = 0; i < depth; ++i) {
+      program += kOperators[random.next(4)];
+      program += std::to_string(random.next(1000));
+      program += ')';
+    }
+    for (uint32_t i = 0, terms = random.next(500); i < terms; ++i) {
+      program += kOperators[random.next(4)];
+      program += "x";
+    }
+    program += ";\n";
+  }
+  program += "  x\n}\n";
+  return program;
+}
+
+// Generates long if / else chains with big blocks as branches, most of which
+// would never be taken in a given run.
+static std::string generateBranchyProgram(std::size_t approximateSize) {
+  BenchRandom random(42);
+  const char* kOperators[] = {" + ", " - ", " * "};
+  std::string program = "{\n  x = 1;\n";
+  while (program.size() < approximateSize) {
+    for (uint32_t branch = 0, branches = 1 + random.next(8);
+         branch < branches; ++branch) {
+      if (branch)
+        program += " else ";
+      else
+        program += "  ";
+      program += "if (x < " + std::to_string(random.next(1000)) + ") {\n";
+      for (uint32_t i = 0, statements = random.next(40); i < statements; ++i) {
+        program += "    x = x";
+        for (uint32_t j = 0, terms = 1 + random.next(4); j < terms; ++j) {
+          program += kOperators[random.next(3)];
+          program += std::to_string(random.next(100000));
+        }
+        program += ";\n";
+      }
+      program += "    x\n  }";
+    }
+    program += ";\n";
+  }
+  program += "  x\n}\n";
+  return program;
+}
+
+int main(int argc, const char** argv) {
+  std::string input = generateProgram(benchInputSize(argc, argv, 8));
+  TokenBuffer tokens = lexIntoBuffer(input);
+  printf("%zu bytes, %zu tokens\n", input.size(), tokens.size());
+
+  double seconds = bestOf(5, [&] { parseStreaming(input); });
+  reportThroughput("lex + parse (streaming)", input.size(), seconds);
+
+  TokenPipeline::Stats stats;
+  seconds = bestOf(5, [&] { stats = parsePipelined(input); });
+  reportThroughput("lex + parse (pipelined)", input.size(), seconds);
+  reportThroughput("  lexer stage", stats.bytes, stats.lexSeconds);
+  reportThroughput("  parser stage", stats.bytes, stats.consumeSeconds);
+  printf("  lexer waited %.1f ms, parser waited %.1f ms\n",
+         stats.lexerWaitSeconds * 1000, stats.consumerWaitSeconds * 1000);
+
+  seconds = bestOf(5, [&] { lexIntoBuffer(input); });
+  reportThroughput("lex into TokenBuffer", input.size(), seconds);
+
+  seconds = bestOf(5, [&] { parseFromBuffer(tokens); });
+  reportThroughput("parse from TokenBuffer", input.size(), seconds);
+
+  seconds = bestOf(5, [&] { parseFromBuffer(lexIntoBuffer(input)); });
+  reportThroughput("lex + parse (TokenBuffer)", input.size(), seconds);
+
+  input = generateExpressionProgram(benchInputSize(argc, argv, 8));
+  tokens = lexIntoBuffer(input);
+  printf("%zu bytes, %zu tokens\n", input.size(), tokens.size());
+
+  seconds = bestOf(5, [&] { parseFromBuffer(tokens); });
+  reportThroughput("parse deep expressions", input.size(), seconds);
+
+  input = generateBranchyProgram(benchInputSize(argc, argv, 8));
+  tokens = lexIntoBuffer(input);
+  printf("%zu bytes, %zu tokens\n", input.size(), tokens.size());
+
+  seconds = bestOf(5, [&] { parseFromBuffer(tokens); });
+  reportThroughput("parse branches", input.size(), seconds);
+
+  seconds = bestOf(5, [&] { parseFromBuffer(tokens, true); });
+  reportThroughput("parse branches (lazy)", input.size(), seconds);
+
+  seconds = bestOf(5, [&] { parseAndVisitAll(tokens, false); });
+  reportThroughput("parse + visit branches", input.size(), seconds);
+
+  seconds = bestOf(5, [&] { parseAndVisitAll(tokens, true); });
+  reportThroughput("parse + visit branches (lazy)", input.size(), seconds);
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <memory>
+#include <string>
+#include "BenchUtils.h"
+#include "ExecutionContext.h"
+#include "Parser.h"
+#include "Program.h"
+#include "TokenBuffer.h"
+
+static std::unique_ptr<Program> compile(const std::string& input,
+                                        ExecutionEngine engine) {
+  BufferReader reader(input);
+  Tokenizer tokenizer(reader);
+  Parser parser(tokenizer);
+  ast::Node* root = parser.parse();
+  if (!root)
+    abort();
+  auto program = Program::fromAST(*root, engine);
+  if (!program)
+    abort();
+  return program.unwrap();
+}
+
+// Runs `program` `repeat` times. Times are per instruction of the stack
+// machine for both engines, so that they're comparable.
+static void execute(const char* name,
+                    Program& program,
+                    std::size_t instructions,
+                    std::size_t repeat) {
+  double seconds = bestOf(5, [&] {
+    for (std::size_t i = 0; i < repeat; ++i) {
+      std::unique_ptr<ExecutionContext> ctx =
+          ExecutionContext::createDefault();
+      if (!program.execute(*ctx))
+        abort();
+    }
+  });
+  printf("%-32s %10.2f ns/instruction\n", name,
+         seconds * 1e9 / (instructions * repeat));
+}
+
+// Runs a program made of `size` bytes of source code `repeat` times, so that
+// programs of all sizes execute the same number of instructions. Small
+// programs stay in the caches, big ones stream through memory.
+static void benchmark(std::size_t size, std::size_t repeat) {
+  std::string input = generateProgram(size);
+  std::unique_ptr<Program> program = compile(input, ExecutionEngine::Stack);
+  std::unique_ptr<Program> registerProgram =
+      compile(input, ExecutionEngine::Register);
+
+  const CompactBytecode& bytecode = program->bytecode();
+  std::vector<Bytecode> expanded = bytecode.decode();
+  std::size_t instructions = 0;
+  std::size_t loads = 0;
+  for (const Bytecode& b : expanded) {
+    if (b.kind() != BytecodeKind::Instruction)
+      continue;
+    instructions++;
+    loads += b.instruction() == Instruction::Load;
+  }
+
+  printf("%zu KiB of source, %zu instructions\n", input.size() / 1024,
+         instructions);
+  printf("%-32s %10zu KiB\n", "bytecode array",
+         expanded.size() * sizeof(Bytecode) / 1024);
+  printf("%-32s %10zu KiB\n", "compact code",
+         bytecode.code().size() / 1024);
+  printf("%-32s %10zu KiB, %zu of %zu loads\n", "constant pool",
+         bytecode.constants().size() * sizeof(Value) / 1024,
+         bytecode.constants().size(), loads);
+
+  const RegisterCode& registerCode = registerProgram->registerCode();
+  printf("%-32s %10zu instructions, %u registers\n", "register code",
+         registerCode.instructionCount(), registerCode.registerCount());
+  printf("%-32s %10zu KiB\n", "", registerCode.code().size() / 1024);
+
+  execute("execute (stack)", *program, instructions, repeat);
+  execute("execute (registers)", *registerProgram, instructions, repeat);
+}
+
+int main(int argc, const char** argv) {
+  const std::size_t size = benchInputSize(argc, argv, 8);
+  for (std::size_t small = 16 * 1024; small < size; small *= 16)
+    benchmark(small, size / small);
+  benchmark(size, 1);
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+#include <string>
+#include <thread>
+#include "BenchUtils.h"
+#include "ParallelTokenizer.h"
+#include "ScanKernels.h"
+#include "TokenFile.h"
+#include "Tokenizer.h"
+
+static std::size_t lexAll(const std::string& input) {
+  BufferReader reader(input);
+  Tokenizer tokenizer(reader);
+  std::size_t count = 0;
+  while (true) {
+    Optional<Token> token = tokenizer.nextToken();
+    if (!token || token->type() == TokenType::Eof)
+      break;
+    count++;
+  }
+  return count;
+}
+
+static const char* kernelName(ScanKernelKind kind) {
+  switch (kind) {
+    case ScanKernelKind::Scalar:
+      return "tokenize (scalar)";
+    case ScanKernelKind::SSE2:
+      return "tokenize (sse2)";
+    case ScanKernelKind::AVX2:
+      return "tokenize (avx2)";
+  }
+  return "?";
+}
+
+static void replaceAll(std::string& input,
+                       const std::string& from,
+                       const std::string& to) {
+  std::string result;
+  std::size_t last = 0;
+  for (std::size_t pos = input.find(from); pos != std::string::npos;
+       pos = input.find(from, last)) {
+    result.append(input, last, pos - last);
+    result += to;
+    last = pos + from.size();
+  }
+  result.append(input, last, std::string::npos);
+  input = std::move(result);
+}
+
+static void benchmark(const char* name, const std::string& input) {
+  printf("%s: %zu bytes, %zu tokens\n", name, input.size(), lexAll(input));
+  for (ScanKernelKind kind : {ScanKernelKind::Scalar, ScanKernelKind::SSE2,
+                              ScanKernelKind::AVX2}) {
+    if (!scanKernelsSupported(kind))
+      continue;
+    setScanKernels(kind);
+    double seconds = bestOf(5, [&] { lexAll(input); });
+    reportThroughput(kernelName(kind), input.size(), seconds);
+  }
+}
+
+// A program made mostly of numeric literals, like tables of generated
+// constants.
+static std::string generateNumericProgram(std::size_t approximateSize) {
+  BenchRandom random(7);
+  std::string program = "{\n";
+  while (program.size() < approximateSize) {
+    program += "  table = table";
+    for (uint32_t i = 0; i < 8; ++i) {
+      program += " + " + std::to_string(random.next());
+      program += " * " + std::to_string(random.next(1000)) + "." +
+                 std::to_string(random.next());
+    }
+    program += ";\n";
+  }
+  program += "  table\n}\n";
+  return program;
+}
+
+static void benchmarkParallel(const std::string& input) {
+  printf("parallel, %u hardware threads\n",
+         std::thread::hardware_concurrency());
+  for (unsigned threads : {1, 2, 4, 8, 16}) {
+    double seconds = bestOf(5, [&] {
+      BufferReader reader(input);
+      SymbolTable symbols;
+      tokenizeInParallel(reader, symbols, threads);
+    });
+    std::string name = "tokenize (" + std::to_string(threads) + " threads)";
+    reportThroughput(name.c_str(), input.size(), seconds);
+  }
+}
+
+// Loading a token file, compared to lexing the source it was written from.
+// Throughput is relative to the size of the source in both cases.
+static void benchmarkTokenFile(const std::string& input) {
+  BufferReader reader(input);
+  Tokenizer tokenizer(reader);
+  TokenBuffer tokens = TokenBuffer::lexAll(tokenizer);
+  std::string file;
+  double seconds = bestOf(5, [&] {
+    std::ostringstream stream;
+    TokenFileWriter writer(stream);
+    writer.write(tokens);
+    writer.flush();
+    file = stream.str();
+  });
+  printf("token file: %zu bytes\n", file.size());
+  reportThroughput("write token file", input.size(), seconds);
+
+  seconds = bestOf(5, [&] {
+    BufferReader reader(input);
+    Tokenizer tokenizer(reader);
+    TokenBuffer::lexAll(tokenizer);
+  });
+  reportThroughput("tokenize into buffer", input.size(), seconds);
+  seconds = bestOf(5, [&] { TokenFile::read(file.data(), file.size()); });
+  reportThroughput("read token file", input.size(), seconds);
+}
+
+int main(int argc, const char** argv) {
+  std::string input = generateProgram(benchInputSize(argc, argv, 32));
+  benchmark("compact input", input);
+  benchmarkParallel(input);
+  benchmarkTokenFile(input);
+
+  benchmark("numeric input",
+            generateNumericProgram(benchInputSize(argc, argv, 32)));
+
+  // Without spaces, so that every other token is an operator or punctuation.
+  std::string dense = input;
+  replaceAll(dense, " ", "");
+  benchmark("dense input", dense);
+
+  // Pretty-printed generated code, with deep indentation and long names.
+  replaceAll(input, "\n  ", "\n" + std::string(32, ' '));
+  replaceAll(input, "variable_", "some_rather_long_generated_variable_");
+  input.resize(benchInputSize(argc, argv, 32));
+  input.resize(input.rfind('\n'));
+  benchmark("indented input", input);
+}
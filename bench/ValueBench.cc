@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "BenchUtils.h"
+#include "ExecutionContext.h"
+#include "Parser.h"
+#include "Program.h"
+
+// Build with and without `-DNAN_BOXED_VALUES=ON` to compare both value
+// representations.
+
+// Runs an arithmetic loop the way the machines do it: checking the types of
+// both operands and boxing the result, over arrays of values that get bigger
+// than the caches.
+template <typename Op>
+static void loop(const char* name,
+                 std::vector<Value>& values,
+                 const std::vector<Value>& operands,
+                 std::size_t repeat,
+                 Op op) {
+  double seconds = bestOf(5, [&] {
+    for (std::size_t i = 0; i < repeat; ++i) {
+      for (std::size_t j = 0; j < values.size(); ++j) {
+        const Value& l = values[j];
+        const Value& r = operands[j];
+        if (l.type() != r.type())
+          abort();
+        values[j] = op(l, r);
+      }
+    }
+  });
+  printf("%-32s %10.2f ns/operation\n", name,
+         seconds * 1e9 / (values.size() * repeat));
+}
+
+static void arithmetic(std::size_t count, std::size_t repeat) {
+  printf("%zu values, %zu KiB\n", count, count * sizeof(Value) / 1024);
+
+  BenchRandom random(42);
+  std::vector<Value> ints, intOperands;
+  std::vector<Value> doubles, doubleOperands;
+  for (std::size_t i = 0; i < count; ++i) {
+    ints.push_back(Value::createInt(random.next(1000)));
+    intOperands.push_back(Value::createInt(random.next(1000)));
+    doubles.push_back(Value::createDouble(random.next(1000) / 7.));
+    doubleOperands.push_back(Value::createDouble(random.next(1000) / 7.));
+  }
+
+  loop("integer add", ints, intOperands, repeat,
+       [](const Value& l, const Value& r) {
+         if (l.type() != ValueType::Integer)
+           abort();
+         // Keep the values small, so that they don't overflow.
+         return Value::createInt((l.intValue() + r.intValue()) & 0xffff);
+       });
+  loop("double multiply-add", doubles, doubleOperands, repeat,
+       [](const Value& l, const Value& r) {
+         if (l.type() != ValueType::Float)
+           abort();
+         return Value::createDouble(l.doubleValue() * 0.5 + r.doubleValue());
+       });
+}
+
+// Runs the generated program on both machines, which also stores values to
+// variables and the stack.
+static void program(std::size_t size, std::size_t repeat) {
+  std::string input = generateProgram(size);
+  for (ExecutionEngine engine :
+       {ExecutionEngine::Stack, ExecutionEngine::Register}) {
+    BufferReader reader(input);
+    Tokenizer tokenizer(reader);
+    Parser parser(tokenizer);
+    ast::Node* root = parser.parse();
+    if (!root)
+      abort();
+    auto result = Program::fromAST(*root, engine);
+    if (!result)
+      abort();
+    std::unique_ptr<Program> program = result.unwrap();
+    double seconds = bestOf(5, [&] {
+      for (std::size_t i = 0; i < repeat; ++i) {
+        std::unique_ptr<ExecutionContext> ctx =
+            ExecutionContext::createDefault();
+        if (!program->execute(*ctx))
+          abort();
+      }
+    });
+    printf("%-32s %10.2f ms\n",
+           engine == ExecutionEngine::Stack ? "program (stack)"
+                                            : "program (registers)",
+           seconds * 1e3);
+  }
+}
+
+int main(int argc, const char** argv) {
+  const std::size_t size = benchInputSize(argc, argv, 8);
+  printf("sizeof(Value) = %zu\n", sizeof(Value));
+  for (std::size_t count = 1024; count * 8 <= size; count *= 32)
+    arithmetic(count, size / 8 / count);
+  printf("%zu KiB of source\n", size / 1024);
+  program(size, 1);
+}
@@ -16,27 +16,104 @@
  */
 
 #include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include "AST.h"
 #include "FileReader.h"
+#include "FlatAST.h"
+#include "LineTable.h"
 #include "Parser.h"
+#include "TokenFile.h"
+#include "TokenPipeline.h"
 #include "Tokenizer.h"
 
 // TODO(emilio): This should probably become a proper unit test with gtest or
 // something like that.
 
-int main(int, const char**) {
-  FileReader reader(stdin, false);
-  Tokenizer tokenizer(reader);
-  Parser parser(tokenizer);
-
-  if (ast::Node* node = parser.parse()) {
+// Errors are located in `source` if we have it, or by byte offset otherwise.
+static int dump(const ast::Node* node,
+                const Parser& parser,
+                Reader* source,
+                const char* flatAstFile) {
+  if (node && flatAstFile) {
+    std::ofstream out(flatAstFile, std::ios::binary);
+    ast::FlatTree::build(*node).write(out);
+    if (!out) {
+      std::cerr << "Couldn't write " << flatAstFile << std::endl;
+      return 1;
+    }
+  } else if (node) {
     ast::ASTDumper dumper(std::cout);
     node->dump(dumper);
   } else if (const ParseError* error = parser.error()) {
-    std::cout << "parse error @ " << error->location() << ": "
-              << error->message() << std::endl;
+    std::cout << "parse error @ ";
+    if (source)
+      std::cout << LineTable(*source).locate(error->location());
+    else
+      std::cout << "offset " << error->location().offset;
+    std::cout << ": " << error->message() << std::endl;
   } else {
     assert(false && "How!");
   }
+  return 0;
+}
+
+// With `--pipelined`, lexes on a separate thread while parsing.
+//
+// With `--tokens <file>`, parses a token file written by `Tokenizer --binary`
+// instead of lexing stdin.
+//
+// With `--flat-ast <file>`, writes the tree to a file that `RunProgram --ast`
+// can use without parsing, instead of dumping it.
+int main(int argc, const char** argv) {
+  bool pipelined = false;
+  const char* tokensFile = nullptr;
+  const char* flatAstFile = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--pipelined")) {
+      pipelined = true;
+    } else if (!strcmp(argv[i], "--tokens") && i + 1 < argc) {
+      tokensFile = argv[++i];
+    } else if (!strcmp(argv[i], "--flat-ast") && i + 1 < argc) {
+      flatAstFile = argv[++i];
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--pipelined] [--tokens <file>] [--flat-ast <file>]\n";
+      return 1;
+    }
+  }
+
+  if (tokensFile) {
+    FileReader tokenReader(tokensFile);
+    auto tokenFile = TokenFile::read(tokenReader);
+    if (const char* error = tokenReader.error()) {
+      std::cerr << "Couldn't read " << tokensFile << ": " << error << std::endl;
+      return 1;
+    }
+    if (!tokenFile) {
+      std::cerr << "Couldn't read " << tokensFile << ": "
+                << tokenFile.unwrapErr() << std::endl;
+      return 1;
+    }
+    std::unique_ptr<TokenFile> file = tokenFile.unwrap();
+    Parser parser(file->tokens());
+    return dump(parser.parse(), parser, nullptr, flatAstFile);
+  }
+
+  FileReader reader(stdin, false);
+  Tokenizer tokenizer(reader);
+  std::unique_ptr<TokenPipeline> pipeline;
+  if (pipelined)
+    pipeline.reset(new TokenPipeline(tokenizer));
+  Parser parser = pipeline ? Parser(*pipeline) : Parser(tokenizer);
+
+  ast::Node* node = parser.parse();
+  // Make sure the lexer thread is done with the reader and the symbol table.
+  pipeline.reset();
+  if (const char* error = reader.error()) {
+    std::cerr << "Couldn't read the input: " << error << std::endl;
+    return 1;
+  }
+  return dump(node, parser, &reader, flatAstFile);
 }
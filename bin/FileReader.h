@@ -17,28 +17,114 @@
 
 #pragma once
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include "Tokenizer.h"
 
+// A reader over a file handle.
+//
+// Regular files are memory-mapped, so that the whole input is available from
+// the beginning. Anything else (pipes, terminals...) is read in large blocks
+// using read(2) into a growing buffer.
+//
+// Errors opening or reading the file end the input early, check `error()`
+// once done with it.
 class FileReader final : public Reader {
+  static const std::size_t kReadBlockSize = 1 << 20;
+
   FILE* m_file;
   bool m_ownsHandle;
+  bool m_eof{false};
+  const char* m_error{nullptr};
+
+  // The mapping, if the file was memory-mapped.
+  void* m_mapping{nullptr};
+  std::size_t m_mappingLength{0};
+
+  // Otherwise, the buffer we read(2) into.
+  char* m_buffer{nullptr};
+  std::size_t m_capacity{0};
+
+  bool tryMap() {
+    int fd = fileno(m_file);
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= 0)
+      return false;
+
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    if (start < 0 || start > info.st_size)
+      return false;
+
+    void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED)
+      return false;
+
+    madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+    m_mapping = mapping;
+    m_mappingLength = info.st_size;
+    m_data = static_cast<const char*>(mapping) + start;
+    m_size = info.st_size - start;
+    return true;
+  }
 
  public:
-  FileReader(FILE* handle, bool owns) : m_file(handle), m_ownsHandle(owns) {}
+  FileReader(FILE* handle, bool owns) : m_file(handle), m_ownsHandle(owns) {
+    if (!m_file)
+      m_error = strerror(errno);
+    if (!m_file || tryMap())
+      m_eof = true;
+  }
 
   FileReader(const char* name) : FileReader(fopen(name, "r"), true) {}
 
-  char next() override {
-    if (!m_file || feof(m_file))
-      return 0;
-    char next = fgetc(m_file);
-    if (next == EOF)
-      return 0;
-    return next;
+  // Why the input ended early, if it did.
+  const char* error() const { return m_error; }
+
+  bool fill() override {
+    if (m_eof)
+      return false;
+
+    if (m_capacity - m_size < kReadBlockSize) {
+      const std::size_t capacity =
+          std::max(m_capacity * 2, m_size + kReadBlockSize);
+      char* buffer = static_cast<char*>(realloc(m_buffer, capacity));
+      if (!buffer) {
+        m_error = "Out of memory";
+        m_eof = true;
+        return false;
+      }
+      m_buffer = buffer;
+      m_capacity = capacity;
+      m_data = m_buffer;
+    }
+
+    while (true) {
+      ssize_t result =
+          read(fileno(m_file), m_buffer + m_size, m_capacity - m_size);
+      if (result < 0 && errno == EINTR)
+        continue;
+      if (result < 0)
+        m_error = strerror(errno);
+      if (result <= 0) {
+        m_eof = true;
+        return false;
+      }
+      m_size += result;
+      return true;
+    }
   }
 
   ~FileReader() override {
+    if (m_mapping)
+      munmap(m_mapping, m_mappingLength);
+    free(m_buffer);
     if (m_ownsHandle && m_file)
       fclose(m_file);
   }
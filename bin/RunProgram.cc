@@ -15,33 +15,34 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cstring>
 #include <iostream>
 
 #include "AST.h"
 #include "ExecutionContext.h"
+#include "FlatAST.h"
 #include "FileReader.h"
+#include "LineTable.h"
 #include "Parser.h"
 #include "Program.h"
+#include "TokenFile.h"
 #include "Tokenizer.h"
 
-int main(int argc, const char** argv) {
-  if (argc < 2) {
-    std::cerr << "Need at least a filename.\n";
-    return 1;
-  }
-  FileReader reader(argv[1]);
-  Tokenizer tokenizer(reader);
-  Parser parser(tokenizer);
-
+static Result<std::unique_ptr<Program>, ProgramCreationError> compile(
+    Parser& parser,
+    bool streaming,
+    ExecutionEngine engine) {
+  if (streaming)
+    return Program::compileStreaming(parser, engine);
   ast::Node* node = parser.parse();
-  if (!node) {
-    const ParseError* error = parser.error();
-    std::cerr << "parse error @ " << error->location() << ": "
-              << error->message() << std::endl;
-    return 1;
-  }
+  if (!node)
+    return ProgramCreationError(std::string(parser.error()->message()));
+  return Program::fromAST(*node, engine);
+}
 
-  auto programResult = Program::fromAST(*node);
+// Runs the program and prints its result.
+static int run(
+    Result<std::unique_ptr<Program>, ProgramCreationError>&& programResult) {
   if (!programResult) {
     // FIXME(emilio): Meaningful error!
     std::cerr << "Couldn't create program: "
@@ -70,3 +71,88 @@ int main(int argc, const char** argv) {
 
   return 0;
 }
+
+// With `--streaming`, compiles each statement as soon as it's parsed, instead
+// of parsing the whole program first.
+//
+// With `--tokens`, the file is a token file written by `Tokenizer --binary`
+// instead of source code.
+//
+// With `--ast`, the file is a flat AST written by `Dumper --flat-ast`, which
+// is compiled straight from the mapped file.
+//
+// With `--registers`, runs the program on the register machine.
+int main(int argc, const char** argv) {
+  bool streaming = false;
+  bool tokens = false;
+  bool flatAst = false;
+  ExecutionEngine engine = ExecutionEngine::Stack;
+  const char* filename = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--streaming"))
+      streaming = true;
+    else if (!strcmp(argv[i], "--tokens"))
+      tokens = true;
+    else if (!strcmp(argv[i], "--ast"))
+      flatAst = true;
+    else if (!strcmp(argv[i], "--registers"))
+      engine = ExecutionEngine::Register;
+    else
+      filename = argv[i];
+  }
+  if (!filename) {
+    std::cerr << "Need at least a filename.\n";
+    return 1;
+  }
+  FileReader reader(filename);
+
+  if (flatAst) {
+    while (reader.fill()) {
+    }
+    if (const char* error = reader.error()) {
+      std::cerr << "Couldn't read " << filename << ": " << error << std::endl;
+      return 1;
+    }
+    auto tree = ast::FlatTree::map(reader.data(), reader.size());
+    if (!tree) {
+      std::cerr << "Couldn't read " << filename << ": " << tree.unwrapErr()
+                << std::endl;
+      return 1;
+    }
+    return run(Program::fromFlatTree(tree.unwrap(), engine));
+  }
+
+  std::unique_ptr<TokenFile> tokenFile;
+  if (tokens) {
+    auto result = TokenFile::read(reader);
+    if (const char* error = reader.error()) {
+      std::cerr << "Couldn't read " << filename << ": " << error << std::endl;
+      return 1;
+    }
+    if (!result) {
+      std::cerr << "Couldn't read " << filename << ": " << result.unwrapErr()
+                << std::endl;
+      return 1;
+    }
+    tokenFile = result.unwrap();
+  }
+  Tokenizer tokenizer(reader);
+  Parser parser = tokenFile ? Parser(tokenFile->tokens()) : Parser(tokenizer);
+
+  auto programResult = compile(parser, streaming, engine);
+  if (const char* error = reader.error()) {
+    std::cerr << "Couldn't read " << filename << ": " << error << std::endl;
+    return 1;
+  }
+  if (const ParseError* error = parser.error()) {
+    std::cerr << "parse error @ ";
+    if (tokenFile)
+      std::cerr << "offset " << error->location().offset;
+    else
+      std::cerr << LineTable(reader).locate(error->location());
+    std::cerr << ": " << error->message() << std::endl;
+    return 1;
+  }
+
+  return run(std::move(programResult));
+}
@@ -17,25 +17,132 @@
 
 #include "Tokenizer.h"
 #include <cstdio>
+#include <cstring>
 #include <iostream>
 #include "FileReader.h"
+#include "LineTable.h"
+#include "ParallelTokenizer.h"
+#include "StreamingTokenizer.h"
+#include "TokenFile.h"
 
 // TODO(emilio): This should probably become a proper unit test with gtest or
 // something like that.
 
-int main(int, const char**) {
-  FileReader reader(stdin, false);
-  Tokenizer tokenizer(reader);
+// With `--parallel`, lexes the whole input up front using all the available
+// threads instead.
+//
+// With `--binary`, the tokens are written as a token file instead, which
+// `Dumper` and `RunProgram` can read with `--tokens`.
+static int dumpTokensInParallel(FileReader& reader, TokenFileWriter* binary) {
+  TokenBuffer tokens = tokenizeInParallel(reader);
+  if (const char* error = reader.error()) {
+    std::cerr << "Couldn't read the input: " << error << std::endl;
+    return 1;
+  }
+  if (binary) {
+    binary->write(tokens);
+    return 0;
+  }
+  for (std::size_t i = 0; i < tokens.size(); ++i)
+    std::cout << tokens.at(i) << '\n';
+  if (!tokens.isComplete()) {
+    std::cout << "Tokenizer error: " << tokens.errorMessage() << " @ "
+              << LineTable(reader).locate(tokens.errorLocation())
+              << std::endl;
+  }
+  return 0;
+}
+
+// The location of `within` in a chunk that starts at `start`.
+static LineColumn relativeTo(const LineColumn& start, const LineColumn& within) {
+  if (within.line)
+    return LineColumn{start.line + within.line, within.column};
+  return LineColumn{start.line, start.column + within.column};
+}
+
+// Otherwise, the input is streamed through a fixed-size buffer, so that
+// arbitrarily big inputs can be lexed in constant memory.
+static int dumpTokensStreaming(int fd, TokenFileWriter* binary) {
+  static char buffer[64 * 1024];
+  StreamingTokenizer tokenizer;
+
+  // Where the current chunk starts, for error reporting.
+  LineColumn chunkStart{0, 0};
+  std::size_t chunkOffset = 0;
+  std::size_t chunkSize = 0;
 
   while (true) {
     Optional<Token> token = tokenizer.nextToken();
-    if (!token) {
-      std::cout << "Tokenizer error: " << tokenizer.errorMessage() << " @ "
-                << tokenizer.location() << std::endl;
+    if (token) {
+      if (binary)
+        binary->write(*token);
+      else
+        std::cout << *token << '\n';
+      if (token->type() == TokenType::Eof)
+        break;
+      continue;
+    }
+
+    if (binary && tokenizer.errorMessage()) {
+      binary->writeError(tokenizer.errorMessage(), tokenizer.location());
       break;
     }
-    std::cout << *token << std::endl;
-    if (token->type() == TokenType::Eof)
+
+    LineTable lines(buffer, chunkSize);
+    if (const char* error = tokenizer.errorMessage()) {
+      // Locations are capped at `kMaxSourceSize`, which may be before the
+      // chunk for too large inputs.
+      const std::size_t offset = tokenizer.location().offset;
+      LineColumn location =
+          lines.locate(offset > chunkOffset ? offset - chunkOffset : 0);
+      std::cout << "Tokenizer error: " << error << " @ "
+                << relativeTo(chunkStart, location) << std::endl;
       break;
+    }
+
+    // Done with the current chunk, read the next one.
+    chunkStart = relativeTo(chunkStart, lines.locate(chunkSize));
+    chunkOffset += chunkSize;
+
+    ssize_t result;
+    do {
+      result = read(fd, buffer, sizeof(buffer));
+    } while (result < 0 && errno == EINTR);
+    if (result < 0) {
+      std::cout.flush();
+      std::cerr << "Couldn't read the input: " << strerror(errno) << std::endl;
+      return 1;
+    }
+    chunkSize = result;
+    tokenizer.feed(buffer, chunkSize);
+    if (!result)
+      tokenizer.finish();
   }
+  return 0;
+}
+
+int main(int argc, const char** argv) {
+  bool parallel = false;
+  bool binary = false;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--parallel")) {
+      parallel = true;
+    } else if (!strcmp(argv[i], "--binary")) {
+      binary = true;
+    } else {
+      std::cerr << "Usage: " << argv[0] << " [--parallel] [--binary]\n";
+      return 1;
+    }
+  }
+
+  std::unique_ptr<TokenFileWriter> writer;
+  if (binary)
+    writer.reset(new TokenFileWriter(std::cout));
+
+  if (parallel) {
+    FileReader reader(stdin, false);
+    return dumpTokensInParallel(reader, writer.get());
+  }
+
+  return dumpTokensStreaming(fileno(stdin), writer.get());
 }
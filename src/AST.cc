@@ -14,200 +14,364 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-
 #include "AST.h"
 #include <cmath>
+#include <deque>
+#include "ASTWalker.h"
 #include "BytecodeCollector.h"
 
 namespace ast {
 
-void ConstantExpression::dump(ASTDumper dumper) const {
+void ConstantExpression::dumpSelf(ASTDumper& dumper) const {
   dumper << name() << " " << m_value;
 }
 
-void VariableBinding::dump(ASTDumper dumper) const {
-  dumper << name() << " " << m_name;
+void VariableBinding::dumpSelf(ASTDumper& dumper) const {
+  dumper << name() << " " << SymbolTable::global().name(m_name);
 }
 
-void BinaryOperation::dump(ASTDumper dumper) const {
+void BinaryOperation::dumpSelf(ASTDumper& dumper) const {
   dumper << name() << "(" << m_op << ")";
-  m_lhs->dump(dumper);
-  m_rhs->dump(dumper);
 }
 
-void UnaryOperation::dump(ASTDumper dumper) const {
+void UnaryOperation::dumpSelf(ASTDumper& dumper) const {
   dumper << name() << "(" << m_op << ")";
-  m_rhs->dump(dumper);
 }
 
-void Statement::dump(ASTDumper dumper) const {
+void Statement::dumpSelf(ASTDumper& dumper) const {
+  dumper << name();
+}
+
+void Block::dumpSelf(ASTDumper& dumper) const {
   dumper << name();
-  m_inner->dump(dumper);
 }
 
-void Block::dump(ASTDumper dumper) const {
+void LazyBlock::dumpSelf(ASTDumper& dumper) const {
   dumper << name();
-  for (const auto& statement : m_statements)
-    statement->dump(dumper);
-  if (m_lastExpression)
-    m_lastExpression->dump(dumper);
 }
 
-void FunctionCall::dump(ASTDumper dumper) const {
-  dumper << name() << "(" << m_name << ")";
-  for (const auto& arg : m_arguments)
-    arg->dump(dumper);
+void FunctionCall::dumpSelf(ASTDumper& dumper) const {
+  dumper << name() << "(" << SymbolTable::global().name(m_name) << ")";
 }
 
-void ParenthesizedExpression::dump(ASTDumper dumper) const {
+void ParenthesizedExpression::dumpSelf(ASTDumper& dumper) const {
   dumper << name();
-  m_inner->dump(dumper);
 }
 
-void ConditionalExpression::dump(ASTDumper dumper) const {
+void ConditionalExpression::dumpSelf(ASTDumper& dumper) const {
   dumper << name();
-  if (m_condition)
-    m_condition->dump(dumper);
-  m_innerExpression->dump(dumper);
-  if (m_else)
-    m_else->dump(dumper);
 }
 
-void ForLoop::dump(ASTDumper dumper) const {
+void ForLoop::dumpSelf(ASTDumper& dumper) const {
   dumper << name();
-  if (m_init)
-    m_init->dump(dumper);
-  if (m_condition)
-    m_condition->dump(dumper);
-  if (m_afterClause)
-    m_afterClause->dump(dumper);
-  m_body->dump(dumper);
-}
-
-static Optional<BuiltinFunction>
-builtinFunctionFromName(const std::string& name) {
-  if (name == "cos")
-    return Some(BuiltinFunction::Cos);
-  if (name == "sin")
-    return Some(BuiltinFunction::Sin);
-  if (name == "abs")
-    return Some(BuiltinFunction::Abs);
-  if (name == "sqrt")
-    return Some(BuiltinFunction::Sqrt);
-  if (name == "pow")
-    return Some(BuiltinFunction::Pow);
-  return None;
-}
-
-BytecodeCollectionResult
-FunctionCall::toByteCode(BytecodeCollector& collector) const {
-  auto functionId = builtinFunctionFromName(m_name);
-  if (!functionId)
-    return std::string("Unknown function: ") + m_name;
-  BytecodeCollectionStatus status = BytecodeCollectionStatus::DidntPush;
-  for (auto it = m_arguments.rbegin(); it != m_arguments.rend(); ++it) {
-    TRY_VAR(status, (*it)->toByteCode(collector));
-    if (status == BytecodeCollectionStatus::DidntPush)
-      return std::string("Argument didn't leave a value on the stack...");
-  }
-  collector.pushFunctionCall(*functionId, m_arguments.size());
-  return BytecodeCollectionStatus::PushedToStack;
 }
 
+uint32_t childCount(const Node& node) {
+  switch (node.kind()) {
+    case NodeType::ConstantExpression:
+    case NodeType::VariableBinding:
+      return 0;
+    case NodeType::UnaryOperation:
+    case NodeType::Statement:
+    case NodeType::ParenthesizedExpression:
+    case NodeType::LazyBlock:
+      return 1;
+    case NodeType::BinaryOperation:
+      return 2;
+    case NodeType::ConditionalExpression:
+      return 3;
+    case NodeType::ForLoop:
+      return 4;
+    case NodeType::Block:
+      // The statements, plus the last expression.
+      return toBlock(node).statements().size() + 1;
+    case NodeType::FunctionCall:
+      return toFunctionCall(node).arguments().size();
+    case NodeType::Expression:
+      break;
+  }
+  assert(false && "Unexpected node kind");
+  return 0;
+}
 
-BytecodeCollectionResult ConstantExpression::toByteCode(
-    BytecodeCollector& collector) const {
-  collector.pushToStack(m_value);
-  return BytecodeCollectionStatus::PushedToStack;
+const Node* child(const Node& node, uint32_t index) {
+  assert(index < childCount(node));
+  switch (node.kind()) {
+    case NodeType::ConstantExpression:
+    case NodeType::VariableBinding:
+    case NodeType::Expression:
+      break;
+    case NodeType::UnaryOperation:
+      return &toUnaryOperation(node).operand();
+    case NodeType::Statement:
+      return &toStatement(node).inner();
+    case NodeType::ParenthesizedExpression:
+      return &toParenthesizedExpression(node).inner();
+    case NodeType::BinaryOperation: {
+      const BinaryOperation& op = toBinaryOperation(node);
+      return index ? &op.rhs() : &op.lhs();
+    }
+    case NodeType::ConditionalExpression: {
+      const ConditionalExpression& conditional = toConditionalExpression(node);
+      const Node* children[] = {conditional.condition(),
+                                &conditional.innerExpression(),
+                                conditional.elseBranch()};
+      return children[index];
+    }
+    case NodeType::ForLoop: {
+      const ForLoop& loop = toForLoop(node);
+      const Node* children[] = {loop.init(), loop.condition(),
+                                loop.afterClause(), &loop.body()};
+      return children[index];
+    }
+    case NodeType::Block: {
+      const Block& block = toBlock(node);
+      if (index < block.statements().size())
+        return block.statements()[index];
+      return block.lastExpression();
+    }
+    case NodeType::LazyBlock:
+      // Parses the block, if needed.
+      return toLazyBlock(node).block();
+    case NodeType::FunctionCall:
+      return toFunctionCall(node).arguments()[index];
+  }
+  assert(false && "Unexpected node kind");
+  return nullptr;
 }
 
-BytecodeCollectionResult UnaryOperation::toByteCode(
-    BytecodeCollector& collector) const {
-  assert(m_op == Operator::Plus || m_op == Operator::Minus);
+// Keeps one dumper per level of the tree being dumped, so that nested dumpers
+// get created and destroyed in the same order as in a recursive dump.
+class DumpVisitor final {
+ public:
+  explicit DumpVisitor(ASTDumper& root) : m_root(root) {}
 
-  BytecodeCollectionStatus status;
-  if (m_op == Operator::Minus) {
-    collector.pushToStack(Value::createDouble(0.));
-    TRY_VAR(status, m_rhs->toByteCode(collector));
-    if (status != BytecodeCollectionStatus::PushedToStack)
-      return std::string("Expected an expression with a value");
-    collector.binOp(m_op);
-    return BytecodeCollectionStatus::PushedToStack;
+  bool visit(const Node& node, uint32_t& step, const Node*& next) {
+    if (!step) {
+      if (m_entered)
+        m_dumpers.emplace_back(current());
+      m_entered = true;
+      node.dumpSelf(current());
+    }
+    next = nextChild(node, step);
+    if (!next && !m_dumpers.empty())
+      m_dumpers.pop_back();
+    return true;
   }
 
-  TRY_VAR(status, m_rhs->toByteCode(collector));
-  if (status != BytecodeCollectionStatus::PushedToStack)
-    return std::string("Expected an expression with a value");
-  return BytecodeCollectionStatus::PushedToStack;
-}
+ private:
+  ASTDumper& current() { return m_dumpers.empty() ? m_root : m_dumpers.back(); }
 
-BytecodeCollectionResult Statement::toByteCode(
-    BytecodeCollector& collector) const {
-  BytecodeCollectionStatus status;
-  TRY_VAR(status, m_inner->toByteCode(collector));
-  if (status == BytecodeCollectionStatus::PushedToStack)
-    collector.popFromStack();
-  return BytecodeCollectionStatus::DidntPush;
+  ASTDumper& m_root;
+  // A deque, because dumpers can't be moved around.
+  std::deque<ASTDumper> m_dumpers;
+  bool m_entered{false};
+};
+
+void Node::dump(ASTDumper dumper) const {
+  DumpVisitor visitor(dumper);
+  walk(*this, visitor);
 }
 
-BytecodeCollectionResult Block::toByteCode(BytecodeCollector& collector) const {
-  BytecodeCollectionStatus status = BytecodeCollectionStatus::DidntPush;
-  collector.pushScope();
+// Generates the bytecode for a tree, keeping the status of the children
+// visited so far in a stack.
+class BytecodeVisitor final {
+ public:
+  explicit BytecodeVisitor(BytecodeCollector& collector)
+      : m_collector(collector) {}
+
+  bool visit(const Node&, uint32_t& step, const Node*& next);
 
-  for (const auto& statement : m_statements) {
-    TRY_VAR(status, statement->toByteCode(collector));
-    assert(status == BytecodeCollectionStatus::DidntPush);
+  BytecodeCollectionResult result() {
+    if (!m_error.empty())
+      return std::move(m_error);
+    assert(m_statuses.size() == 1);
+    BytecodeCollectionStatus status = m_statuses.back();
+    return status;
   }
 
-  if (m_lastExpression)
-    TRY_VAR(status, m_lastExpression->toByteCode(collector));
-
-  collector.popScope();
-  return status;
-}
-
-BytecodeCollectionResult BinaryOperation::toByteCode(
-    BytecodeCollector& collector) const {
-  BytecodeCollectionStatus status;
-
-  if (m_op == Operator::Equals) {
-    if (!isVariableBinding(*m_lhs))
-      return std::string("Assigned to something that was not a variable");
-    const VariableBinding& var = toVariableBinding(*m_lhs);
-    LabelId id = collector.reserveVariableIdFor(var.varName());
-    TRY_VAR(status, m_rhs->toByteCode(collector));
-    if (status != BytecodeCollectionStatus::PushedToStack)
-      return std::string(
-          "Expected rhs of expression to leave a value "
-          "in the stack");
-    collector.pushAssignTo(id);
-    return BytecodeCollectionStatus::PushedToStack;
+ private:
+  bool error(std::string&& message) {
+    m_error = std::move(message);
+    return false;
   }
 
-  TRY_VAR(status, m_lhs->toByteCode(collector));
-  if (status != BytecodeCollectionStatus::PushedToStack)
-    return std::string(
-        "Expected lhs of expression to leave a value in the stack");
-  TRY_VAR(status, m_rhs->toByteCode(collector));
-  if (status != BytecodeCollectionStatus::PushedToStack)
-    return std::string(
-        "Expected lhs of expression to leave a value in the stack");
-  collector.binOp(m_op);
-  return BytecodeCollectionStatus::PushedToStack;
-}
-
-BytecodeCollectionResult VariableBinding::toByteCode(
-    BytecodeCollector& collector) const {
-  Optional<LabelId> id = collector.resolveVariable(varName());
-  if (!id)
-    return std::string("Unresolved variable: ") + varName();
-  collector.pushLoadVar(*id);
-  return BytecodeCollectionStatus::PushedToStack;
-}
-
-BytecodeCollectionResult ParenthesizedExpression::toByteCode(
-    BytecodeCollector& collector) const {
-  return m_inner->toByteCode(collector);
+  // Pops the status of the last child visited, and returns whether it left a
+  // value in the stack.
+  bool childPushed() {
+    BytecodeCollectionStatus status = m_statuses.back();
+    m_statuses.pop_back();
+    return status == BytecodeCollectionStatus::PushedToStack;
+  }
+
+  bool pushed() {
+    m_statuses.push_back(BytecodeCollectionStatus::PushedToStack);
+    return true;
+  }
+
+  bool didntPush() {
+    m_statuses.push_back(BytecodeCollectionStatus::DidntPush);
+    return true;
+  }
+
+  BytecodeCollector& m_collector;
+  std::vector<BytecodeCollectionStatus> m_statuses;
+  // The variables being assigned to.
+  std::vector<LabelId> m_assignments;
+  std::string m_error;
+};
+
+bool BytecodeVisitor::visit(const Node& node,
+                            uint32_t& step,
+                            const Node*& next) {
+  switch (node.kind()) {
+    case NodeType::ConstantExpression:
+      m_collector.pushToStack(toConstantExpression(node).value());
+      return pushed();
+    case NodeType::VariableBinding: {
+      SymbolId name = toVariableBinding(node).varName();
+      Optional<LabelId> id = m_collector.resolveVariable(name);
+      if (!id)
+        return error(std::string("Unresolved variable: ") +
+                     std::string(SymbolTable::global().name(name)));
+      m_collector.pushLoadVar(*id);
+      return pushed();
+    }
+    case NodeType::UnaryOperation: {
+      const UnaryOperation& op = toUnaryOperation(node);
+      assert(op.op() == Operator::Plus || op.op() == Operator::Minus);
+      if (!step++) {
+        if (op.op() == Operator::Minus)
+          m_collector.pushToStack(Value::createDouble(0.));
+        next = &op.operand();
+        return true;
+      }
+      if (!childPushed())
+        return error("Expected an expression with a value");
+      if (op.op() == Operator::Minus)
+        m_collector.binOp(op.op());
+      return pushed();
+    }
+    case NodeType::BinaryOperation: {
+      const BinaryOperation& op = toBinaryOperation(node);
+      const bool isAssignment = op.op() == Operator::Equals;
+      if (!step) {
+        if (!isAssignment) {
+          step = 1;
+          next = &op.lhs();
+          return true;
+        }
+        if (!isVariableBinding(op.lhs()))
+          return error("Assigned to something that was not a variable");
+        // We don't load the variable we're assigning to.
+        const VariableBinding& var = toVariableBinding(op.lhs());
+        m_assignments.push_back(
+            m_collector.reserveVariableIdFor(var.varName()));
+        step = 2;
+        next = &op.rhs();
+        return true;
+      }
+      if (!childPushed()) {
+        if (isAssignment)
+          return error(
+              "Expected rhs of expression to leave a value "
+              "in the stack");
+        return error(
+            "Expected lhs of expression to leave a value in the stack");
+      }
+      if (step == 1) {
+        step = 2;
+        next = &op.rhs();
+        return true;
+      }
+      if (isAssignment) {
+        m_collector.pushAssignTo(m_assignments.back());
+        m_assignments.pop_back();
+      } else {
+        m_collector.binOp(op.op());
+      }
+      return pushed();
+    }
+    case NodeType::Statement:
+      if (!step++) {
+        next = &toStatement(node).inner();
+        return true;
+      }
+      if (childPushed())
+        m_collector.popFromStack();
+      return didntPush();
+    case NodeType::ParenthesizedExpression:
+      // The status of the inner expression is the status of the parens.
+      if (!step++)
+        next = &toParenthesizedExpression(node).inner();
+      return true;
+    case NodeType::Block: {
+      // `step` is the index of the next statement, or one past the last
+      // expression.
+      const Block& block = toBlock(node);
+      const uint32_t count = block.statements().size();
+      if (!step) {
+        m_collector.pushScope();
+      } else if (step <= count) {
+        bool pushed = childPushed();
+        assert(!pushed);
+        (void)pushed;
+      }
+      if (step < count) {
+        next = block.statements()[step++];
+        return true;
+      }
+      if (step == count && block.lastExpression()) {
+        step++;
+        next = block.lastExpression();
+        return true;
+      }
+      m_collector.popScope();
+      // The status of the last expression is the status of the block.
+      return block.lastExpression() ? true : didntPush();
+    }
+    case NodeType::LazyBlock:
+      // The status of the block is the status of the lazy block.
+      if (!step++) {
+        next = toLazyBlock(node).block();
+        if (!next)
+          return error("Couldn't parse block");
+      }
+      return true;
+    case NodeType::FunctionCall: {
+      const FunctionCall& call = toFunctionCall(node);
+      const auto& arguments = call.arguments();
+      Optional<BuiltinFunction> function =
+          BytecodeCollector::builtinFunction(call.functionName());
+      if (!function)
+        return error(
+            std::string("Unknown function: ") +
+            std::string(SymbolTable::global().name(call.functionName())));
+      if (step && !childPushed())
+        return error("Argument didn't leave a value on the stack...");
+      // Arguments are pushed in reverse order.
+      if (step < arguments.size()) {
+        next = arguments[arguments.size() - ++step];
+        return true;
+      }
+      m_collector.pushFunctionCall(*function, arguments.size());
+      return pushed();
+    }
+    case NodeType::ConditionalExpression:
+    case NodeType::ForLoop:
+      return error(std::string("Bytecode generation not implemented yet for ") +
+                   node.name());
+    case NodeType::Expression:
+      break;
+  }
+  assert(false && "Unexpected node kind");
+  return error("Internal error");
+}
+
+BytecodeCollectionResult Node::toByteCode(BytecodeCollector& collector) const {
+  BytecodeVisitor visitor(collector);
+  walk(*this, visitor);
+  return visitor.result();
 }
 
 }  // namespace ast
@@ -18,11 +18,11 @@
 #pragma once
 
 #include <cassert>
-#include <memory>
-#include <vector>
 
 #include "ASTDumper.h"
+#include "AstArena.h"
 #include "Result.h"
+#include "SymbolTable.h"
 #include "Tokenizer.h"
 #include "Value.h"
 
@@ -30,7 +30,7 @@ class BytecodeCollector;
 
 namespace ast {
 
-enum class NodeType {
+enum class NodeType : uint8_t {
 #define NODE_TYPE(ty) ty,
 #include "ASTNodeTypes.h"
 #undef NODE_TYPE
@@ -49,75 +49,83 @@ enum class BytecodeCollectionStatus {
 
 using BytecodeCollectionResult = Result<BytecodeCollectionStatus, std::string>;
 
+// Nodes are allocated in an `AstArena`, and never destroyed individually, so
+// links between them are plain pointers.
 class Node {
+  NodeType m_kind;
+
  public:
-  virtual bool isOfType(NodeType) const = 0;
-  virtual const char* name() const = 0;
-  virtual void dump(ASTDumper) const = 0;
-  virtual ~Node() = default;
-  virtual BytecodeCollectionResult toByteCode(BytecodeCollector&) const {
-    return std::string("Bytecode generation not implemented yet for ") + name();
+  NodeType kind() const { return m_kind; }
+
+  // Every concrete node is an expression for now.
+  bool isOfType(NodeType type) const {
+    return type == m_kind || type == NodeType::Expression;
   }
+
+  virtual const char* name() const = 0;
+  // Dumps this node and its children. Passing the dumper by value nests the
+  // output one level below whatever the caller was dumping.
+  //
+  // Dumps, like the errors of `toByteCode`, name variables and functions from
+  // `SymbolTable::global()`, so they're only meaningful for trees parsed from
+  // tokens interned there.
+  void dump(ASTDumper) const;
+  // Dumps the line describing this node, but not its children.
+  virtual void dumpSelf(ASTDumper&) const = 0;
+
+  BytecodeCollectionResult toByteCode(BytecodeCollector&) const;
+
+ protected:
+  explicit Node(NodeType kind) : m_kind(kind) {}
+  ~Node() = default;
 };
 
 class Expression : public Node {
- public:
-  bool isOfType(NodeType type) const override {
-    return type == NodeType::Expression;
-  }
+ protected:
+  explicit Expression(NodeType kind) : Node(kind) {}
+  ~Expression() = default;
 };
 
 class VariableBinding final : public Expression {
-  std::string m_name;
+  SymbolId m_name;
 
  public:
-  explicit VariableBinding(const char* name) : m_name(name) {}
+  explicit VariableBinding(SymbolId name)
+      : Expression(NodeType::VariableBinding), m_name(name) {}
 
   const char* name() const final { return "VariableBinding"; }
 
-  const std::string& varName() const { return m_name; }
-
-  void dump(ASTDumper) const final;
-
-  bool isOfType(NodeType type) const final {
-    return type == NodeType::VariableBinding || Expression::isOfType(type);
-  }
+  SymbolId varName() const { return m_name; }
 
-  BytecodeCollectionResult toByteCode(BytecodeCollector&) const override;
+  void dumpSelf(ASTDumper&) const final;
 };
 
 class ConstantExpression final : public Expression {
   Value m_value;
 
  public:
-  explicit ConstantExpression(Value value) : m_value(value) {}
+  explicit ConstantExpression(Value value)
+      : Expression(NodeType::ConstantExpression), m_value(value) {}
 
   const char* name() const final { return "ConstantExpression"; }
-  void dump(ASTDumper) const final;
-
-  bool isOfType(NodeType type) const override {
-    return type == NodeType::ConstantExpression || Expression::isOfType(type);
-  }
+  void dumpSelf(ASTDumper&) const final;
 
-  BytecodeCollectionResult toByteCode(BytecodeCollector&) const override;
+  const Value& value() const { return m_value; }
 };
 
 class UnaryOperation final : public Expression {
   Operator m_op;
-  std::unique_ptr<Expression> m_rhs;
+  Expression* m_rhs;
 
  public:
-  UnaryOperation(Operator op, std::unique_ptr<Expression>&& expr)
-      : m_op(op), m_rhs(std::move(expr)) {}
+  UnaryOperation(Operator op, Expression* expr)
+      : Expression(NodeType::UnaryOperation), m_op(op), m_rhs(expr) {}
 
   const char* name() const final { return "UnaryOperation"; }
-  void dump(ASTDumper) const final;
-
-  bool isOfType(NodeType type) const override {
-    return type == NodeType::UnaryOperation || Expression::isOfType(type);
-  }
+  void dumpSelf(ASTDumper&) const final;
 
-  BytecodeCollectionResult toByteCode(BytecodeCollector&) const override;
+  Operator op() const { return m_op; }
+  const Expression& operand() const { return *m_rhs; }
 };
 
 // A statement is an expression terminated by a semicolon.
@@ -125,153 +133,191 @@ class UnaryOperation final : public Expression {
 // Evaluating this will always yield a zero, but it may have side effects like
 // setting variable bindings.
 class Statement final : public Expression {
-  std::unique_ptr<Expression> m_inner;
+  Expression* m_inner;
 
  public:
-  explicit Statement(std::unique_ptr<Expression>&& inner)
-      : m_inner(std::move(inner)) {}
+  explicit Statement(Expression* inner)
+      : Expression(NodeType::Statement), m_inner(inner) {}
 
   const char* name() const final { return "Statement"; }
 
-  bool isOfType(NodeType type) const final {
-    return type == NodeType::Statement || Expression::isOfType(type);
-  }
-
-  void dump(ASTDumper) const final;
+  void dumpSelf(ASTDumper&) const final;
 
-  BytecodeCollectionResult toByteCode(BytecodeCollector&) const override;
+  const Expression& inner() const { return *m_inner; }
 };
 
 // A block is a list of statements, with a final expression, potentially.
 class Block final : public Expression {
-  std::vector<std::unique_ptr<Statement>> m_statements;
-  std::unique_ptr<Expression> m_lastExpression;  // may be null.
+  ArenaArray<Statement*> m_statements;
+  Expression* m_lastExpression;  // may be null.
  public:
-  explicit Block(std::vector<std::unique_ptr<Statement>>&& statements,
-                 std::unique_ptr<Expression>&& lastExpression)
-      : m_statements(std::move(statements)),
-        m_lastExpression(std::move(lastExpression)) {}
+  explicit Block(ArenaArray<Statement*> statements, Expression* lastExpression)
+      : Expression(NodeType::Block),
+        m_statements(statements),
+        m_lastExpression(lastExpression) {}
 
   const char* name() const final { return "Block"; }
 
-  bool isOfType(NodeType type) const final {
-    return type == NodeType::Block || Expression::isOfType(type);
-  }
+  void dumpSelf(ASTDumper&) const final;
+
+  const ArenaArray<Statement*>& statements() const { return m_statements; }
+  const Expression* lastExpression() const { return m_lastExpression; }
+};
+
+class LazyBlock;
 
-  void dump(ASTDumper) const final;
+// Parses the blocks that were skipped at parse time, see `LazyBlock`.
+class LazyBlockParser {
+ public:
+  // Returns null if the block turns out to be invalid.
+  virtual const Block* parseLazyBlock(const LazyBlock&) = 0;
+
+ protected:
+  ~LazyBlockParser() = default;
+};
 
-  BytecodeCollectionResult toByteCode(BytecodeCollector&) const override;
+// A block nested in another block that the parser skipped over just by
+// matching braces, and that only gets parsed the first time someone asks for
+// it, so that code that is never compiled is never fully parsed either.
+//
+// The tokens of the block, braces included, are [firstToken, endToken).
+class LazyBlock final : public Expression {
+  LazyBlockParser& m_parser;
+  uint32_t m_firstToken;
+  uint32_t m_endToken;
+  mutable const Block* m_block{nullptr};
+
+ public:
+  LazyBlock(LazyBlockParser& parser, uint32_t firstToken, uint32_t endToken)
+      : Expression(NodeType::LazyBlock),
+        m_parser(parser),
+        m_firstToken(firstToken),
+        m_endToken(endToken) {}
+
+  const char* name() const final { return "LazyBlock"; }
+  void dumpSelf(ASTDumper&) const final;
+
+  uint32_t firstToken() const { return m_firstToken; }
+  uint32_t endToken() const { return m_endToken; }
+
+  // Whether the block has been parsed already.
+  bool isParsed() const { return m_block; }
+
+  // Parses the block if needed. Returns null on parse errors.
+  const Block* block() const {
+    if (!m_block)
+      m_block = m_parser.parseLazyBlock(*this);
+    return m_block;
+  }
 };
 
 class BinaryOperation final : public Expression {
   Operator m_op;
-  std::unique_ptr<Expression> m_lhs;
-  std::unique_ptr<Expression> m_rhs;
+  Expression* m_lhs;
+  Expression* m_rhs;
 
  public:
-  BinaryOperation(Operator op,
-                  std::unique_ptr<Expression>&& lhs,
-                  std::unique_ptr<Expression>&& rhs)
-      : m_op(op), m_lhs(std::move(lhs)), m_rhs(std::move(rhs)) {}
+  BinaryOperation(Operator op, Expression* lhs, Expression* rhs)
+      : Expression(NodeType::BinaryOperation),
+        m_op(op),
+        m_lhs(lhs),
+        m_rhs(rhs) {}
 
   const char* name() const final { return "BinaryOperation"; }
-  void dump(ASTDumper) const final;
+  void dumpSelf(ASTDumper&) const final;
 
-  bool isOfType(NodeType type) const override {
-    return type == NodeType::BinaryOperation || Expression::isOfType(type);
-  }
-
-  BytecodeCollectionResult toByteCode(BytecodeCollector&) const override;
+  Operator op() const { return m_op; }
+  const Expression& lhs() const { return *m_lhs; }
+  const Expression& rhs() const { return *m_rhs; }
 };
 
 class FunctionCall final : public Expression {
-  std::string m_name;
-  std::vector<std::unique_ptr<Expression>> m_arguments;
+  SymbolId m_name;
+  ArenaArray<Expression*> m_arguments;
 
  public:
-  FunctionCall(std::string&& name,
-               std::vector<std::unique_ptr<Expression>>&& args)
-      : m_name(std::move(name)), m_arguments(std::move(args)) {}
+  FunctionCall(SymbolId name, ArenaArray<Expression*> args)
+      : Expression(NodeType::FunctionCall), m_name(name), m_arguments(args) {}
 
   const char* name() const final { return "FunctionCall"; }
-  void dump(ASTDumper) const final;
+  void dumpSelf(ASTDumper&) const final;
 
-  bool isOfType(NodeType type) const override {
-    return type == NodeType::FunctionCall || Expression::isOfType(type);
-  }
-
-  BytecodeCollectionResult toByteCode(BytecodeCollector&) const final;
+  SymbolId functionName() const { return m_name; }
+  const ArenaArray<Expression*>& arguments() const { return m_arguments; }
 };
 
 class ParenthesizedExpression final : public Expression {
-  std::unique_ptr<Expression> m_inner;
+  Expression* m_inner;
 
  public:
-  ParenthesizedExpression(std::unique_ptr<Expression>&& inner)
-      : m_inner(std::move(inner)) {}
+  ParenthesizedExpression(Expression* inner)
+      : Expression(NodeType::ParenthesizedExpression), m_inner(inner) {}
 
   const char* name() const final { return "ParenthesizedExpression"; }
-  void dump(ASTDumper) const final;
+  void dumpSelf(ASTDumper&) const final;
 
-  bool isOfType(NodeType type) const override {
-    return type == NodeType::ParenthesizedExpression ||
-           Expression::isOfType(type);
-  }
-
-  BytecodeCollectionResult toByteCode(BytecodeCollector&) const override;
+  const Expression& inner() const { return *m_inner; }
 };
 
 class ConditionalExpression final : public Expression {
   // May be null if it's an `else` clause.
-  std::unique_ptr<Expression> m_condition;
+  Expression* m_condition;
 
-  std::unique_ptr<Expression> m_innerExpression;
+  Expression* m_innerExpression;
 
   // May be null, if there's no `else` or `else if` branch.
-  std::unique_ptr<ConditionalExpression> m_else;
+  ConditionalExpression* m_else;
 
  public:
-  ConditionalExpression(std::unique_ptr<Expression>&& condition,
-                        std::unique_ptr<Expression>&& inner,
-                        std::unique_ptr<ConditionalExpression>&& elseBranch)
-      : m_condition(std::move(condition)),
-        m_innerExpression(std::move(inner)),
-        m_else(std::move(elseBranch)) {}
+  ConditionalExpression(Expression* condition,
+                        Expression* inner,
+                        ConditionalExpression* elseBranch)
+      : Expression(NodeType::ConditionalExpression),
+        m_condition(condition),
+        m_innerExpression(inner),
+        m_else(elseBranch) {}
 
   const char* name() const final { return "ConditionalExpression"; }
-  void dump(ASTDumper) const final;
+  void dumpSelf(ASTDumper&) const final;
 
-  bool isOfType(NodeType type) const override {
-    return type == NodeType::ConditionalExpression ||
-           Expression::isOfType(type);
-  }
+  const Expression* condition() const { return m_condition; }
+  const Expression& innerExpression() const { return *m_innerExpression; }
+  const ConditionalExpression* elseBranch() const { return m_else; }
 };
 
 class ForLoop final : public Expression {
-  std::unique_ptr<ast::Expression> m_init;
-  std::unique_ptr<ast::Expression> m_condition;
-  std::unique_ptr<ast::Expression> m_afterClause;
-  std::unique_ptr<ast::Expression> m_body;
+  Expression* m_init;
+  Expression* m_condition;
+  Expression* m_afterClause;
+  Expression* m_body;
 
  public:
-  ForLoop(std::unique_ptr<ast::Expression>&& init,
-          std::unique_ptr<ast::Expression>&& condition,
-          std::unique_ptr<ast::Expression>&& afterClause,
-          std::unique_ptr<ast::Expression>&& body)
-      : m_init(std::move(init)),
-        m_condition(std::move(condition)),
-        m_afterClause(std::move(afterClause)),
-        m_body(std::move(body)) {}
+  ForLoop(Expression* init,
+          Expression* condition,
+          Expression* afterClause,
+          Expression* body)
+      : Expression(NodeType::ForLoop),
+        m_init(init),
+        m_condition(condition),
+        m_afterClause(afterClause),
+        m_body(body) {}
 
   const char* name() const final { return "ForLoop"; }
 
-  void dump(ASTDumper) const final;
+  void dumpSelf(ASTDumper&) const final;
 
-  bool isOfType(NodeType type) const override {
-    return type == NodeType::ForLoop || Expression::isOfType(type);
-  }
+  // All of these but the body may be null.
+  const Expression* init() const { return m_init; }
+  const Expression* condition() const { return m_condition; }
+  const Expression* afterClause() const { return m_afterClause; }
+  const Expression& body() const { return *m_body; }
 };
 
+// The children of a node, in source order, for generic traversals. Optional
+// children that are missing are null.
+uint32_t childCount(const Node&);
+const Node* child(const Node&, uint32_t index);
+
 #define NODE_TYPE(ty)                                                          \
   inline bool is##ty(const Node& node) { return node.isOfType(NodeType::ty); } \
   inline bool is##ty(const Node* node) { return node && is##ty(*node); }       \
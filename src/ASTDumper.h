@@ -17,6 +17,7 @@
 
 #pragma once
 
+#include <iomanip>
 #include <ostream>
 
 namespace ast {
@@ -50,8 +51,7 @@ class ASTDumper {
 template <typename T>
 ASTDumper& operator<<(ASTDumper& dumper, const T& v) {
   if (!dumper.m_dirty)
-    for (std::size_t i = 0; i < dumper.m_indent; ++i)
-      dumper.m_stream << " ";
+    dumper.m_stream << std::setw(dumper.m_indent) << "";
   dumper.m_dirty = true;
   dumper.m_stream << v;
   return dumper;
@@ -25,6 +25,7 @@ NODE_TYPE(FunctionCall)
 NODE_TYPE(ParenthesizedExpression)
 NODE_TYPE(VariableBinding)
 NODE_TYPE(Block)
+NODE_TYPE(LazyBlock)
 NODE_TYPE(Statement)
 NODE_TYPE(ConditionalExpression)
 NODE_TYPE(ForLoop)
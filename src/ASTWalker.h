@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "AST.h"
+
+namespace ast {
+
+// How deep `walk` recurses before switching to an explicit stack. Recursing
+// is measurably faster than pushing and popping frames, so we only bother
+// with the stack for the rare deeply nested trees.
+constexpr uint32_t kMaxWalkRecursionDepth = 128;
+
+template <typename Visitor>
+bool walkWithStack(const Node& root, Visitor& visitor) {
+  struct Frame {
+    const Node* node;
+    uint32_t step;
+  };
+
+  std::vector<Frame> stack;
+  stack.push_back({&root, 0});
+  while (!stack.empty()) {
+    Frame& frame = stack.back();
+    const Node* next = nullptr;
+    if (!visitor.visit(*frame.node, frame.step, next))
+      return false;
+    if (next)
+      stack.push_back({next, 0});
+    else
+      stack.pop_back();
+  }
+  return true;
+}
+
+template <typename Visitor>
+bool walkRecursively(const Node& node, Visitor& visitor, uint32_t depth) {
+  uint32_t step = 0;
+  while (true) {
+    const Node* next = nullptr;
+    if (!visitor.visit(node, step, next))
+      return false;
+    if (!next)
+      return true;
+    bool walked = depth < kMaxWalkRecursionDepth
+                      ? walkRecursively(*next, visitor, depth + 1)
+                      : walkWithStack(*next, visitor);
+    if (!walked)
+      return false;
+  }
+}
+
+// Walks the tree under `root` depth-first. Arbitrarily deep trees don't
+// overflow the native stack: past a certain depth the rest of the subtree is
+// walked using an explicit one.
+//
+// The visitor is called as `visitor.visit(node, step, next)` when entering a
+// node, with `step` set to zero, and again after each child it asks to visit
+// finishes. The meaning of `step` past zero is up to the visitor, which
+// usually uses it to remember which child comes next. The visitor sets `next`
+// to the next child to visit, or leaves it null when done with the node, and
+// returns false to stop the walk.
+//
+// Returns whether the whole tree was walked.
+template <typename Visitor>
+bool walk(const Node& root, Visitor& visitor) {
+  return walkRecursively(root, visitor, 0);
+}
+
+// Returns the first child of `node` at or after `index`, in source order,
+// skipping missing optional children, and advances `index` past it. For
+// visitors that don't care about the order of the children.
+inline const Node* nextChild(const Node& node, uint32_t& index) {
+  for (const uint32_t count = childCount(node); index < count;) {
+    if (const Node* child = ast::child(node, index++))
+      return child;
+  }
+  return nullptr;
+}
+
+}  // namespace ast
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "AstArena.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace ast {
+
+void* AstArena::allocateSlow(std::size_t size, std::size_t alignment) {
+  // Blocks are allocated with `new char[]`, which is suitably aligned for
+  // anything but over-aligned types.
+  assert(alignment <= alignof(std::max_align_t));
+  const std::size_t blockSize = std::max(kBlockSize, size);
+  // The spare block is already accounted for in `m_capacity`.
+  std::unique_ptr<char[]> data;
+  if (blockSize == kBlockSize && m_spareBlock) {
+    data = std::move(m_spareBlock);
+  } else {
+    data.reset(new char[blockSize]);
+    m_capacity += blockSize;
+    m_peakCapacity = std::max(m_peakCapacity, m_capacity);
+  }
+  char* block = data.get();
+  m_blocks.push_back({std::move(data), blockSize});
+
+  // Oversized allocations get their own block, and we keep bumping into the
+  // current one.
+  if (blockSize != kBlockSize)
+    return block;
+
+  m_cursor = block + size;
+  m_end = block + blockSize;
+  return block;
+}
+
+void AstArena::rewind(const Mark& mark) {
+  assert(mark.blockCount <= m_blocks.size());
+  while (m_blocks.size() > mark.blockCount) {
+    Block& block = m_blocks.back();
+    if (block.size == kBlockSize && !m_spareBlock)
+      m_spareBlock = std::move(block.data);
+    else
+      m_capacity -= block.size;
+    m_blocks.pop_back();
+  }
+  m_cursor = mark.cursor;
+  m_end = mark.end;
+}
+
+void AstArena::adopt(AstArena& other) {
+  // Keep our current block last, so that we can keep allocating from it.
+  std::size_t adopted = 0;
+  for (const Block& block : other.m_blocks)
+    adopted += block.size;
+  m_blocks.insert(m_blocks.begin(),
+                  std::make_move_iterator(other.m_blocks.begin()),
+                  std::make_move_iterator(other.m_blocks.end()));
+  m_capacity += adopted;
+  m_peakCapacity = std::max(m_peakCapacity, m_capacity);
+
+  other.m_blocks.clear();
+  other.m_cursor = other.m_end = nullptr;
+  other.m_capacity -= adopted;
+}
+
+}  // namespace ast
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ast {
+
+// An immutable array allocated in an `AstArena`.
+template <typename T>
+class ArenaArray {
+  T* m_data{nullptr};
+  uint32_t m_size{0};
+
+ public:
+  ArenaArray() = default;
+  ArenaArray(T* data, uint32_t size) : m_data(data), m_size(size) {}
+
+  uint32_t size() const { return m_size; }
+  bool isEmpty() const { return !m_size; }
+
+  const T& operator[](uint32_t i) const {
+    assert(i < m_size);
+    return m_data[i];
+  }
+
+  const T* begin() const { return m_data; }
+  const T* end() const { return m_data + m_size; }
+};
+
+/**
+ * A bump allocator for AST nodes.
+ *
+ * Nodes are never destroyed individually: all the memory is released at once
+ * when the arena goes away, which is why everything allocated in it needs to
+ * be trivially destructible, and links to other nodes need to be plain
+ * pointers.
+ */
+class AstArena {
+ public:
+  AstArena() = default;
+  AstArena(const AstArena&) = delete;
+  AstArena& operator=(const AstArena&) = delete;
+
+  template <typename T, typename... Args>
+  T* make(Args&&... args) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "Arena-allocated objects are never destroyed");
+    return new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+  }
+
+  // Allocates uninitialized storage for `count` objects of type `T`.
+  template <typename T>
+  T* allocateArray(std::size_t count) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "Arena-allocated objects are never destroyed");
+    return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+  }
+
+  void* allocate(std::size_t size, std::size_t alignment) {
+    std::size_t padding = -reinterpret_cast<uintptr_t>(m_cursor) & (alignment - 1);
+    if (padding + size > std::size_t(m_end - m_cursor))
+      return allocateSlow(size, alignment);
+    void* result = m_cursor + padding;
+    m_cursor += padding + size;
+    return result;
+  }
+
+  // A point in the allocation history of the arena, see `rewind`.
+  struct Mark {
+    std::size_t blockCount;
+    char* cursor;
+    char* end;
+  };
+
+  Mark mark() const { return {m_blocks.size(), m_cursor, m_end}; }
+
+  // Frees everything allocated since `mark` was taken. Nothing allocated
+  // since then can be used afterwards.
+  void rewind(const Mark&);
+
+  // Takes over all the memory `other` has allocated, so that it lives as long
+  // as this arena. Marks taken before are not valid anymore.
+  void adopt(AstArena& other);
+
+  // The memory in use by the arena, including unused space at the end of its
+  // blocks.
+  std::size_t capacity() const { return m_capacity; }
+  // The most memory the arena has used at once.
+  std::size_t peakCapacity() const { return m_peakCapacity; }
+
+ private:
+  static constexpr std::size_t kBlockSize = 64 * 1024;
+
+  struct Block {
+    std::unique_ptr<char[]> data;
+    std::size_t size;
+  };
+
+  void* allocateSlow(std::size_t size, std::size_t alignment);
+
+  std::vector<Block> m_blocks;
+  // A block freed by `rewind`, kept around so that rewinding repeatedly right
+  // before the end of a block doesn't allocate and free a block every time.
+  std::unique_ptr<char[]> m_spareBlock;
+  char* m_cursor{nullptr};
+  char* m_end{nullptr};
+  std::size_t m_capacity{0};
+  std::size_t m_peakCapacity{0};
+};
+
+}  // namespace ast
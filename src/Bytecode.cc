@@ -1,5 +1,7 @@
 #include "Bytecode.h"
 
+#include <unordered_map>
+
 std::ostream& operator<<(std::ostream& os, const Instruction& kind) {
   switch (kind) {
     case Instruction::Div:
@@ -95,3 +97,179 @@ std::ostream& operator<<(std::ostream& os, const Bytecode& bytecode) {
 
   return os << ")";
 }
+
+namespace {
+
+// The bits of a value, which tell equal constants apart, including floats
+// that compare equal, like 0 and -0.
+struct ConstantKey {
+  ValueType type;
+  uint64_t bits;
+
+  bool operator==(const ConstantKey& other) const {
+    return type == other.type && bits == other.bits;
+  }
+};
+
+struct ConstantKeyHash {
+  std::size_t operator()(const ConstantKey& key) const {
+    return std::hash<uint64_t>()(key.bits) ^ std::size_t(key.type);
+  }
+};
+
+ConstantKey constantKey(const Value& value) {
+  ConstantKey key{value.type(), 0};
+  switch (value.type()) {
+    case ValueType::Integer:
+      key.bits = value.intValue();
+      break;
+    case ValueType::Float: {
+      double number = value.doubleValue();
+      memcpy(&key.bits, &number, sizeof(number));
+      break;
+    }
+    case ValueType::Bool:
+      key.bits = value.boolValue();
+      break;
+  }
+  return key;
+}
+
+std::size_t varintSize(uint64_t value) {
+  std::size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
+  }
+  return size;
+}
+
+}  // namespace
+
+CompactBytecode CompactBytecode::encode(const std::vector<Bytecode>& bytecode) {
+  CompactBytecode result;
+  std::unordered_map<ConstantKey, uint32_t, ConstantKeyHash> constantIndices;
+  std::vector<uint32_t> constants;
+
+  // Lay out the instructions first, so that we know where jumps go.
+  std::vector<std::size_t> positions(bytecode.size() + 1);
+  std::size_t position = 0;
+  for (std::size_t i = 0; i < bytecode.size(); ++i) {
+    positions[i] = position;
+    switch (bytecode[i].kind()) {
+      case BytecodeKind::Instruction:
+        position += 1;
+        break;
+      case BytecodeKind::Value: {
+        auto entry = constantIndices.emplace(constantKey(bytecode[i].value()),
+                                             constantIndices.size());
+        if (entry.second)
+          result.m_constants.push_back(bytecode[i].value());
+        constants.push_back(entry.first->second);
+        position += varintSize(entry.first->second);
+        break;
+      }
+      case BytecodeKind::LabelId:
+        position += varintSize(bytecode[i].labelId());
+        break;
+      case BytecodeKind::BuiltinFunctionId:
+        position += 1;
+        break;
+      case BytecodeKind::ArgumentCount:
+        position += varintSize(bytecode[i].argumentCount());
+        break;
+      case BytecodeKind::Offset:
+        position += sizeof(int32_t);
+        break;
+    }
+  }
+  positions.back() = position;
+
+  std::vector<uint8_t>& code = result.m_code;
+  code.reserve(position);
+  std::size_t constant = 0;
+  // The instruction the operands being emitted belong to.
+  std::size_t instruction = 0;
+  for (std::size_t i = 0; i < bytecode.size(); ++i) {
+    const Bytecode& current = bytecode[i];
+    switch (current.kind()) {
+      case BytecodeKind::Instruction:
+        instruction = i;
+        code.push_back(uint8_t(current.instruction()));
+        break;
+      case BytecodeKind::Value:
+        writeVarint(code, constants[constant++]);
+        break;
+      case BytecodeKind::LabelId:
+        writeVarint(code, current.labelId());
+        break;
+      case BytecodeKind::BuiltinFunctionId:
+        code.push_back(uint8_t(current.function()));
+        break;
+      case BytecodeKind::ArgumentCount:
+        writeVarint(code, current.argumentCount());
+        break;
+      case BytecodeKind::Offset: {
+        // Offsets are relative to the instruction, in bytecodes.
+        const std::size_t target = instruction + current.offset();
+        assert(target <= bytecode.size());
+        const int32_t offset =
+            int32_t(int64_t(positions[target]) - int64_t(positions[instruction]));
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&offset);
+        code.insert(code.end(), bytes, bytes + sizeof(offset));
+        break;
+      }
+    }
+  }
+  assert(code.size() == position);
+  return result;
+}
+
+std::vector<Bytecode> CompactBytecode::decode() const {
+  std::vector<Bytecode> result;
+  // The index of the bytecode each opcode decodes to, to translate offsets
+  // back.
+  std::unordered_map<std::size_t, std::size_t> indices;
+  // The operand of each jump, and the position it jumps to.
+  std::vector<std::pair<std::size_t, std::size_t>> jumps;
+  const uint8_t* cursor = m_code.data();
+  const uint8_t* end = cursor + m_code.size();
+  while (cursor < end) {
+    const std::size_t position = cursor - m_code.data();
+    const Instruction instruction = Instruction(*cursor++);
+    indices[position] = result.size();
+    result.emplace_back(instruction);
+    switch (instruction) {
+      case Instruction::Load:
+        result.emplace_back(m_constants[readVarint(cursor)]);
+        break;
+      case Instruction::StoreVar:
+      case Instruction::LoadVar:
+      case Instruction::ClearVar:
+        result.push_back(Bytecode::label(readVarint(cursor)));
+        break;
+      case Instruction::CallFunction:
+        result.push_back(Bytecode::function(BuiltinFunction(*cursor++)));
+        result.push_back(Bytecode::argumentCount(readVarint(cursor)));
+        break;
+      case Instruction::Jump:
+      case Instruction::JumpIfZero:
+        jumps.emplace_back(result.size(), position + readOffset(cursor));
+        result.push_back(Bytecode::offset(0));
+        break;
+      case Instruction::Pop:
+      case Instruction::Add:
+      case Instruction::Subtract:
+      case Instruction::Mul:
+      case Instruction::Div:
+        break;
+    }
+  }
+  indices[m_code.size()] = result.size();
+  for (const auto& jump : jumps) {
+    const std::size_t instruction = jump.first - 1;
+    result[jump.first] = Bytecode::offset(ssize_t(indices[jump.second]) -
+                                          ssize_t(instruction));
+  }
+  return result;
+}
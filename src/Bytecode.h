@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstring>
 #include <ostream>
+#include <vector>
 #include "Value.h"
+#include "Varint.h"
 
 /**
  * Program execution consists of two parts:
@@ -92,6 +95,7 @@ enum class BytecodeKind : uint8_t {
 
 std::ostream& operator<<(std::ostream&, const BytecodeKind&);
 
+// Builtin functions are interned as well-known symbols, in this same order.
 enum class BuiltinFunction {
   Cos,
   Sin,
@@ -179,3 +183,46 @@ class Bytecode final {
 };
 
 std::ostream& operator<<(std::ostream&, const Bytecode&);
+
+/**
+ * The bytecode of a program as it's stored for execution: a stream of bytes
+ * rather than an array of `Bytecode`s, each big enough to hold a `Value`.
+ *
+ * Each instruction is an opcode byte, followed by its operands:
+ *
+ *  * Load: the index of the value in `constants()`, as a varint. Equal values
+ *    share a single constant.
+ *  * StoreVar, LoadVar, ClearVar: the label, as a varint.
+ *  * CallFunction: the function, as a byte, and the argument count, as a
+ *    varint.
+ *  * Jump, JumpIfZero: the offset in bytes from the opcode, as four bytes,
+ *    so that offsets can be computed before emitting the code.
+ *
+ * Varints are unsigned LEB128, as written by `writeVarint` in Varint.h.
+ */
+class CompactBytecode final {
+ public:
+  static CompactBytecode encode(const std::vector<Bytecode>&);
+
+  // The same bytecode `encode` was called with.
+  std::vector<Bytecode> decode() const;
+
+  const std::vector<uint8_t>& code() const { return m_code; }
+  const std::vector<Value>& constants() const { return m_constants; }
+
+  // The bytes used by the code and constants.
+  std::size_t size() const {
+    return m_code.size() + m_constants.size() * sizeof(Value);
+  }
+
+  static int32_t readOffset(const uint8_t*& cursor) {
+    int32_t result;
+    memcpy(&result, cursor, sizeof(result));
+    cursor += sizeof(result);
+    return result;
+  }
+
+ private:
+  std::vector<uint8_t> m_code;
+  std::vector<Value> m_constants;
+};
@@ -14,6 +14,16 @@ void BytecodeCollector::pushToStack(Value val) {
   m_bytecode.emplace_back(std::move(val));
 }
 
+static_assert(SymbolId(WellKnownSymbol::Pow) - kFirstBuiltinSymbol ==
+                  SymbolId(BuiltinFunction::Pow),
+              "Builtin function and well-known symbol order should match");
+
+Optional<BuiltinFunction> BytecodeCollector::builtinFunction(SymbolId name) {
+  if (!SymbolTable::isBuiltin(name))
+    return None;
+  return Some(BuiltinFunction(name - kFirstBuiltinSymbol));
+}
+
 void BytecodeCollector::pushAssignTo(LabelId id) {
   m_bytecode.emplace_back(Instruction::StoreVar);
   m_bytecode.emplace_back(Bytecode::label(id));
@@ -31,13 +41,17 @@ void BytecodeCollector::popFromStack() {
 void BytecodeCollector::binOp(Operator op) {
   switch (op) {
     case Operator::Plus:
-      return m_bytecode.emplace_back(Instruction::Add);
+      m_bytecode.emplace_back(Instruction::Add);
+      break;
     case Operator::Minus:
-      return m_bytecode.emplace_back(Instruction::Subtract);
+      m_bytecode.emplace_back(Instruction::Subtract);
+      break;
     case Operator::Slash:
-      return m_bytecode.emplace_back(Instruction::Div);
+      m_bytecode.emplace_back(Instruction::Div);
+      break;
     case Operator::Star:
-      return m_bytecode.emplace_back(Instruction::Mul);
+      m_bytecode.emplace_back(Instruction::Mul);
+      break;
     case Operator::Equals:
     default:
       // TODO
@@ -57,32 +71,27 @@ void BytecodeCollector::pushScope() {
 
 void BytecodeCollector::popScope() {
   assert(!m_scopes.empty());
-  {
-    const Scope& scope = m_scopes.back();
-    for (const auto& var : scope.m_variables) {
-      m_bytecode.emplace_back(Instruction::ClearVar);
-      m_bytecode.push_back(Bytecode::label(var.second));
-    }
+  for (SymbolId name : m_scopes.back().m_variables) {
+    m_bytecode.emplace_back(Instruction::ClearVar);
+    m_bytecode.push_back(Bytecode::label(m_bindings[name]));
+    m_bindings[name] = 0;
   }
   m_scopes.pop_back();
 }
 
-Optional<LabelId> BytecodeCollector::resolveVariable(const std::string& name) {
-  auto it = m_scopes.crbegin();
-  const auto end = m_scopes.crend();
-  for (; it != end; ++it) {
-    const auto found = it->m_variables.find(name);
-    if (found != it->m_variables.end())
-      return Some(found->second);
-  }
-
-  return None;
+Optional<LabelId> BytecodeCollector::resolveVariable(SymbolId name) {
+  if (name >= m_bindings.size() || !m_bindings[name])
+    return None;
+  return Some(m_bindings[name]);
 }
 
-LabelId BytecodeCollector::reserveVariableIdFor(const std::string& name) {
+LabelId BytecodeCollector::reserveVariableIdFor(SymbolId name) {
   if (auto id = resolveVariable(name))
     return *id;
+  if (name >= m_bindings.size())
+    m_bindings.resize(name + 1, 0);
   const auto id = ++m_lastVariableId;
-  m_scopes.back().m_variables.emplace(name, id);
+  m_bindings[name] = id;
+  m_scopes.back().m_variables.push_back(name);
   return id;
 }
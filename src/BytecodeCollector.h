@@ -3,16 +3,19 @@
 #include "Bytecode.h"
 #include "Tokenizer.h"
 
-#include <unordered_map>
 #include <vector>
 
 class BytecodeCollector {
   struct Scope {
-    std::unordered_map<std::string, LabelId> m_variables;
+    // The variables declared in this scope, in declaration order.
+    std::vector<SymbolId> m_variables;
   };
 
   std::vector<Bytecode> m_bytecode;
   std::vector<Scope> m_scopes;
+  // The label currently bound to each symbol, indexed by `SymbolId`, or zero
+  // if the symbol is not bound to any variable in scope.
+  std::vector<LabelId> m_bindings;
   LabelId m_lastVariableId{0};
 
  public:
@@ -31,6 +34,9 @@ class BytecodeCollector {
   void pushFunctionCall(BuiltinFunction, size_t argumentCount);
   void binOp(Operator);
 
-  Optional<LabelId> resolveVariable(const std::string& name);
-  LabelId reserveVariableIdFor(const std::string& name);
+  Optional<LabelId> resolveVariable(SymbolId name);
+
+  // The builtin function a symbol refers to, if any.
+  static Optional<BuiltinFunction> builtinFunction(SymbolId name);
+  LabelId reserveVariableIdFor(SymbolId name);
 };
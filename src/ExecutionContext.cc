@@ -21,11 +21,9 @@ std::ostream& operator<<(std::ostream& os, const ExecutionContext& ctx) {
     os << "    " << var.first << ": " << var.second << "\n";
   os << "  )\n";
   os << "  Stack(\n";
-  std::stack<Value> copy = ctx.m_valueStack;
-  while (!copy.empty()) {
-    os << "    " << copy.top() << "\n";
-    copy.pop();
-  }
+  // From the top of the stack.
+  for (auto it = ctx.m_valueStack.rbegin(); it != ctx.m_valueStack.rend(); ++it)
+    os << "    " << *it << "\n";
   os << "  )\n";
   os << ")";
 
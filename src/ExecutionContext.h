@@ -1,13 +1,14 @@
 #pragma once
 
 #include <memory>
-#include <stack>
 #include <string>
 #include <unordered_map>
+#include <vector>
 #include "Bytecode.h"
 
 class ExecutionContext {
-  std::stack<Value> m_valueStack;
+  // The bottom of the stack is first.
+  std::vector<Value> m_valueStack;
   std::unordered_map<LabelId, Value> m_variables;
   bool m_hasPendingError{false};
   std::string m_errorMsg;
@@ -22,14 +23,32 @@ class ExecutionContext {
   const Value pop() {
     assert(!m_valueStack.empty());
     assert(!m_hasPendingError);
-    const Value ret = m_valueStack.top();
-    m_valueStack.pop();
+    const Value ret = m_valueStack.back();
+    m_valueStack.pop_back();
     return ret;
   }
 
   void push(Value&& val) {
     assert(!m_hasPendingError);
-    m_valueStack.push(std::move(val));
+    m_valueStack.push_back(std::move(val));
+  }
+
+  // Makes room for `depth` values on top of the stack, for the interpreter to
+  // use directly, and returns the first of them. The stack needs to be
+  // trimmed with `trimStack` afterwards.
+  Value* growStack(size_t depth) {
+    const size_t size = m_valueStack.size();
+    m_valueStack.resize(size + depth, Value::createInt(0));
+    return m_valueStack.data() + size;
+  }
+
+  // Drops the values from `end` on, which needs to be within the slots
+  // returned by `growStack`.
+  void trimStack(const Value* end) {
+    assert(end >= m_valueStack.data() &&
+           end <= m_valueStack.data() + m_valueStack.size());
+    m_valueStack.erase(m_valueStack.begin() + (end - m_valueStack.data()),
+                       m_valueStack.end());
   }
 
   const Value* stackTop() const {
@@ -39,7 +58,7 @@ class ExecutionContext {
     if (m_valueStack.empty())
       return nullptr;
 
-    return &m_valueStack.top();
+    return &m_valueStack.back();
   }
 
   void noteError(const std::string& msg) {
@@ -0,0 +1,754 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FlatAST.h"
+
+#include <cstring>
+#include <deque>
+
+#include "ASTWalker.h"
+#include "BytecodeCollector.h"
+
+namespace ast {
+
+static const char* kindName(NodeType kind) {
+  switch (kind) {
+#define NODE_TYPE(ty) \
+  case NodeType::ty:  \
+    return #ty;
+#include "ASTNodeTypes.h"
+#undef NODE_TYPE
+  }
+  assert(false);
+  return "";
+}
+
+// Adds the nodes in post-order, as they're left.
+class FlatTreeBuilder final {
+ public:
+  explicit FlatTreeBuilder(FlatTree& tree) : m_tree(tree) {}
+
+  bool visit(const ast::Node& node, uint32_t& step, const ast::Node*& next) {
+    next = nextChild(node, step);
+    if (!next)
+      m_tree.add(node, m_pending);
+    return true;
+  }
+
+ private:
+  FlatTree& m_tree;
+  std::vector<NodeId> m_pending;
+};
+
+FlatTree FlatTree::build(const ast::Node& root) {
+  FlatTree tree;
+  FlatTreeBuilder builder(tree);
+  walk(root, builder);
+  tree.m_nodes.shrink_to_fit();
+  tree.m_constants.shrink_to_fit();
+  tree.m_lists.shrink_to_fit();
+  tree.m_symbols.shrink_to_fit();
+  tree.m_children = std::vector<NodeId>();
+  tree.m_symbolIndices = std::vector<uint32_t>();
+  tree.useOwnedStorage();
+  return tree;
+}
+
+void FlatTree::useOwnedStorage() {
+  m_nodeData = m_nodes.data();
+  m_constantData = m_constants.data();
+  m_listData = m_lists.data();
+  m_nodeCount = m_nodes.size();
+  m_constantCount = m_constants.size();
+  m_listCount = m_lists.size();
+}
+
+std::size_t FlatTree::memoryUsage() const {
+  return m_nodeCount * sizeof(Node) + m_constantCount * sizeof(Value) +
+         m_listCount * sizeof(NodeId) + m_symbols.capacity() * sizeof(SymbolId);
+}
+
+namespace {
+
+// The layout of a file written by `FlatTree::write`: this header, followed by
+// the node array, the payloads of the constants, the child list array, the
+// symbols as the offsets where each of their names end, the types of the
+// constants, and the names themselves.
+struct FlatTreeFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t nodeCount;
+  uint32_t constantCount;
+  uint32_t listCount;
+  uint32_t symbolCount;
+  uint32_t namesSize;
+};
+
+constexpr char kFlatTreeMagic[8] = {'f', 'l', 'a', 't', 'a', 's', 't', '\0'};
+constexpr uint32_t kFlatTreeVersion = 2;
+
+static_assert(sizeof(FlatTreeFileHeader) % alignof(FlatTree::Node) == 0,
+              "The nodes need to be aligned in the file");
+
+constexpr uint8_t kNodeTypeCount = 0
+#define NODE_TYPE(ty) +1
+#include "ASTNodeTypes.h"
+#undef NODE_TYPE
+    ;
+
+// The 64 bits of a constant, which together with its type are enough to
+// create it again with `decodeConstant`.
+uint64_t constantPayload(const Value& value) {
+  switch (value.type()) {
+    case ValueType::Integer:
+      return uint64_t(value.intValue());
+    case ValueType::Float: {
+      const double number = value.doubleValue();
+      uint64_t bits;
+      memcpy(&bits, &number, sizeof(bits));
+      return bits;
+    }
+    case ValueType::Bool:
+      return value.boolValue();
+  }
+  assert(false);
+  return 0;
+}
+
+bool decodeConstant(uint8_t type, uint64_t payload, Value& out) {
+  switch (ValueType(type)) {
+    case ValueType::Integer:
+      out = Value::createInt(int64_t(payload));
+      return true;
+    case ValueType::Float: {
+      double number;
+      memcpy(&number, &payload, sizeof(number));
+      out = Value::createDouble(number);
+      return true;
+    }
+    case ValueType::Bool:
+      if (payload > 1)
+        return false;
+      out = Value::createBool(payload);
+      return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+void FlatTree::write(std::ostream& stream) const {
+  const SymbolTable& symbols = SymbolTable::global();
+  std::vector<uint32_t> nameEnds;
+  std::string names;
+  for (SymbolId symbol : m_symbols) {
+    names += symbols.name(symbol);
+    nameEnds.push_back(names.size());
+  }
+
+  std::vector<uint64_t> payloads;
+  std::vector<uint8_t> types;
+  for (uint32_t i = 0; i < m_constantCount; ++i) {
+    payloads.push_back(constantPayload(m_constantData[i]));
+    types.push_back(uint8_t(m_constantData[i].type()));
+  }
+
+  FlatTreeFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kFlatTreeMagic, sizeof(kFlatTreeMagic));
+  header.version = kFlatTreeVersion;
+  header.nodeCount = m_nodeCount;
+  header.constantCount = m_constantCount;
+  header.listCount = m_listCount;
+  header.symbolCount = m_symbols.size();
+  header.namesSize = names.size();
+
+  stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  stream.write(reinterpret_cast<const char*>(m_nodeData),
+               m_nodeCount * sizeof(Node));
+  stream.write(reinterpret_cast<const char*>(payloads.data()),
+               payloads.size() * sizeof(uint64_t));
+  stream.write(reinterpret_cast<const char*>(m_listData),
+               m_listCount * sizeof(NodeId));
+  stream.write(reinterpret_cast<const char*>(nameEnds.data()),
+               nameEnds.size() * sizeof(uint32_t));
+  stream.write(reinterpret_cast<const char*>(types.data()), types.size());
+  stream.write(names.data(), names.size());
+}
+
+Result<FlatTree, std::string> FlatTree::map(const char* data,
+                                            std::size_t size) {
+  FlatTreeFileHeader header;
+  if (size < sizeof(header))
+    return std::string("Not a flat AST file");
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, kFlatTreeMagic, sizeof(kFlatTreeMagic)))
+    return std::string("Not a flat AST file");
+  if (header.version != kFlatTreeVersion)
+    return std::string("Flat AST file written by a different version");
+  if (reinterpret_cast<uintptr_t>(data) % alignof(Node))
+    return std::string("Misaligned flat AST file");
+
+  const uint64_t expectedSize =
+      sizeof(header) + uint64_t(header.nodeCount) * sizeof(Node) +
+      uint64_t(header.constantCount) * (sizeof(uint64_t) + 1) +
+      uint64_t(header.listCount) * sizeof(NodeId) +
+      uint64_t(header.symbolCount) * sizeof(uint32_t) + header.namesSize;
+  if (!header.nodeCount || expectedSize != size)
+    return std::string("Malformed flat AST file");
+
+  FlatTree tree;
+  const char* cursor = data + sizeof(header);
+  tree.m_nodeData = reinterpret_cast<const Node*>(cursor);
+  tree.m_nodeCount = header.nodeCount;
+  cursor += header.nodeCount * sizeof(Node);
+  const char* payloads = cursor;
+  cursor += header.constantCount * sizeof(uint64_t);
+  tree.m_listData = reinterpret_cast<const NodeId*>(cursor);
+  tree.m_listCount = header.listCount;
+  cursor += header.listCount * sizeof(NodeId);
+  const char* nameEnds = cursor;
+  cursor += header.symbolCount * sizeof(uint32_t);
+  const char* types = cursor;
+  const char* names = types + header.constantCount;
+
+  tree.m_constants.resize(header.constantCount, Value::createInt(0));
+  for (uint32_t i = 0; i < header.constantCount; ++i) {
+    uint64_t payload;
+    memcpy(&payload, payloads + i * sizeof(uint64_t), sizeof(payload));
+    if (!decodeConstant(types[i], payload, tree.m_constants[i]))
+      return std::string("Malformed flat AST file");
+  }
+  tree.m_constantData = tree.m_constants.data();
+  tree.m_constantCount = header.constantCount;
+
+  if (!tree.isValid(header.symbolCount))
+    return std::string("Malformed flat AST file");
+
+  SymbolTable& symbols = SymbolTable::global();
+  tree.m_symbols.reserve(header.symbolCount);
+  uint32_t start = 0;
+  for (uint32_t i = 0; i < header.symbolCount; ++i) {
+    uint32_t end;
+    memcpy(&end, nameEnds + i * sizeof(uint32_t), sizeof(end));
+    if (end < start || end > header.namesSize)
+      return std::string("Malformed flat AST file");
+    tree.m_symbols.push_back(
+        symbols.intern(std::string_view(names + start, end - start)));
+    start = end;
+  }
+  return std::move(tree);
+}
+
+bool FlatTree::isValid(uint32_t symbolCount) const {
+  // Each node can only be the child of a single node that comes after it,
+  // so that walks terminate, and take time proportional to the size of the
+  // tree.
+  std::vector<bool> isChild(m_nodeCount, false);
+  for (NodeId id = 0; id < m_nodeCount; ++id) {
+    const Node& node = m_nodeData[id];
+    if (uint8_t(node.kind) >= kNodeTypeCount || node.op > Operator::Ge ||
+        node.padding) {
+      return false;
+    }
+
+    // The fields that aren't used are zero, and the operator is only used by
+    // operations.
+    bool valid = false;
+    switch (node.kind) {
+      case NodeType::ConstantExpression:
+        valid = node.a < m_constantCount && !node.b && !node.c;
+        break;
+      case NodeType::VariableBinding:
+        valid = node.a < symbolCount && !node.b && !node.c;
+        break;
+      case NodeType::BinaryOperation:
+        valid = !node.c;
+        break;
+      case NodeType::UnaryOperation:
+      case NodeType::Statement:
+      case NodeType::ParenthesizedExpression:
+      case NodeType::LazyBlock:
+        valid = !node.b && !node.c;
+        break;
+      case NodeType::Block:
+        valid = uint64_t(node.a) + node.b <= m_listCount;
+        break;
+      case NodeType::FunctionCall:
+        valid =
+            node.a < symbolCount && uint64_t(node.b) + node.c <= m_listCount;
+        break;
+      case NodeType::ConditionalExpression:
+        valid = true;
+        break;
+      case NodeType::ForLoop:
+        valid = uint64_t(node.a) + 4 <= m_listCount && !node.b && !node.c;
+        break;
+      case NodeType::Expression:
+        break;
+    }
+    if (!valid)
+      return false;
+    if (node.op != Operator::Plus && node.kind != NodeType::UnaryOperation &&
+        node.kind != NodeType::BinaryOperation) {
+      return false;
+    }
+
+    for (uint32_t i = 0, count = nodeChildCount(node); i < count; ++i) {
+      const NodeId child = nodeChild(node, i);
+      if (child == kNoNode) {
+        // Only the children the original tree allows to be missing may be.
+        const bool optional =
+            node.kind == NodeType::LazyBlock ||
+            (node.kind == NodeType::Block && i == node.b) ||
+            (node.kind == NodeType::ConditionalExpression && i != 1) ||
+            (node.kind == NodeType::ForLoop && i != 3);
+        if (!optional)
+          return false;
+        continue;
+      }
+      if (child >= id || isChild[child])
+        return false;
+      isChild[child] = true;
+      // The walks rely on these.
+      if (node.kind == NodeType::Block && i < node.b &&
+          m_nodeData[child].kind != NodeType::Statement) {
+        return false;
+      }
+      if (node.kind == NodeType::LazyBlock &&
+          m_nodeData[child].kind != NodeType::Block) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+uint32_t FlatTree::symbolIndex(SymbolId symbol) {
+  if (symbol >= m_symbolIndices.size())
+    m_symbolIndices.resize(symbol + 1, 0);
+  if (!m_symbolIndices[symbol]) {
+    m_symbols.push_back(symbol);
+    m_symbolIndices[symbol] = m_symbols.size();
+  }
+  return m_symbolIndices[symbol] - 1;
+}
+
+uint32_t FlatTree::pushList(const NodeId* children, uint32_t count) {
+  uint32_t start = m_lists.size();
+  m_lists.insert(m_lists.end(), children, children + count);
+  return start;
+}
+
+NodeId FlatTree::add(const ast::Node& node, std::vector<NodeId>& pending) {
+  // Take the ids of the children from `pending`, filling the gaps of missing
+  // optional children.
+  const uint32_t count = childCount(node);
+  uint32_t present = 0;
+  for (uint32_t i = 0; i < count; ++i)
+    present += !!child(node, i);
+  std::size_t next = pending.size() - present;
+  m_children.clear();
+  for (uint32_t i = 0; i < count; ++i)
+    m_children.push_back(child(node, i) ? pending[next++] : kNoNode);
+  pending.resize(pending.size() - present);
+
+  const NodeId* children = m_children.data();
+  // Operators are meaningless for most nodes, but we want the records to be
+  // fully initialized.
+  const Operator kNoOp = Operator::Plus;
+  NodeId id = kNoNode;
+  switch (node.kind()) {
+    case NodeType::ConstantExpression: {
+      m_constants.push_back(toConstantExpression(node).value());
+      uint32_t index = m_constants.size() - 1;
+      id = push(node.kind(), kNoOp, index, 0, 0);
+      break;
+    }
+    case NodeType::VariableBinding:
+      id = push(node.kind(), kNoOp,
+                symbolIndex(toVariableBinding(node).varName()), 0, 0);
+      break;
+    case NodeType::UnaryOperation:
+      id = push(node.kind(), toUnaryOperation(node).op(), children[0], 0, 0);
+      break;
+    case NodeType::BinaryOperation:
+      id = push(node.kind(), toBinaryOperation(node).op(), children[0],
+                children[1], 0);
+      break;
+    case NodeType::Statement:
+    case NodeType::ParenthesizedExpression:
+    case NodeType::LazyBlock:
+      id = push(node.kind(), kNoOp, children[0], 0, 0);
+      break;
+    case NodeType::Block: {
+      uint32_t statements = count - 1;
+      id = push(node.kind(), kNoOp, pushList(children, statements),
+                statements, children[statements]);
+      break;
+    }
+    case NodeType::FunctionCall:
+      id = push(node.kind(), kNoOp,
+                symbolIndex(toFunctionCall(node).functionName()),
+                pushList(children, count), count);
+      break;
+    case NodeType::ConditionalExpression:
+      id = push(node.kind(), kNoOp, children[0], children[1], children[2]);
+      break;
+    case NodeType::ForLoop:
+      id = push(node.kind(), kNoOp, pushList(children, count), 0, 0);
+      break;
+    case NodeType::Expression:
+      assert(false && "Unexpected node kind");
+      break;
+  }
+  pending.push_back(id);
+  return id;
+}
+
+uint32_t FlatTree::nodeChildCount(const Node& node) const {
+  switch (node.kind) {
+    case NodeType::ConstantExpression:
+    case NodeType::VariableBinding:
+    case NodeType::Expression:
+      return 0;
+    case NodeType::UnaryOperation:
+    case NodeType::Statement:
+    case NodeType::ParenthesizedExpression:
+    case NodeType::LazyBlock:
+      return 1;
+    case NodeType::BinaryOperation:
+      return 2;
+    case NodeType::Block:
+      return node.b + 1;
+    case NodeType::FunctionCall:
+      return node.c;
+    case NodeType::ConditionalExpression:
+      return 3;
+    case NodeType::ForLoop:
+      return 4;
+  }
+  assert(false);
+  return 0;
+}
+
+NodeId FlatTree::nodeChild(const Node& node, uint32_t index) const {
+  assert(index < nodeChildCount(node));
+  switch (node.kind) {
+    case NodeType::UnaryOperation:
+    case NodeType::Statement:
+    case NodeType::ParenthesizedExpression:
+    case NodeType::LazyBlock:
+      return node.a;
+    case NodeType::BinaryOperation:
+    case NodeType::ConditionalExpression:
+      return index == 0 ? node.a : index == 1 ? node.b : node.c;
+    case NodeType::Block:
+      return index < node.b ? list(node.a + index) : node.c;
+    case NodeType::FunctionCall:
+      return list(node.b + index);
+    case NodeType::ForLoop:
+      return list(node.a + index);
+    case NodeType::ConstantExpression:
+    case NodeType::VariableBinding:
+    case NodeType::Expression:
+      break;
+  }
+  assert(false);
+  return kNoNode;
+}
+
+template <typename Visitor>
+bool FlatTree::walkNodes(Visitor& visitor) const {
+  struct Frame {
+    NodeId id;
+    uint32_t step;
+  };
+
+  std::vector<Frame> stack;
+  stack.push_back({root(), 0});
+  while (!stack.empty()) {
+    Frame& frame = stack.back();
+    NodeId next = kNoNode;
+    if (!visitor.visit(frame.id, frame.step, next))
+      return false;
+    if (next != kNoNode)
+      stack.push_back({next, 0});
+    else
+      stack.pop_back();
+  }
+  return true;
+}
+
+// Same as the `DumpVisitor` of the original tree.
+class FlatDumpVisitor final {
+ public:
+  FlatDumpVisitor(const FlatTree& tree, ASTDumper& root)
+      : m_tree(tree), m_root(root) {}
+
+  bool visit(NodeId id, uint32_t& step, NodeId& next) {
+    const FlatTree::Node& node = m_tree[id];
+    if (!step) {
+      if (m_entered)
+        m_dumpers.emplace_back(current());
+      m_entered = true;
+      dumpSelf(node, current());
+    }
+    // Skip the missing optional children.
+    for (const uint32_t count = m_tree.nodeChildCount(node);
+         next == kNoNode && step < count;) {
+      next = m_tree.nodeChild(node, step++);
+    }
+    if (next == kNoNode && !m_dumpers.empty())
+      m_dumpers.pop_back();
+    return true;
+  }
+
+ private:
+  void dumpSelf(const FlatTree::Node& node, ASTDumper& dumper) {
+    dumper << kindName(node.kind);
+    switch (node.kind) {
+      case NodeType::ConstantExpression:
+        dumper << " " << m_tree.constant(node.a);
+        break;
+      case NodeType::VariableBinding:
+        dumper << " "
+               << SymbolTable::global().name(m_tree.m_symbols[node.a]);
+        break;
+      case NodeType::UnaryOperation:
+      case NodeType::BinaryOperation:
+        dumper << "(" << node.op << ")";
+        break;
+      case NodeType::FunctionCall:
+        dumper << "("
+               << SymbolTable::global().name(m_tree.m_symbols[node.a])
+               << ")";
+        break;
+      default:
+        break;
+    }
+  }
+
+  ASTDumper& current() { return m_dumpers.empty() ? m_root : m_dumpers.back(); }
+
+  const FlatTree& m_tree;
+  ASTDumper& m_root;
+  // A deque, because dumpers can't be moved around.
+  std::deque<ASTDumper> m_dumpers;
+  bool m_entered{false};
+};
+
+void FlatTree::dump(ASTDumper dumper) const {
+  FlatDumpVisitor visitor(*this, dumper);
+  walkNodes(visitor);
+}
+
+// Same as the `BytecodeVisitor` of the original tree, keeping the status of
+// the children visited so far in a stack.
+class FlatBytecodeVisitor final {
+ public:
+  FlatBytecodeVisitor(const FlatTree& tree, BytecodeCollector& collector)
+      : m_tree(tree), m_collector(collector) {}
+
+  bool visit(NodeId, uint32_t& step, NodeId& next);
+
+  BytecodeCollectionResult result() {
+    if (!m_error.empty())
+      return std::move(m_error);
+    assert(m_statuses.size() == 1);
+    BytecodeCollectionStatus status = m_statuses.back();
+    return status;
+  }
+
+ private:
+  bool error(std::string&& message) {
+    m_error = std::move(message);
+    return false;
+  }
+
+  // Pops the status of the last child visited, and returns whether it left a
+  // value in the stack.
+  bool childPushed() {
+    BytecodeCollectionStatus status = m_statuses.back();
+    m_statuses.pop_back();
+    return status == BytecodeCollectionStatus::PushedToStack;
+  }
+
+  bool pushed() {
+    m_statuses.push_back(BytecodeCollectionStatus::PushedToStack);
+    return true;
+  }
+
+  bool didntPush() {
+    m_statuses.push_back(BytecodeCollectionStatus::DidntPush);
+    return true;
+  }
+
+  SymbolId symbol(uint32_t index) const { return m_tree.m_symbols[index]; }
+
+  const FlatTree& m_tree;
+  BytecodeCollector& m_collector;
+  std::vector<BytecodeCollectionStatus> m_statuses;
+  // The variables being assigned to.
+  std::vector<LabelId> m_assignments;
+  std::string m_error;
+};
+
+bool FlatBytecodeVisitor::visit(NodeId id, uint32_t& step, NodeId& next) {
+  const FlatTree::Node& node = m_tree[id];
+  switch (node.kind) {
+    case NodeType::ConstantExpression:
+      m_collector.pushToStack(m_tree.constant(node.a));
+      return pushed();
+    case NodeType::VariableBinding: {
+      Optional<LabelId> label = m_collector.resolveVariable(symbol(node.a));
+      if (!label)
+        return error(std::string("Unresolved variable: ") +
+                     std::string(SymbolTable::global().name(symbol(node.a))));
+      m_collector.pushLoadVar(*label);
+      return pushed();
+    }
+    case NodeType::UnaryOperation:
+      assert(node.op == Operator::Plus || node.op == Operator::Minus);
+      if (!step++) {
+        if (node.op == Operator::Minus)
+          m_collector.pushToStack(Value::createDouble(0.));
+        next = node.a;
+        return true;
+      }
+      if (!childPushed())
+        return error("Expected an expression with a value");
+      if (node.op == Operator::Minus)
+        m_collector.binOp(node.op);
+      return pushed();
+    case NodeType::BinaryOperation: {
+      const bool isAssignment = node.op == Operator::Equals;
+      if (!step) {
+        if (!isAssignment) {
+          step = 1;
+          next = node.a;
+          return true;
+        }
+        const FlatTree::Node& lhs = m_tree[node.a];
+        if (lhs.kind != NodeType::VariableBinding)
+          return error("Assigned to something that was not a variable");
+        // We don't load the variable we're assigning to.
+        m_assignments.push_back(
+            m_collector.reserveVariableIdFor(symbol(lhs.a)));
+        step = 2;
+        next = node.b;
+        return true;
+      }
+      if (!childPushed()) {
+        if (isAssignment)
+          return error(
+              "Expected rhs of expression to leave a value "
+              "in the stack");
+        return error(
+            "Expected lhs of expression to leave a value in the stack");
+      }
+      if (step == 1) {
+        step = 2;
+        next = node.b;
+        return true;
+      }
+      if (isAssignment) {
+        m_collector.pushAssignTo(m_assignments.back());
+        m_assignments.pop_back();
+      } else {
+        m_collector.binOp(node.op);
+      }
+      return pushed();
+    }
+    case NodeType::Statement:
+      if (!step++) {
+        next = node.a;
+        return true;
+      }
+      if (childPushed())
+        m_collector.popFromStack();
+      return didntPush();
+    case NodeType::ParenthesizedExpression:
+      // The status of the inner expression is the status of the parens.
+      if (!step++)
+        next = node.a;
+      return true;
+    case NodeType::Block:
+      // `step` is the index of the next statement, or one past the last
+      // expression.
+      if (!step) {
+        m_collector.pushScope();
+      } else if (step <= node.b) {
+        bool pushed = childPushed();
+        assert(!pushed);
+        (void)pushed;
+      }
+      if (step < node.b) {
+        next = m_tree.list(node.a + step++);
+        return true;
+      }
+      if (step == node.b && node.c != kNoNode) {
+        step++;
+        next = node.c;
+        return true;
+      }
+      m_collector.popScope();
+      // The status of the last expression is the status of the block.
+      return node.c != kNoNode ? true : didntPush();
+    case NodeType::LazyBlock:
+      // The status of the block is the status of the lazy block.
+      if (!step++) {
+        if (node.a == kNoNode)
+          return error("Couldn't parse block");
+        next = node.a;
+      }
+      return true;
+    case NodeType::FunctionCall: {
+      Optional<BuiltinFunction> function =
+          BytecodeCollector::builtinFunction(symbol(node.a));
+      if (!function)
+        return error(std::string("Unknown function: ") +
+                     std::string(SymbolTable::global().name(symbol(node.a))));
+      if (step && !childPushed())
+        return error("Argument didn't leave a value on the stack...");
+      // Arguments are pushed in reverse order.
+      if (step < node.c) {
+        next = m_tree.list(node.b + node.c - ++step);
+        return true;
+      }
+      m_collector.pushFunctionCall(*function, node.c);
+      return pushed();
+    }
+    case NodeType::ConditionalExpression:
+    case NodeType::ForLoop:
+      return error(std::string("Bytecode generation not implemented yet for ") +
+                   kindName(node.kind));
+    case NodeType::Expression:
+      break;
+  }
+  assert(false && "Unexpected node kind");
+  return error("Internal error");
+}
+
+BytecodeCollectionResult FlatTree::toByteCode(
+    BytecodeCollector& collector) const {
+  FlatBytecodeVisitor visitor(*this, collector);
+  walkNodes(visitor);
+  return visitor.result();
+}
+
+}  // namespace ast
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "AST.h"
+#include "Result.h"
+
+namespace ast {
+
+using NodeId = uint32_t;
+constexpr NodeId kNoNode = std::numeric_limits<NodeId>::max();
+
+/**
+ * A compact, pointer-free copy of an AST.
+ *
+ * All the nodes live in a single array of fixed-size records addressed by
+ * 32-bit indices, in post-order, so that children always come before their
+ * parents, and the root is the last node. Constants and variable-length child
+ * lists (block statements, call arguments, loop clauses) live in their own
+ * side arrays, and so do the symbols the tree refers to, so that nothing in
+ * the node array depends on the symbol table of the process.
+ *
+ * The meaning of the `a`, `b` and `c` fields of each node depends on its kind:
+ *
+ *  - ConstantExpression: `a` is the index of the value in `constants()`.
+ *  - VariableBinding: `a` is the index of the symbol in `symbols()`.
+ *  - UnaryOperation: `a` is the operand.
+ *  - BinaryOperation: `a` and `b` are the left and right hand sides.
+ *  - Statement, ParenthesizedExpression: `a` is the inner expression.
+ *  - LazyBlock: `a` is the block, which gets parsed when building the flat
+ *    tree, or `kNoNode` if it failed to parse.
+ *  - Block: `b` statements start at `a` in the child lists, `c` is the last
+ *    expression.
+ *  - FunctionCall: `a` is the index of the function name in `symbols()`, and
+ *    `c` arguments start at `b` in the child lists.
+ *  - ConditionalExpression: `a` is the condition, `b` the inner expression and
+ *    `c` the else branch.
+ *  - ForLoop: the init, condition, after clause and body start at `a` in the
+ *    child lists.
+ *
+ * Optional children are `kNoNode` when missing.
+ *
+ * A tree can be written to a file with `write`, and used straight from the
+ * (memory-mapped) contents of the file with `map`, without copying the nodes.
+ */
+class FlatTree {
+ public:
+  struct Node {
+    NodeType kind;
+    Operator op;
+    // Always zero, so that files don't depend on uninitialized memory.
+    uint16_t padding;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+  };
+
+  static_assert(sizeof(Node) == 16, "Flat nodes are supposed to be small");
+
+  static FlatTree build(const ast::Node& root);
+
+  // Uses the nodes of a tree written by `write` in place. The data needs to
+  // outlive the tree, and be aligned like a `Node`, which memory mappings and
+  // malloc'd buffers are.
+  //
+  // The file may come from anywhere, so every node is checked to be a valid
+  // part of a tree before using it, in time proportional to the size of the
+  // file. Constants are decoded into the tree, and symbols interned.
+  static Result<FlatTree, std::string> map(const char* data, std::size_t size);
+
+  // Writes the tree in the format `map` reads. Constants are written as their
+  // type and 64 bits of payload, rather than in their in-memory
+  // representation, so the same tree always makes the same file. It's only
+  // readable on machines with the same byte order though.
+  void write(std::ostream&) const;
+
+  FlatTree(FlatTree&&) = default;
+  FlatTree& operator=(FlatTree&&) = default;
+  FlatTree(const FlatTree&) = delete;
+  FlatTree& operator=(const FlatTree&) = delete;
+
+  std::size_t size() const { return m_nodeCount; }
+  NodeId root() const { return m_nodeCount - 1; }
+  const Node& operator[](NodeId id) const {
+    assert(id < m_nodeCount);
+    return m_nodeData[id];
+  }
+  const Value& constant(uint32_t index) const {
+    assert(index < m_constantCount);
+    return m_constantData[index];
+  }
+  std::size_t constantCount() const { return m_constantCount; }
+  const std::vector<SymbolId>& symbols() const { return m_symbols; }
+
+  // The bytes used by the node, constant, child list and symbol arrays,
+  // whether they're owned by the tree or mapped.
+  std::size_t memoryUsage() const;
+
+  // Same output as `ast::Node::dump` on the original tree, which also names
+  // symbols from `SymbolTable::global()`, like `write` and `map` do.
+  void dump(ASTDumper) const;
+
+  // Same bytecode as `ast::Node::toByteCode` on the original tree.
+  BytecodeCollectionResult toByteCode(BytecodeCollector&) const;
+
+ private:
+  friend class FlatTreeBuilder;
+  friend class FlatDumpVisitor;
+  friend class FlatBytecodeVisitor;
+
+  FlatTree() = default;
+
+  // Points the arrays at the storage of the tree itself, once built.
+  void useOwnedStorage();
+  uint32_t symbolIndex(SymbolId);
+
+  // Adds `node`, whose children have already been added, and whose ids are at
+  // the end of `pending`. Replaces them with the id of `node`.
+  NodeId add(const ast::Node&, std::vector<NodeId>& pending);
+  NodeId push(NodeType kind,
+              Operator op,
+              uint32_t a,
+              uint32_t b,
+              uint32_t c) {
+    m_nodes.push_back({kind, op, 0, a, b, c});
+    return m_nodes.size() - 1;
+  }
+  uint32_t pushList(const NodeId* children, uint32_t count);
+
+  uint32_t list(uint32_t index) const { return m_listData[index]; }
+
+  // Whether the mapped arrays make up a tree that the walks below can use
+  // safely, given the number of symbols in the file.
+  bool isValid(uint32_t symbolCount) const;
+
+  // The children of a node in source order, like `ast::child`, which are
+  // `kNoNode` when missing.
+  uint32_t nodeChildCount(const Node&) const;
+  NodeId nodeChild(const Node&, uint32_t index) const;
+
+  // Walks the tree depth-first like `ast::walk` does, always with an explicit
+  // stack, since mapped trees may come from anywhere. The visitor is called
+  // as `visitor.visit(id, step, next)`, and sets `next` to `kNoNode` when done
+  // with the node.
+  template <typename Visitor>
+  bool walkNodes(Visitor&) const;
+
+  // The arrays of the tree, which either point to the storage below, or to
+  // the data passed to `map`.
+  const Node* m_nodeData{nullptr};
+  const Value* m_constantData{nullptr};
+  const NodeId* m_listData{nullptr};
+  uint32_t m_nodeCount{0};
+  uint32_t m_constantCount{0};
+  uint32_t m_listCount{0};
+
+  std::vector<Node> m_nodes;
+  std::vector<Value> m_constants;
+  std::vector<NodeId> m_lists;
+  // Always owned, since symbol ids are only meaningful within a process.
+  std::vector<SymbolId> m_symbols;
+
+  // The children of the node being added, see `add`.
+  std::vector<NodeId> m_children;
+  // The index of each symbol in `m_symbols` plus one, or zero if not there
+  // yet, while building.
+  std::vector<uint32_t> m_symbolIndices;
+};
+
+}  // namespace ast
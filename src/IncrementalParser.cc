@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "IncrementalParser.h"
+
+#include <algorithm>
+
+IncrementalParser::IncrementalParser(std::string source)
+    : m_source(std::move(source)) {
+  parseFromScratch();
+}
+
+ast::Node* IncrementalParser::edit(std::size_t offset,
+                                   std::size_t removed,
+                                   std::string_view inserted) {
+  assert(offset + removed <= m_source.size());
+  m_source.replace(offset, removed, inserted);
+  m_stats = Stats();
+  relex(offset, removed, inserted.size());
+  parse();
+  if (m_arena->capacity() > 2 * m_fullParseCapacity)
+    parseFromScratch();
+  return m_root;
+}
+
+void IncrementalParser::parseFromScratch() {
+  BufferReader reader(m_source.data(), m_source.size());
+  Tokenizer tokenizer(reader);
+  m_tokens = TokenBuffer::lexAll(tokenizer);
+  m_arena.reset(new ast::AstArena());
+  m_oldRecords.clear();
+  m_damageBegin = m_oldDamageEnd = m_newDamageEnd = 0;
+  m_stats = Stats();
+  m_stats.relexedTokens = m_tokens.size();
+  parse();
+  m_fullParseCapacity = m_arena->capacity();
+}
+
+void IncrementalParser::relex(std::size_t offset,
+                              std::size_t removed,
+                              std::size_t inserted) {
+  const int64_t delta = int64_t(inserted) - int64_t(removed);
+
+  // A token only depends on the bytes it spans and the one right after it, so
+  // the first token that may change is the first one that ends at or after the
+  // edit. The tokenizer was right after the previous one when it found it.
+  std::size_t first = 0;
+  std::size_t last = m_tokens.size();
+  while (first < last) {
+    std::size_t middle = first + (last - first) / 2;
+    if (m_tokens.span(middle).end() < offset)
+      first = middle + 1;
+    else
+      last = middle;
+  }
+  const uint32_t start = first ? m_tokens.span(first - 1).end() : 0;
+
+  // Lex until we find a token past the edit that starts where an old one did,
+  // since from there on the source and thus the tokens are the same.
+  BufferReader reader(m_source.data() + start, m_source.size() - start);
+  Tokenizer tokenizer(reader);
+  TokenBuffer relexed;
+  const std::size_t editEnd = offset + inserted;
+  std::size_t next = first;
+  bool synced = false;
+  while (true) {
+    Optional<Token> token = tokenizer.nextToken();
+    if (!token) {
+      relexed.setError(tokenizer.errorMessage(), tokenizer.location());
+      break;
+    }
+    const std::size_t position = start + token->span().offset;
+    if (position >= editEnd) {
+      const int64_t oldPosition = int64_t(position) - delta;
+      while (next < m_tokens.size() && m_tokens.span(next).offset < oldPosition)
+        next++;
+      if (next < m_tokens.size() && m_tokens.span(next).offset == oldPosition) {
+        synced = true;
+        break;
+      }
+    }
+    relexed.push(*token);
+    if (token->type() == TokenType::Eof)
+      break;
+  }
+
+  if (synced) {
+    m_tokens.splice(first, next, relexed, start, delta);
+    if (const char* error = m_tokens.errorMessage()) {
+      const Span& location = m_tokens.errorLocation();
+      m_tokens.setError(error,
+                        Span(location.offset + delta, location.length));
+    }
+  } else {
+    next = m_tokens.size();
+    m_tokens.splice(first, next, relexed, start, 0);
+    const Span& location = relexed.errorLocation();
+    m_tokens.setError(relexed.errorMessage(),
+                      Span(location.offset + start, location.length));
+  }
+
+  m_damageBegin = first;
+  m_oldDamageEnd = next;
+  m_newDamageEnd = first + relexed.size();
+  m_stats.relexedTokens = relexed.size();
+}
+
+void IncrementalParser::parse() {
+  Parser parser(m_tokens);
+  parser.setSubtreeTracker(this);
+  m_records.clear();
+  m_oldCursor = 0;
+  m_root = parser.parse();
+  m_error.reset(parser.error() ? new ParseError(*parser.error()) : nullptr);
+  m_stats.parsedNodes = parser.nodeCount() - m_stats.reusedNodes;
+  m_arena->adopt(parser.arena());
+  std::swap(m_records, m_oldRecords);
+}
+
+const ParsedSubtree* IncrementalParser::reuse(uint32_t firstToken,
+                                              ast::NodeType kind) {
+  // Map the token to where it was last time, if it was there.
+  uint32_t oldFirstToken = firstToken;
+  int64_t shift = 0;
+  if (firstToken >= m_newDamageEnd) {
+    shift = int64_t(m_newDamageEnd) - int64_t(m_oldDamageEnd);
+    oldFirstToken = firstToken - shift;
+  } else if (firstToken >= m_damageBegin) {
+    return nullptr;
+  }
+
+  // The parser asks in source order.
+  while (m_oldCursor < m_oldRecords.size() &&
+         m_oldRecords[m_oldCursor].subtree.firstToken < oldFirstToken)
+    m_oldCursor++;
+
+  for (std::size_t i = m_oldCursor; i < m_oldRecords.size() &&
+                                    m_oldRecords[i].subtree.firstToken ==
+                                        oldFirstToken;
+       ++i) {
+    const Record& record = m_oldRecords[i];
+    if (!record.subtree.node || record.subtree.node->kind() != kind)
+      continue;
+    // It has to be entirely before or after the damaged tokens.
+    if (oldFirstToken < m_damageBegin &&
+        record.subtree.endToken > m_damageBegin)
+      return nullptr;
+
+    // Keep the records of the reused subtrees too, so that they can be reused
+    // separately next time.
+    const std::size_t end = i + 1 + record.descendants;
+    for (std::size_t j = i; j < end; ++j) {
+      Record copy = m_oldRecords[j];
+      copy.subtree.firstToken += shift;
+      copy.subtree.endToken += shift;
+      m_records.push_back(copy);
+    }
+    m_oldCursor = end;
+
+    m_stats.reusedNodes += record.subtree.nodeCount;
+    m_reused = record.subtree;
+    m_reused.firstToken += shift;
+    m_reused.endToken += shift;
+    return &m_reused;
+  }
+  return nullptr;
+}
+
+uint32_t IncrementalParser::willParse() {
+  m_records.push_back({{nullptr, 0, 0, 0}, 0});
+  return m_records.size() - 1;
+}
+
+void IncrementalParser::didParse(uint32_t record,
+                                 const ParsedSubtree& subtree) {
+  m_records[record] = {subtree, uint32_t(m_records.size() - record - 1)};
+}
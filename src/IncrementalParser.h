@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "AstArena.h"
+#include "Parser.h"
+#include "TokenBuffer.h"
+
+// Parses a program, and then reparses it after each edit to its source,
+// re-lexing only the tokens around the edit and reusing the blocks and
+// statements that don't contain any of them.
+//
+// Trees returned by `root()` are only valid until the next edit.
+class IncrementalParser final : private SubtreeTracker {
+ public:
+  explicit IncrementalParser(std::string source);
+
+  // Replaces `removed` bytes at `offset` with `inserted`, and reparses.
+  ast::Node* edit(std::size_t offset,
+                  std::size_t removed,
+                  std::string_view inserted);
+
+  ast::Node* root() const { return m_root; }
+  const ParseError* error() const { return m_error.get(); }
+  const std::string& source() const { return m_source; }
+  const TokenBuffer& tokens() const { return m_tokens; }
+
+  // What the last (re)parse did.
+  struct Stats {
+    std::size_t relexedTokens{0};
+    std::size_t reusedNodes{0};
+    std::size_t parsedNodes{0};
+  };
+  const Stats& stats() const { return m_stats; }
+
+ private:
+  void parseFromScratch();
+  // Re-lexes the tokens that may have changed after replacing `removed` bytes
+  // at `offset` with `inserted` bytes.
+  void relex(std::size_t offset, std::size_t removed, std::size_t inserted);
+  void parse();
+
+  const ParsedSubtree* reuse(uint32_t firstToken, ast::NodeType) override;
+  uint32_t willParse() override;
+  void didParse(uint32_t record, const ParsedSubtree&) override;
+
+  struct Record {
+    // Null if the parser didn't get to finish it.
+    ParsedSubtree subtree;
+    // How many records for subtrees of this one follow it.
+    uint32_t descendants;
+  };
+
+  std::string m_source;
+  TokenBuffer m_tokens;
+  // Owns the nodes of all the trees since the last full parse. Replaced nodes
+  // are only freed by the next full parse, which happens once they outgrow the
+  // tree that was parsed last time.
+  std::unique_ptr<ast::AstArena> m_arena;
+  std::size_t m_fullParseCapacity{0};
+
+  ast::Node* m_root{nullptr};
+  std::unique_ptr<ParseError> m_error;
+  Stats m_stats;
+
+  // The blocks and statements of the last parse and of the current one, in
+  // source order.
+  std::vector<Record> m_oldRecords;
+  std::vector<Record> m_records;
+  // Where to start looking for subtrees to reuse in `m_oldRecords`.
+  std::size_t m_oldCursor{0};
+  ParsedSubtree m_reused;
+
+  // The tokens [m_damageBegin, m_oldDamageEnd) of the last parse were replaced
+  // by [m_damageBegin, m_newDamageEnd).
+  uint32_t m_damageBegin{0};
+  uint32_t m_oldDamageEnd{0};
+  uint32_t m_newDamageEnd{0};
+};
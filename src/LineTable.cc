@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "LineTable.h"
+
+#include <algorithm>
+#include <cstring>
+
+LineTable::LineTable(const char* data, std::size_t size)
+    : m_data(data), m_size(size), m_lineStarts{0} {}
+
+LineColumn LineTable::locate(uint32_t offset) {
+  const std::size_t target = std::min<std::size_t>(offset, m_size);
+  while (m_scanned < target) {
+    const char* start = m_data + m_scanned;
+    const char* newline =
+        static_cast<const char*>(memchr(start, '\n', target - m_scanned));
+    if (!newline) {
+      m_scanned = target;
+      break;
+    }
+    m_scanned = newline - m_data + 1;
+    m_lineStarts.push_back(m_scanned);
+  }
+
+  auto next =
+      std::upper_bound(m_lineStarts.begin(), m_lineStarts.end(), target);
+  const std::size_t line = next - m_lineStarts.begin() - 1;
+  return LineColumn{line, target - m_lineStarts[line]};
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "Tokenizer.h"
+
+// A zero-based line and column in the source.
+struct LineColumn {
+  std::size_t line;
+  std::size_t column;
+};
+
+// Printed one-based, like compilers usually do.
+inline std::ostream& operator<<(std::ostream& os, const LineColumn& location) {
+  return os << location.line + 1 << ":" << location.column + 1;
+}
+
+// Converts byte offsets in a source buffer to lines and columns.
+//
+// The tokenizer only tracks byte offsets, since line numbers are only needed
+// for diagnostics. Lines are found lazily, only as far into the buffer as the
+// offsets that are looked up.
+//
+// The buffer must outlive the table, and not change.
+class LineTable {
+ public:
+  LineTable(const char* data, std::size_t size);
+  explicit LineTable(const Reader& reader)
+      : LineTable(reader.data(), reader.size()) {}
+
+  LineColumn locate(uint32_t offset);
+  LineColumn locate(const Span& span) { return locate(span.offset); }
+
+ private:
+  const char* m_data;
+  std::size_t m_size;
+  // The offsets where each line we've seen so far starts.
+  std::vector<uint32_t> m_lineStarts;
+  // How much of the buffer we've looked at.
+  std::size_t m_scanned{0};
+};
@@ -91,5 +91,5 @@ template <typename T>
 Optional<T> Some(T value) {
   Optional<T> ret;
   ret.set(std::move(value));
-  return std::move(ret);
+  return ret;
 }
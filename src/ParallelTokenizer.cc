@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ParallelTokenizer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Chunk {
+  std::size_t begin{0};
+  std::size_t end{0};
+
+  // Lexed with a fresh symbol table and offsets relative to the start of the
+  // chunk, which get fixed up when copying the tokens to the result.
+  SymbolTable symbols;
+  TokenBuffer tokens;
+  std::vector<SymbolId> symbolMap;
+
+  std::size_t outputIndex{0};
+};
+
+// Runs `callback` for every index in [0, count), spreading them over
+// `threadCount` threads, the current one included.
+template <typename Callback>
+void runInParallel(std::size_t count, unsigned threadCount, Callback callback) {
+  std::atomic<std::size_t> next{0};
+  auto work = [&] {
+    for (std::size_t i = next++; i < count; i = next++)
+      callback(i);
+  };
+
+  std::vector<std::thread> workers;
+  for (std::size_t i = 1; i < std::min<std::size_t>(threadCount, count); ++i)
+    workers.emplace_back(work);
+  work();
+  for (std::thread& worker : workers)
+    worker.join();
+}
+
+// Finds where to end the chunk that should end around `target`: right after
+// the next newline or semicolon.
+std::size_t chunkBoundary(const char* data,
+                          std::size_t size,
+                          std::size_t target) {
+  for (std::size_t i = target; i < size; ++i) {
+    if (data[i] == '\n' || data[i] == ';')
+      return i + 1;
+  }
+  return size;
+}
+
+void lexChunk(const char* data, Chunk& chunk) {
+  const char* start = data + chunk.begin;
+  const std::size_t length = chunk.end - chunk.begin;
+
+  // Roughly one token every six bytes in typical generated code.
+  chunk.tokens.reserve(length / 6);
+  BufferReader reader(start, length);
+  Tokenizer tokenizer(reader, chunk.symbols);
+  chunk.tokens.lexFrom(tokenizer);
+}
+
+}  // namespace
+
+TokenBuffer tokenizeInParallel(Reader& reader,
+                               SymbolTable& symbols,
+                               unsigned threadCount,
+                               std::size_t minChunkSize) {
+  while (reader.fill()) {
+  }
+
+  if (!threadCount)
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+  const char* data = reader.data();
+  const std::size_t size = reader.size();
+  if (size > kMaxSourceSize) {
+    // Unlike the other tokenizers, don't bother lexing up to the limit.
+    TokenBuffer result;
+    result.setError(kSourceTooLarge, Span(0, 0));
+    return result;
+  }
+
+  // A few chunks per thread, so that a slow chunk doesn't hold everyone back.
+  const std::size_t chunkSize =
+      std::max(minChunkSize, size / (std::size_t(threadCount) * 4) + 1);
+  std::vector<std::size_t> boundaries;
+  for (std::size_t end = 0; end < size;)
+    boundaries.push_back(end = chunkBoundary(data, size, end + chunkSize - 1));
+  if (boundaries.empty())
+    boundaries.push_back(0);
+
+  std::vector<Chunk> chunks(boundaries.size());
+  for (std::size_t i = 0; i < chunks.size(); ++i) {
+    chunks[i].begin = i ? boundaries[i - 1] : 0;
+    chunks[i].end = boundaries[i];
+  }
+
+  runInParallel(chunks.size(), threadCount,
+                [&](std::size_t i) { lexChunk(data, chunks[i]); });
+
+  // Now stitch the chunks together. This is the only sequential part, and it
+  // only needs to look at each chunk and its distinct symbols.
+  //
+  // Interning each chunk's symbols in order, in the order they were first
+  // seen in the chunk, assigns the same ids the sequential tokenizer would.
+  TokenBuffer result;
+  std::size_t tokenCount = 0;
+  std::size_t usedChunks = 0;
+  for (Chunk& chunk : chunks) {
+    usedChunks++;
+    chunk.outputIndex = tokenCount;
+
+    chunk.symbolMap.resize(chunk.symbols.size());
+    for (SymbolId id = 0; id < chunk.symbols.size(); ++id)
+      chunk.symbolMap[id] = symbols.intern(chunk.symbols.name(id));
+
+    if (const char* error = chunk.tokens.errorMessage()) {
+      const Span& location = chunk.tokens.errorLocation();
+      result.setError(error,
+                      Span(location.offset + chunk.begin, location.length));
+      tokenCount += chunk.tokens.size();
+      break;
+    }
+
+    // Every chunk ends with an Eof token. We only want to keep the last one,
+    // or one that the tokenizer found before the end of the chunk (that is, a
+    // null byte).
+    assert(chunk.tokens.isComplete());
+    const std::size_t eof = chunk.tokens.size() - 1;
+    if (&chunk == &chunks.back() ||
+        chunk.tokens.span(eof).offset != chunk.end - chunk.begin) {
+      tokenCount += chunk.tokens.size();
+      break;
+    }
+    tokenCount += eof;
+  }
+
+  result.resize(tokenCount);
+  runInParallel(usedChunks, threadCount, [&](std::size_t i) {
+    const std::size_t next =
+        i + 1 < usedChunks ? chunks[i + 1].outputIndex : tokenCount;
+    const Chunk& chunk = chunks[i];
+    result.copyRelocated(chunk.outputIndex, chunk.tokens,
+                         next - chunk.outputIndex, chunk.begin,
+                         chunk.symbolMap);
+  });
+  return result;
+}
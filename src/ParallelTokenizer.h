@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include "SymbolTable.h"
+#include "TokenBuffer.h"
+#include "Tokenizer.h"
+
+// The smallest chunk of input worth handing to another thread.
+const std::size_t kMinParallelChunkSize = 256 * 1024;
+
+// Lexes the whole input of `reader` using up to `threadCount` threads (or as
+// many as the hardware supports, if zero), interning identifiers into
+// `symbols`.
+//
+// The input is split in chunks right after a newline or a semicolon, which can
+// never be in the middle of a token, and each chunk is lexed independently.
+// The result, including symbol ids, token locations and errors, is the same
+// as what lexing the input sequentially with a `Tokenizer` would produce.
+TokenBuffer tokenizeInParallel(
+    Reader&,
+    SymbolTable& = SymbolTable::global(),
+    unsigned threadCount = 0,
+    std::size_t minChunkSize = kMinParallelChunkSize);
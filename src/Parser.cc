@@ -19,38 +19,142 @@
 
 #include <memory>
 
+template <typename T>
+ast::ArenaArray<T*> Parser::takeScratch(std::size_t start) {
+  const std::size_t count = m_scratch.size() - start;
+  T** items = m_arena.allocateArray<T*>(count);
+  for (std::size_t i = 0; i < count; ++i)
+    items[i] = static_cast<T*>(m_scratch[start + i]);
+  m_scratch.resize(start);
+  return ast::ArenaArray<T*>(items, count);
+}
+
 ast::Node* Parser::parse() {
   // TODO(emilio): Create an anonymous block, and read a list of statements
   // instead?
-  m_astRoot = parseExpression();
+  ast::Expression* root = parseExpression();
+  if (root && parseEndOfProgram())
+    m_astRoot = root;
+
+  if (!m_astRoot)
+    assert(m_parseError);
+  return m_astRoot;
+}
 
-  auto tok = m_tokenizer.nextToken();
+bool Parser::parseEndOfProgram() {
+  auto tok = nextToken();
+  // Allow a trailing semicolon after the program.
+  if (tok && tok->type() == TokenType::SemiColon)
+    tok = nextToken();
   if (!tok || tok->type() != TokenType::Eof) {
-    m_astRoot.reset();
     noteParseError("Found unexpected token after program");
+    return false;
+  }
+  return true;
+}
+
+bool Parser::parseStreaming(StatementConsumer& consumer) {
+  assert(!m_tracker);
+  Optional<Token> tok = nextToken();
+  if (!tok || tok->type() != TokenType::LeftBrace) {
+    putBack(tok);
+    ast::Node* root = parse();
+    return root && consumer.program(*root);
   }
 
-  if (!m_astRoot)
-    assert(m_parseError);
-  return m_astRoot.get();
+  // This mirrors the block parsing in `parseOneExpression`.
+  if (!consumer.beginBlock())
+    return false;
+  m_blockDepth++;
+  ast::Expression* lastExpression = nullptr;
+  while (true) {
+    const ast::AstArena::Mark mark = m_arena.mark();
+    Optional<Token> closingBrace = nextToken();
+    if (!closingBrace) {
+      noteParseError("Unfinished block");
+      return false;
+    }
+    if (closingBrace->type() == TokenType::RightBrace)
+      break;
+    putBack(closingBrace);
+    ast::Expression* inner = parseExpression();
+    if (!inner)
+      return false;
+    Optional<Token> semiColonOrBrace = nextToken();
+    if (!semiColonOrBrace ||
+        (semiColonOrBrace->type() != TokenType::SemiColon &&
+         semiColonOrBrace->type() != TokenType::RightBrace)) {
+      noteParseError("Unbalanced block, or expected semicolon");
+      return false;
+    }
+    if (semiColonOrBrace->type() == TokenType::RightBrace) {
+      lastExpression = inner;
+      break;
+    }
+    if (!consumer.statement(*make<ast::Statement>(inner)))
+      return false;
+    m_arena.rewind(mark);
+  }
+
+  m_blockDepth--;
+  return consumer.endBlock(lastExpression) && parseEndOfProgram();
 }
 
-std::unique_ptr<ast::Expression> Parser::noteParseError(std::string&& message) {
+ast::Expression* Parser::noteParseError(std::string&& message) {
   assert(!m_parseError);
-  assert(!m_astRoot);
-  m_parseError.reset(
-      new ParseError(m_tokenizer.location(), std::move(message)));
+  m_parseError.reset(new ParseError(currentLocation(), std::move(message)));
   return nullptr;
 }
 
+ast::Expression* Parser::noteLexerError() {
+  if (const char* message = m_tokens.errorMessage())
+    return noteParseError(message);
+  return noteParseError("Unexpected end of token stream");
+}
+
+Span Parser::currentLocation() const {
+  if (m_index == m_tokens.size() && m_tokens.errorMessage())
+    return m_tokens.errorLocation();
+  if (m_tokens.isEmpty())
+    return Span();
+  // Point to the last token we've looked at.
+  return m_tokens.span(m_index ? m_index - 1 : 0);
+}
+
+bool Parser::refill() {
+  if ((!m_tokenizer && !m_pipeline) || m_window.isComplete() ||
+      m_window.errorMessage())
+    return false;
+
+  // Keep the last token around so that it can still be put back.
+  const bool keepLast = !m_window.isEmpty();
+  Token last = keepLast ? m_window.at(m_window.size() - 1)
+                        : Token::createOfType(TokenType::Eof, Span());
+  m_window.clear();
+  if (keepLast)
+    m_window.push(last);
+  m_index = m_window.size();
+  if (m_pipeline)
+    m_pipeline->takeBatch(m_window);
+  else
+    m_window.lexFrom(*m_tokenizer, kWindowSize);
+  return m_index < m_window.size();
+}
+
 Optional<Token> Parser::nextToken() {
-  if (m_lastToken)
-    return std::move(m_lastToken);
-  return m_tokenizer.nextToken();
+  if (m_index == m_tokens.size() && !refill()) {
+    // Keep returning Eof once we've reached the end of the stream.
+    if (m_tokens.isComplete())
+      return Some(m_tokens.at(m_tokens.size() - 1));
+    return None;
+  }
+  return Some(m_tokens.at(m_index++));
 }
 
-std::unique_ptr<ast::Expression> Parser::parseOneExpression() {
+ast::Expression* Parser::parseOneExpression() {
   Optional<Token> tok = nextToken();
+  if (!tok)
+    return noteLexerError();
 
   switch (tok->type()) {
     case TokenType::SemiColon:
@@ -63,21 +167,20 @@ std::unique_ptr<ast::Expression> Parser::parseOneExpression() {
           if (!tok || tok->type() != TokenType::LeftParen)
             return noteParseError(
                 "Expected left parenthesis after if condition");
-          std::unique_ptr<ast::Expression> condition = parseExpression();
+          ast::Expression* condition = parseExpression();
           if (!condition)
             return nullptr;
           tok = nextToken();
           if (!tok || tok->type() != TokenType::RightParen)
             return noteParseError("Expected right paren after if condition");
-          std::unique_ptr<ast::Expression> inner = parseExpression();
+          ast::Expression* inner = parseExpression();
           if (!inner)
             return nullptr;
-          std::unique_ptr<ast::ConditionalExpression> elseBranch =
+          ast::ConditionalExpression* elseBranch =
               tryParseRemainingConditionalBranches();
           if (!elseBranch && m_parseError)
             return nullptr;
-          return std::make_unique<ast::ConditionalExpression>(
-              std::move(condition), std::move(inner), std::move(elseBranch));
+          return make<ast::ConditionalExpression>(condition, inner, elseBranch);
         }
         case Keyword::Else:
           return noteParseError("extraneous else keyword");
@@ -86,12 +189,12 @@ std::unique_ptr<ast::Expression> Parser::parseOneExpression() {
           if (!tok || tok->type() != TokenType::LeftParen)
             return noteParseError("Expected left parenthesis after for clause");
 
-          std::unique_ptr<ast::Expression> init;
+          ast::Expression* init = nullptr;
 
           tok = nextToken();
           // Allow empty init clauses.
           if (!tok || tok->type() != TokenType::SemiColon) {
-            m_lastToken = std::move(tok);
+            putBack(tok);
             init = parseExpression();
             if (!init)
               return nullptr;
@@ -101,10 +204,10 @@ std::unique_ptr<ast::Expression> Parser::parseOneExpression() {
               return noteParseError("Expected semicolon after for init clause");
           }
 
-          std::unique_ptr<ast::Expression> condition;
+          ast::Expression* condition = nullptr;
           tok = nextToken();
           if (!tok || tok->type() != TokenType::SemiColon) {
-            m_lastToken = std::move(tok);
+            putBack(tok);
             condition = parseExpression();
             if (!condition)
               return nullptr;
@@ -115,9 +218,9 @@ std::unique_ptr<ast::Expression> Parser::parseOneExpression() {
           }
 
           tok = nextToken();
-          std::unique_ptr<ast::Expression> afterClause;
+          ast::Expression* afterClause = nullptr;
           if (!tok || tok->type() != TokenType::RightParen) {
-            m_lastToken = std::move(tok);
+            putBack(tok);
             afterClause = parseExpression();
             if (!afterClause)
               return nullptr;
@@ -128,18 +231,16 @@ std::unique_ptr<ast::Expression> Parser::parseOneExpression() {
                   "Expected closing paren after for final clause");
           }
 
-          std::unique_ptr<ast::Expression> body = parseExpression();
+          ast::Expression* body = parseExpression();
           if (!body)
             return nullptr;
-          return std::make_unique<ast::ForLoop>(
-              std::move(init), std::move(condition), std::move(afterClause),
-              std::move(body));
+          return make<ast::ForLoop>(init, condition, afterClause, body);
         }
         case Keyword::While: {
           Optional<Token> tok = nextToken();
           if (!tok || tok->type() != TokenType::LeftParen)
             return noteParseError("Expected left parenthesis after for clause");
-          std::unique_ptr<ast::Expression> condition = parseExpression();
+          ast::Expression* condition = parseExpression();
           if (!condition)
             return nullptr;
 
@@ -147,12 +248,11 @@ std::unique_ptr<ast::Expression> Parser::parseOneExpression() {
           if (!tok || tok->type() != TokenType::RightParen)
             return noteParseError("Expected left paren after while condition");
 
-          std::unique_ptr<ast::Expression> body = parseExpression();
+          ast::Expression* body = parseExpression();
           if (!body)
             return nullptr;
 
-          return std::make_unique<ast::ForLoop>(nullptr, std::move(condition),
-                                                nullptr, std::move(body));
+          return make<ast::ForLoop>(nullptr, condition, nullptr, body);
         }
       }
       assert(false);
@@ -166,68 +266,49 @@ std::unique_ptr<ast::Expression> Parser::parseOneExpression() {
                       ? Value::createInt(tok->number())
                       : Value::createDouble(tok->doubleValue());
 
-      return std::make_unique<ast::ConstantExpression>(val);
-    }
-    case TokenType::LeftParen: {
-      std::unique_ptr<ast::Expression> inner = parseExpression();
-      if (!inner)
-        return nullptr;
-      Optional<Token> endingParen = nextToken();
-      if (!endingParen || endingParen->type() != TokenType::RightParen)
-        return noteParseError("Unbalanced paren");
-      return std::make_unique<ast::ParenthesizedExpression>(std::move(inner));
+      return make<ast::ConstantExpression>(val);
     }
     case TokenType::LeftBrace: {
-      std::unique_ptr<ast::Expression> lastExpression;
-      std::vector<std::unique_ptr<ast::Statement>> statements;
-      while (true) {
-        Optional<Token> closingBrace = nextToken();
-        if (!closingBrace)
-          return noteParseError("Unfinished block");
-        if (closingBrace->type() == TokenType::RightBrace)
-          return std::make_unique<ast::Block>(std::move(statements), nullptr);
-        m_lastToken = std::move(closingBrace);
-        std::unique_ptr<ast::Expression> inner = parseExpression();
-        if (!inner)
-          return nullptr;
-        Optional<Token> semiColonOrBrace = nextToken();
-        if (!semiColonOrBrace ||
-            (semiColonOrBrace->type() != TokenType::SemiColon &&
-             semiColonOrBrace->type() != TokenType::RightBrace)) {
-          return noteParseError("Unbalanced block, or expected semicolon");
-        }
-        if (semiColonOrBrace->type() == TokenType::RightBrace)
-          return std::make_unique<ast::Block>(std::move(statements),
-                                              std::move(inner));
-        statements.push_back(
-            std::make_unique<ast::Statement>(std::move(inner)));
-      }
+      if (m_lazyBlocks && m_blockDepth)
+        return skipBlock();
+      const uint32_t firstToken = m_index - 1;
+      if (ast::Expression* reused = tryReuse(firstToken, ast::NodeType::Block))
+        return reused;
+      const uint32_t record = m_tracker ? m_tracker->willParse() : 0;
+      const std::size_t nodeCount = m_nodeCount;
+      m_blockDepth++;
+      ast::Expression* block = parseBlock();
+      m_blockDepth--;
+      if (block && m_tracker)
+        m_tracker->didParse(record, {block, firstToken, uint32_t(m_index),
+                                     uint32_t(m_nodeCount - nodeCount)});
+      return block;
     }
     case TokenType::Identifier: {
-      std::vector<std::unique_ptr<ast::Expression>> arguments;
-      std::string name = tok->ident();
+      const std::size_t firstArgument = m_scratch.size();
+      SymbolId name = tok->symbol();
 
       Optional<Token> tok = nextToken();
       if (!tok || tok->type() != TokenType::LeftParen) {
-        m_lastToken = std::move(tok);
-        return std::make_unique<ast::VariableBinding>(name.c_str());
+        putBack(tok);
+        return make<ast::VariableBinding>(name);
       }
 
       // Otherwise this is a function call.
       tok = nextToken();
       if (!tok)
-        return noteParseError(m_tokenizer.errorMessage());
+        return noteLexerError();
       if (tok->type() != TokenType::RightParen) {
-        m_lastToken = std::move(tok);
+        putBack(tok);
 
         while (true) {
           auto arg = parseExpression();
           if (!arg)
             return nullptr;
-          arguments.push_back(std::move(arg));
+          m_scratch.push_back(arg);
           tok = nextToken();
           if (!tok)
-            return noteParseError(m_tokenizer.errorMessage());
+            return noteLexerError();
           if (tok->type() == TokenType::RightParen)
             break;
           if (tok->type() != TokenType::Comma)
@@ -235,8 +316,8 @@ std::unique_ptr<ast::Expression> Parser::parseOneExpression() {
         }
       }
 
-      return std::make_unique<ast::FunctionCall>(std::move(name),
-                                                 std::move(arguments));
+      return make<ast::FunctionCall>(
+          name, takeScratch<ast::Expression>(firstArgument));
     }
     case TokenType::RightParen:
       return noteParseError("Unbalanced paren");
@@ -244,13 +325,10 @@ std::unique_ptr<ast::Expression> Parser::parseOneExpression() {
       return noteParseError("Unbalanced block");
     case TokenType::Comma:
       return noteParseError("Unexpected standalone comma");
-    case TokenType::Operator: {
-      Operator op = tok->op();
-      auto target = parseExpression();
-      if (!target)
-        return nullptr;
-      return std::make_unique<ast::UnaryOperation>(op, std::move(target));
-    }
+    case TokenType::LeftParen:
+    case TokenType::Operator:
+      assert(false && "Should've been handled by parseOperand");
+      break;
     case TokenType::Eof:
       return noteParseError("Unexpected EOF");
   }
@@ -259,6 +337,93 @@ std::unique_ptr<ast::Expression> Parser::parseOneExpression() {
   return nullptr;
 }
 
+ast::Expression* Parser::tryReuse(uint32_t firstToken, ast::NodeType kind) {
+  if (!m_tracker)
+    return nullptr;
+  const ParsedSubtree* subtree = m_tracker->reuse(firstToken, kind);
+  if (!subtree)
+    return nullptr;
+  m_index = subtree->endToken;
+  m_nodeCount += subtree->nodeCount;
+  return subtree->node;
+}
+
+ast::Expression* Parser::parseBlock() {
+  const std::size_t firstStatement = m_scratch.size();
+  while (true) {
+    Optional<Token> closingBrace = nextToken();
+    if (!closingBrace)
+      return noteParseError("Unfinished block");
+    if (closingBrace->type() == TokenType::RightBrace)
+      return make<ast::Block>(
+          takeScratch<ast::Statement>(firstStatement), nullptr);
+    putBack(closingBrace);
+    const uint32_t firstToken = m_index;
+    if (ast::Expression* reused =
+            tryReuse(firstToken, ast::NodeType::Statement)) {
+      m_scratch.push_back(reused);
+      continue;
+    }
+    const uint32_t record = m_tracker ? m_tracker->willParse() : 0;
+    const std::size_t nodeCount = m_nodeCount;
+    ast::Expression* inner = parseExpression();
+    if (!inner)
+      return nullptr;
+    Optional<Token> semiColonOrBrace = nextToken();
+    if (!semiColonOrBrace ||
+        (semiColonOrBrace->type() != TokenType::SemiColon &&
+         semiColonOrBrace->type() != TokenType::RightBrace)) {
+      return noteParseError("Unbalanced block, or expected semicolon");
+    }
+    if (semiColonOrBrace->type() == TokenType::RightBrace)
+      return make<ast::Block>(
+          takeScratch<ast::Statement>(firstStatement), inner);
+    ast::Statement* statement = make<ast::Statement>(inner);
+    if (m_tracker)
+      m_tracker->didParse(record, {statement, firstToken, uint32_t(m_index),
+                                   uint32_t(m_nodeCount - nodeCount)});
+    m_scratch.push_back(statement);
+  }
+}
+
+ast::Expression* Parser::skipBlock() {
+  const std::size_t firstToken = m_index - 1;
+  uint32_t depth = 1;
+  while (m_index < m_tokens.size()) {
+    switch (m_tokens.type(m_index++)) {
+      case TokenType::LeftBrace:
+        depth++;
+        break;
+      case TokenType::RightBrace:
+        if (!--depth)
+          return make<ast::LazyBlock>(*this, firstToken, m_index);
+        break;
+      case TokenType::Eof:
+        return noteParseError("Unfinished block");
+      default:
+        break;
+    }
+  }
+  return noteLexerError();
+}
+
+const ast::Block* Parser::parseLazyBlock(const ast::LazyBlock& block) {
+  // Don't bother once the program is known to be invalid.
+  if (m_parseError)
+    return nullptr;
+
+  const std::size_t index = m_index;
+  const uint32_t blockDepth = m_blockDepth;
+  m_index = block.firstToken() + 1;
+  // Blocks nested in this one are lazy again.
+  m_blockDepth = 1;
+  ast::Expression* parsed = parseBlock();
+  assert(!parsed || m_index == block.endToken());
+  m_index = index;
+  m_blockDepth = blockDepth;
+  return ast::toBlock(parsed);
+}
+
 static inline uint8_t operatorPriority(Operator op) {
   switch (op) {
     case Operator::Equals:
@@ -301,50 +466,101 @@ static inline uint8_t operatorPriority(Operator op) {
   return 0;
 }
 
-std::unique_ptr<ast::Expression> Parser::parseExpression() {
-  return parseWithOperatorPriorityAtLeast(0);
+uint8_t Parser::PendingOperator::minPriority() const {
+  return kind == Binary ? operatorPriority(op) : 0;
 }
 
-std::unique_ptr<ast::Expression> Parser::parseWithOperatorPriorityAtLeast(
-    uint8_t minPriority) {
-  auto expr = parseOneExpression();
-  if (!expr)
-    return nullptr;
+// This is equivalent to the usual precedence climbing recursion, where
+// operands of binary operators bind every operator of the same or higher
+// priority, and unary operators apply to the whole expression that follows,
+// but keeps the pending operators and parentheses in `m_operatorStack` instead
+// of the native stack, so that arbitrarily nested input can't overflow it.
+ast::Expression* Parser::parseExpression() {
+  const std::size_t base = m_operatorStack.size();
+  ast::Expression* expr = parseOperand();
+  while (expr) {
+    const uint8_t minPriority =
+        m_operatorStack.size() == base
+            ? 0
+            : m_operatorStack.back().minPriority();
+
+    Optional<Token> tok = nextToken();
+    if (!tok) {
+      expr = noteLexerError();
+      break;
+    }
 
+    if (tok->type() == TokenType::Operator &&
+        operatorPriority(tok->op()) >= minPriority) {
+      m_operatorStack.push_back({PendingOperator::Binary, tok->op(), expr});
+      expr = parseOperand();
+      continue;
+    }
+
+    putBack(tok);
+    if (m_operatorStack.size() == base)
+      break;
+
+    // Whatever is at the top of the stack is done, fold it.
+    PendingOperator pending = m_operatorStack.back();
+    m_operatorStack.pop_back();
+    switch (pending.kind) {
+      case PendingOperator::Binary:
+        expr = make<ast::BinaryOperation>(pending.op, pending.lhs, expr);
+        break;
+      case PendingOperator::Unary:
+        expr = make<ast::UnaryOperation>(pending.op, expr);
+        break;
+      case PendingOperator::Parenthesized: {
+        Optional<Token> endingParen = nextToken();
+        if (!endingParen || endingParen->type() != TokenType::RightParen)
+          expr = noteParseError("Unbalanced paren");
+        else
+          expr = make<ast::ParenthesizedExpression>(expr);
+        break;
+      }
+    }
+  }
+
+  m_operatorStack.resize(base);
+  return expr;
+}
+
+ast::Expression* Parser::parseOperand() {
   while (true) {
-    auto tok = nextToken();
+    Optional<Token> tok = nextToken();
     if (!tok)
-      return noteParseError(m_tokenizer.errorMessage());
-    if (tok->type() != TokenType::Operator ||
-        operatorPriority(tok->op()) < minPriority) {
-      m_lastToken = std::move(tok);
-      return expr;
+      return noteLexerError();
+    if (tok->type() == TokenType::LeftParen) {
+      m_operatorStack.push_back(
+          {PendingOperator::Parenthesized, Operator::Plus, nullptr});
+      continue;
     }
-
-    auto rhs = parseWithOperatorPriorityAtLeast(operatorPriority(tok->op()));
-    if (!rhs)
-      return nullptr;
-    expr = std::make_unique<ast::BinaryOperation>(tok->op(), std::move(expr),
-                                                  std::move(rhs));
+    if (tok->type() == TokenType::Operator) {
+      m_operatorStack.push_back({PendingOperator::Unary, tok->op(), nullptr});
+      continue;
+    }
+    putBack(tok);
+    return parseOneExpression();
   }
 }
 
-std::unique_ptr<ast::ConditionalExpression>
+ast::ConditionalExpression*
 Parser::tryParseRemainingConditionalBranches() {
   Optional<Token> tok = nextToken();
   if (!tok || tok->type() != TokenType::Keyword ||
       tok->keyword() != Keyword::Else) {
-    m_lastToken = std::move(tok);
+    putBack(tok);
     return nullptr;
   }
 
   tok = nextToken();
   if (!tok) {
-    m_lastToken = std::move(tok);
+    putBack(tok);
     return nullptr;
   }
 
-  std::unique_ptr<ast::Expression> conditional;
+  ast::Expression* conditional = nullptr;
   if (tok->type() == TokenType::Keyword && tok->keyword() == Keyword::If) {
     tok = nextToken();
     if (!tok || tok->type() != TokenType::LeftParen) {
@@ -360,20 +576,19 @@ Parser::tryParseRemainingConditionalBranches() {
       return nullptr;
     }
   } else {
-    m_lastToken = std::move(tok);
+    putBack(tok);
   }
 
-  std::unique_ptr<ast::Expression> body = parseExpression();
+  ast::Expression* body = parseExpression();
   if (!body)
     return nullptr;
 
-  std::unique_ptr<ast::ConditionalExpression> elseBranch;
+  ast::ConditionalExpression* elseBranch = nullptr;
   if (conditional) {
     elseBranch = tryParseRemainingConditionalBranches();
     if (!elseBranch && m_parseError)
       return nullptr;
   }
 
-  return std::make_unique<ast::ConditionalExpression>(
-      std::move(conditional), std::move(body), std::move(elseBranch));
+  return make<ast::ConditionalExpression>(conditional, body, elseBranch);
 }
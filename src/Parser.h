@@ -18,9 +18,12 @@
 #pragma once
 
 #include "AST.h"
+#include "TokenBuffer.h"
+#include "TokenPipeline.h"
 #include "Tokenizer.h"
 
 #include <memory>
+#include <utility>
 
 class ParseError {
  public:
@@ -35,32 +38,209 @@ class ParseError {
   std::string m_message;
 };
 
-class Parser {
+// Receives the program from `Parser::parseStreaming`, piece by piece. Returning
+// false from any of these stops parsing.
+class StatementConsumer {
  public:
-  explicit Parser(Tokenizer& tokenizer) : m_tokenizer(tokenizer) {}
+  virtual ~StatementConsumer() = default;
+
+  // The whole program, if it's not a block.
+  virtual bool program(const ast::Node&) = 0;
+
+  // Otherwise the block gets opened, its statements are handed out one at a
+  // time, and it gets closed with its last expression, which may be null.
+  virtual bool beginBlock() = 0;
+  virtual bool statement(const ast::Statement&) = 0;
+  virtual bool endBlock(const ast::Expression* lastExpression) = 0;
+};
+
+// A block or statement, and the range of tokens it was parsed from.
+struct ParsedSubtree {
+  ast::Expression* node;
+  uint32_t firstToken;
+  uint32_t endToken;
+  // How many nodes there are in the subtree, `node` included.
+  uint32_t nodeCount;
+};
+
+// Keeps track of the blocks and statements a parser goes through, and provides
+// the ones that can be reused from a previous parse of mostly the same tokens.
+// See `IncrementalParser`.
+class SubtreeTracker {
+ public:
+  virtual ~SubtreeTracker() = default;
+
+  // Returns a block or statement (depending on `kind`) that can be used
+  // instead of parsing again from `firstToken`, if any.
+  virtual const ParsedSubtree* reuse(uint32_t firstToken, ast::NodeType kind) = 0;
+
+  // Called right before and after parsing a block or statement, so that they
+  // can be recorded in source order. Not called for reused subtrees.
+  virtual uint32_t willParse() = 0;
+  virtual void didParse(uint32_t record, const ParsedSubtree&) = 0;
+};
+
+// The parser walks a `TokenBuffer` by index.
+//
+// It can either be handed the whole token stream of the program up front, or
+// a tokenizer, in which case it lexes in batches into a small window as it
+// goes.
+class Parser final : public ast::LazyBlockParser {
+ public:
+  explicit Parser(Tokenizer& tokenizer)
+      : m_tokenizer(&tokenizer), m_tokens(m_window) {
+    m_window.reserve(kWindowSize + 1);
+  }
+
+  explicit Parser(const TokenBuffer& tokens) : m_tokens(tokens) {}
+
+  // Parses the batches of tokens lexed on another thread by `pipeline`.
+  explicit Parser(TokenPipeline& pipeline)
+      : m_pipeline(&pipeline), m_tokens(m_window) {
+    m_window.reserve(TokenPipeline::kBatchSize + 1);
+  }
+
+  Parser(const Parser&) = delete;
+  Parser& operator=(const Parser&) = delete;
 
   ast::Node* parse();
+
+  // Parses the same programs as `parse()`, but if the program is a block, each
+  // of its statements is handed to `consumer` as soon as it's parsed, and
+  // freed right afterwards, so that only one statement needs to be in memory
+  // at once. The only difference is that a top-level block can't be the left
+  // hand side of a binary operator.
+  //
+  // Returns false on parse errors, which are reported by `error()` as usual,
+  // or if the consumer stopped parsing. Statements before a parse error may
+  // have been consumed already.
+  //
+  // Not supported with a `SubtreeTracker`, which would hold onto the freed
+  // statements.
+  bool parseStreaming(StatementConsumer& consumer);
+
   const ParseError* error() const { return m_parseError.get(); }
 
+  // Makes the parser only match the braces of blocks nested in other blocks,
+  // creating `ast::LazyBlock`s that get parsed the first time they're needed.
+  // The tokens need to stay around until then, so this is only supported when
+  // parsing a whole `TokenBuffer`.
+  //
+  // Errors inside lazy blocks are only reported by `error()` once the blocks
+  // get parsed.
+  void setLazyBlocks(bool lazy) {
+    assert(!lazy || (!m_tokenizer && !m_pipeline && !m_tracker));
+    m_lazyBlocks = lazy;
+  }
+
+  // Makes the parser report the blocks and statements it parses to `tracker`,
+  // and reuse the ones it provides. Only supported when parsing a whole
+  // `TokenBuffer`, without lazy blocks.
+  void setSubtreeTracker(SubtreeTracker* tracker) {
+    assert(!tracker || (!m_tokenizer && !m_pipeline && !m_lazyBlocks));
+    m_tracker = tracker;
+  }
+
+  // How many nodes have been created or reused so far.
+  std::size_t nodeCount() const { return m_nodeCount; }
+
+  // The arena holding the nodes of the tree returned by `parse()`.
+  const ast::AstArena& arena() const { return m_arena; }
+  ast::AstArena& arena() { return m_arena; }
+
  private:
+  // How many tokens we lex at once when parsing from a tokenizer.
+  static constexpr std::size_t kWindowSize = 1024;
+
   Optional<Token> nextToken();
 
-  std::unique_ptr<ast::Expression> parseOneExpression();
-  std::unique_ptr<ast::Expression> parseExpression();
-  std::unique_ptr<ast::ConditionalExpression>
+  // Un-does the last `nextToken()` call, which returned `token`.
+  void putBack(const Optional<Token>& token) {
+    if (token && m_index)
+      m_index--;
+  }
+
+  // Lexes (or takes from the pipeline) the next batch of tokens into the
+  // window, if we have a tokenizer.
+  bool refill();
+
+  const ast::Block* parseLazyBlock(const ast::LazyBlock&) override;
+
+  // Checks that there's nothing but an optional semicolon after the program.
+  bool parseEndOfProgram();
+
+  // Parses anything but operators and parenthesized expressions, which are
+  // handled by `parseExpression` and `parseOperand`.
+  ast::Expression* parseOneExpression();
+  ast::Expression* parseExpression();
+  // Pushes the unary operators and left parens in front of an operand to the
+  // operator stack, then parses the operand itself.
+  ast::Expression* parseOperand();
+  ast::ConditionalExpression*
   tryParseRemainingConditionalBranches();
+  // Parses the rest of a block, after its opening brace.
+  ast::Expression* parseBlock();
+  // Skips to the brace that closes the current block, for a lazy block.
+  ast::Expression* skipBlock();
+
+  template <typename T, typename... Args>
+  T* make(Args&&... args) {
+    m_nodeCount++;
+    return m_arena.make<T>(std::forward<Args>(args)...);
+  }
 
-  std::unique_ptr<ast::Expression> parseWithOperatorPriorityAtLeast(
-      uint8_t minPriority);
+  // Uses a subtree of the tracker instead of parsing it, if possible.
+  ast::Expression* tryReuse(uint32_t firstToken, ast::NodeType kind);
+
+  // Moves the nodes pushed to `m_scratch` since `start` to the arena.
+  template <typename T>
+  ast::ArenaArray<T*> takeScratch(std::size_t start);
 
   // The return value here is just convenience, it always returns null.
-  std::unique_ptr<ast::Expression> noteParseError(std::string&& message);
+  ast::Expression* noteParseError(std::string&& message);
+  ast::Expression* noteLexerError();
+  Span currentLocation() const;
+
+  // Only one of these is non-null if we're lexing as we go.
+  Tokenizer* m_tokenizer{nullptr};
+  TokenPipeline* m_pipeline{nullptr};
+  TokenBuffer m_window;
+
+  const TokenBuffer& m_tokens;
+  // The index of the next token to return from `m_tokens`.
+  std::size_t m_index{0};
+
+  SubtreeTracker* m_tracker{nullptr};
+  std::size_t m_nodeCount{0};
+
+  bool m_lazyBlocks{false};
+  // How many blocks we're in, lazy blocks are only created for nested ones.
+  uint32_t m_blockDepth{0};
+
+  // Owns all the nodes of the tree.
+  ast::AstArena m_arena;
+  ast::Node* m_astRoot{nullptr};
+  // The statements and arguments of the blocks and function calls being
+  // parsed, so that we don't need a vector per node.
+  std::vector<ast::Expression*> m_scratch;
 
-  Tokenizer& m_tokenizer;
+  // An operator or paren that still waits for its (right hand side) operand.
+  struct PendingOperator {
+    enum Kind : uint8_t {
+      Binary,
+      Unary,
+      Parenthesized,
+    };
 
-  // We need this lookahead token :(
-  Optional<Token> m_lastToken;
+    Kind kind;
+    Operator op;
+    // The left hand side, for binary operators.
+    ast::Expression* lhs;
 
-  std::unique_ptr<ast::Node> m_astRoot{nullptr};
+    // The priority an operator following the operand needs to have to be part
+    // of the operand.
+    uint8_t minPriority() const;
+  };
+  std::vector<PendingOperator> m_operatorStack;
   std::unique_ptr<ParseError> m_parseError{nullptr};
 };
@@ -3,113 +3,264 @@
 #include "AST.h"
 #include "BytecodeCollector.h"
 #include "ExecutionContext.h"
+#include "FlatAST.h"
+#include "Parser.h"
+#include "RegisterCode.h"
+#include "Varint.h"
+#include <algorithm>
 #include <cmath>
 
-class ProgramExecutionState {
- public:
-  ProgramExecutionState(const std::vector<Bytecode>& bytecode,
-                        ExecutionContext& ctx)
-      : m_bytecode(bytecode), m_ctx(ctx) {
-    assert(!m_bytecode.empty());
-  }
+// Use labels as values to jump straight from each instruction handler to the
+// next one, rather than through a switch.
+#if defined(__GNUC__) && !defined(DISABLE_COMPUTED_GOTO)
+#define HAVE_COMPUTED_GOTO
+#endif
+
+// The handlers of the stack machine. The threaded code of a program has one
+// of these per instruction, followed by its operands:
+//
+//  * Load: a pointer to the constant.
+//  * StoreVar, LoadVar, ClearVar: the label.
+//  * CallFunction: the function, and the argument count.
+//  * Unsupported: the instruction, for the error message.
+//
+// And always ends with Halt, so that handlers don't need to check for the end
+// of the code.
+//
+// The stack is a preallocated array, as deep as the program needs, with its
+// top value cached in a local, see `executeThreaded`.
+enum class ThreadedOp : uint8_t {
+  Load,
+  Pop,
+  StoreVar,
+  LoadVar,
+  ClearVar,
+  Add,
+  Subtract,
+  Mul,
+  Div,
+  CallFunction,
+  Unsupported,
+  Halt,
+  Count,
+};
 
-  bool execute();
-  bool executeInstruction(Instruction);
-  bool executeFunction(BuiltinFunction id, size_t args);
-  bool executeAbs(size_t args);
-  bool executeCos(size_t args);
-  bool executePow(size_t args);
-  bool executeSin(size_t args);
-  bool executeSqrt(size_t args);
-
-  const Bytecode& at(ssize_t offset) const {
-    size_t final_offset = m_pc + offset;
-    assert(final_offset < m_bytecode.size());
-    return m_bytecode[final_offset];
+static bool executeThreaded(const ThreadedSlot* code,
+                            size_t stackDepth,
+                            ExecutionContext* ctx,
+                            const void* const** handlers);
+
+// Also computes how deep the stack gets while running the code.
+static std::vector<ThreadedSlot> threadCode(const CompactBytecode& bytecode,
+                                            size_t& stackDepth) {
+  const void* const* handlers = nullptr;
+#ifdef HAVE_COMPUTED_GOTO
+  executeThreaded(nullptr, 0, nullptr, &handlers);
+#endif
+
+  std::vector<ThreadedSlot> code;
+  auto emit = [&](ThreadedOp op) {
+    ThreadedSlot slot;
+    if (handlers)
+      slot.handler = handlers[size_t(op)];
+    else
+      slot.operand = uint64_t(op);
+    code.push_back(slot);
+  };
+  auto operand = [&](uint64_t value) {
+    ThreadedSlot slot;
+    slot.operand = value;
+    code.push_back(slot);
+  };
+
+  // Programs don't pop values they didn't push.
+  size_t depth = 0;
+  stackDepth = 0;
+  auto push = [&](size_t count) {
+    depth += count;
+    stackDepth = std::max(stackDepth, depth);
+  };
+  auto pop = [&](size_t count) {
+    assert(depth >= count);
+    depth -= count;
+  };
+
+  const uint8_t* cursor = bytecode.code().data();
+  const uint8_t* end = cursor + bytecode.code().size();
+  while (cursor < end) {
+    const Instruction ins = Instruction(*cursor++);
+    switch (ins) {
+      case Instruction::Load: {
+        push(1);
+        emit(ThreadedOp::Load);
+        ThreadedSlot slot;
+        slot.constant =
+            &bytecode.constants()[readVarint(cursor)];
+        code.push_back(slot);
+        break;
+      }
+      case Instruction::Pop:
+        pop(1);
+        emit(ThreadedOp::Pop);
+        break;
+      case Instruction::StoreVar:
+        emit(ThreadedOp::StoreVar);
+        operand(readVarint(cursor));
+        break;
+      case Instruction::LoadVar:
+        push(1);
+        emit(ThreadedOp::LoadVar);
+        operand(readVarint(cursor));
+        break;
+      case Instruction::ClearVar:
+        emit(ThreadedOp::ClearVar);
+        operand(readVarint(cursor));
+        break;
+      case Instruction::Add:
+        pop(1);
+        emit(ThreadedOp::Add);
+        break;
+      case Instruction::Subtract:
+        pop(1);
+        emit(ThreadedOp::Subtract);
+        break;
+      case Instruction::Mul:
+        pop(1);
+        emit(ThreadedOp::Mul);
+        break;
+      case Instruction::Div:
+        pop(1);
+        emit(ThreadedOp::Div);
+        break;
+      case Instruction::CallFunction: {
+        emit(ThreadedOp::CallFunction);
+        operand(*cursor++);
+        const uint64_t count = readVarint(cursor);
+        operand(count);
+        pop(count);
+        push(1);
+        break;
+      }
+      case Instruction::Jump:
+      case Instruction::JumpIfZero:
+        emit(ThreadedOp::Unsupported);
+        operand(uint64_t(ins));
+        CompactBytecode::readOffset(cursor);
+        break;
+    }
   }
+  emit(ThreadedOp::Halt);
+  return code;
+}
 
-  bool done() const { return m_pc >= m_bytecode.size(); }
-
-  void jmp(ssize_t offset) {
-    if (offset < 0) {
-      assert(m_pc >= static_cast<size_t>(-offset));
-    }
-    m_pc += offset;
+Result<std::unique_ptr<Program>, ProgramCreationError> Program::create(
+    const std::vector<Bytecode>& bytecode,
+    ExecutionEngine engine) {
+  std::unique_ptr<Program> program(
+      new Program(CompactBytecode::encode(bytecode), engine));
+  if (engine == ExecutionEngine::Register) {
+    auto registerCode = RegisterCode::fromBytecode(program->m_bytecode);
+    if (!registerCode)
+      return ProgramCreationError(registerCode.unwrapErr());
+    program->m_registerCode = registerCode.unwrap();
+  } else {
+    program->m_threadedCode =
+        threadCode(program->m_bytecode, program->m_stackDepth);
   }
+  return std::move(program);
+}
 
-  void advance(size_t offset) { jmp(offset); }
+Result<std::unique_ptr<Program>, ProgramCreationError> Program::fromAST(
+    const ast::Node& ast,
+    ExecutionEngine engine) {
+  BytecodeCollector collector;
+  ast::BytecodeCollectionResult result = ast.toByteCode(collector);
+  if (!result)
+    return ProgramCreationError(result.unwrapErr());
+  return create(collector.takeBytecode(), engine);
+}
 
-  const Bytecode& curr() const { return at(0); }
+Result<std::unique_ptr<Program>, ProgramCreationError> Program::fromFlatTree(
+    const ast::FlatTree& tree,
+    ExecutionEngine engine) {
+  BytecodeCollector collector;
+  ast::BytecodeCollectionResult result = tree.toByteCode(collector);
+  if (!result)
+    return ProgramCreationError(result.unwrapErr());
+  return create(collector.takeBytecode(), engine);
+}
 
-  const Value& expectValueAt(ssize_t offset) const {
-    return at(offset).value();
+namespace {
+
+// Emits the same bytecode as `ast::Block::toByteCode` would for the whole
+// block.
+class StreamingCompiler final : public StatementConsumer {
+ public:
+  bool program(const ast::Node& node) override {
+    return check(node.toByteCode(m_collector));
   }
 
-  const LabelId expectLabelAt(ssize_t offset) const {
-    return at(offset).labelId();
+  bool beginBlock() override {
+    m_collector.pushScope();
+    return true;
   }
 
-  const size_t expectArgumentCountAt(ssize_t offset) const {
-    return at(offset).argumentCount();
+  bool statement(const ast::Statement& statement) override {
+    return check(statement.toByteCode(m_collector));
   }
 
-  const BuiltinFunction expectFunctionAt(ssize_t offset) const {
-    return at(offset).function();
+  bool endBlock(const ast::Expression* lastExpression) override {
+    if (lastExpression && !check(lastExpression->toByteCode(m_collector)))
+      return false;
+    m_collector.popScope();
+    return true;
   }
 
-  bool error(const std::string& msg) {
-    m_ctx.noteError(msg);
+  BytecodeCollector& collector() { return m_collector; }
+  std::string& error() { return m_error; }
+
+ private:
+  bool check(ast::BytecodeCollectionResult&& result) {
+    if (result)
+      return true;
+    m_error = result.unwrapErr();
     return false;
   }
 
- private:
-  const std::vector<Bytecode>& m_bytecode;
-  ExecutionContext& m_ctx;
-  size_t m_pc{0};
+  BytecodeCollector m_collector;
+  std::string m_error;
 };
 
-Result<std::unique_ptr<Program>, ProgramCreationError> Program::fromAST(
-    const ast::Node& ast) {
-  BytecodeCollector collector;
-  ast::BytecodeCollectionResult result = ast.toByteCode(collector);
-  if (!result)
-    return ProgramCreationError(result.unwrapErr());
-  return std::unique_ptr<Program>(new Program(collector.takeBytecode()));
+}  // namespace
+
+Result<std::unique_ptr<Program>, ProgramCreationError>
+Program::compileStreaming(Parser& parser, ExecutionEngine engine) {
+  StreamingCompiler compiler;
+  if (!parser.parseStreaming(compiler)) {
+    if (parser.error())
+      return ProgramCreationError(std::string(parser.error()->message()));
+    return ProgramCreationError(std::move(compiler.error()));
+  }
+  return create(compiler.collector().takeBytecode(), engine);
 }
 
+static bool executeRegisters(const RegisterCode&, ExecutionContext&);
+
 bool Program::execute(ExecutionContext& ctx) {
-  ProgramExecutionState state(m_bytecode, ctx);
-  return state.execute();
+  if (m_engine == ExecutionEngine::Register)
+    return executeRegisters(m_registerCode, ctx);
+  return executeThreaded(m_threadedCode.data(), m_stackDepth, &ctx, nullptr);
 }
 
 std::ostream& operator<<(std::ostream& os, const Program& program) {
+  if (program.m_engine == ExecutionEngine::Register)
+    return os << program.m_registerCode;
   os << "Program(\n";
-  for (const auto& bytecode : program.m_bytecode)
+  for (const auto& bytecode : program.m_bytecode.decode())
     os << "  " << bytecode << '\n';
   return os << ")";
 }
 
-bool ProgramExecutionState::execute() {
-  while (!done()) {
-    const Bytecode& current = curr();
-    switch (current.kind()) {
-      case BytecodeKind::Value:
-      case BytecodeKind::ArgumentCount:
-      case BytecodeKind::Offset:
-      case BytecodeKind::LabelId:
-      case BytecodeKind::BuiltinFunctionId:
-        assert(false &&
-               "unexpected top-level bytecode kind, expected an instruction");
-        return false;
-      case BytecodeKind::Instruction:
-        if (!executeInstruction(current.instruction()))
-          return false;
-        break;
-    }
-  }
-  return true;
-}
-
 #define IMPL_OP(name_, op_, boolop_)                                     \
   static Value name_##Values(const Value& l, const Value& r) {           \
     assert(r.type() == l.type());                                        \
@@ -131,131 +282,231 @@ IMPL_OP(subract, -, -)
 IMPL_OP(mul, *, |)  // Dubious: do type-checking and prevent this!
 IMPL_OP(div, /, &)  // Dubious: do type-checking and prevent this!
 
-bool ProgramExecutionState::executeInstruction(Instruction ins) {
+// Applies an arithmetic instruction to two values.
+static inline bool arithmetic(Instruction ins, Value l, Value r, Value& result) {
+  if (r.type() != l.type()) {
+    // Hack for unary negation of integers.
+    //
+    // TODO(emilio): Either do type checking and put the correct value from
+    // the bytecode generator, or create proper coercion rules.
+    if (l.type() == ValueType::Float && l.doubleValue() == 0. &&
+        r.type() == ValueType::Integer) {
+      l = Value::createInt(0);
+    } else if (l.type() == ValueType::Float &&
+               r.type() == ValueType::Integer) {
+      // Integers meeting floats become floats, which is also what NaN-boxed
+      // integers that overflow 48 bits turn into, see `Value.h`.
+      r = Value::createDouble(double(r.intValue()));
+    } else if (l.type() == ValueType::Integer &&
+               r.type() == ValueType::Float) {
+      l = Value::createDouble(double(l.intValue()));
+    } else {
+      return false;
+    }
+  }
   switch (ins) {
     case Instruction::Subtract:
-    case Instruction::Add:
-    case Instruction::Mul:
-    case Instruction::Div: {
-      auto r = m_ctx.pop();
-      auto l = m_ctx.pop();
-      if (r.type() != l.type()) {
-        // Hack for unary negation of integers.
-        //
-        // TODO(emilio): Either do type checking and put the correct value from
-        // the bytecode generator, or create integer coercion rules.
-        if (l.type() == ValueType::Float &&
-            l.doubleValue() == 0. &&
-            r.type() == ValueType::Integer) {
-          l = Value::createInt(0);
-        } else {
-          return error("Mismatched types in binary operation");
-        }
-      }
-      switch (ins) {
-        case Instruction::Subtract:
-          m_ctx.push(subractValues(l, r));
-          break;
-        case Instruction::Add:
-          m_ctx.push(addValues(l, r));
-          break;
-        case Instruction::Mul:
-          m_ctx.push(mulValues(l, r));
-          break;
-        case Instruction::Div:
-          m_ctx.push(divValues(l, r));
-          break;
-        default:
-          __builtin_unreachable();
-      }
-      advance(1);
-      return true;
-    }
-    case Instruction::Load: {
-      Value val = expectValueAt(1);
-      m_ctx.push(std::move(val));
-      advance(2);
+      result = subractValues(l, r);
       return true;
-    }
-    case Instruction::Pop: {
-      m_ctx.pop();
-      advance(1);
+    case Instruction::Add:
+      result = addValues(l, r);
       return true;
-    }
-    case Instruction::StoreVar: {
-      assert(m_ctx.stackTop());
-      Value val = *m_ctx.stackTop();
-      LabelId id = expectLabelAt(1);
-      m_ctx.setVariable(id, val);
-      advance(2);
+    case Instruction::Mul:
+      result = mulValues(l, r);
       return true;
-    }
-    case Instruction::ClearVar: {
-      LabelId id = expectLabelAt(1);
-      m_ctx.clearVariable(id);
-      advance(2);
+    case Instruction::Div:
+      result = divValues(l, r);
       return true;
+    default:
+      break;
+  }
+  __builtin_unreachable();
+}
+
+static bool callFunction(BuiltinFunction,
+                         const Value* args,
+                         size_t count,
+                         Value& result);
+
+// Runs the threaded code of a program, see `threadCode`, on top of the stack
+// of `ctx`.
+//
+// The top of the stack lives in `top`, and the rest of it in the slots below
+// `sp`, so binary operations work in place on `top`. The first slot holds the
+// (meaningless) initial value of `top`, so that pushing doesn't need to check
+// whether the stack is empty.
+//
+// With computed gotos, the addresses of the handlers are only available
+// here, so when `handlers` is non-null this returns them instead.
+#ifdef HAVE_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+static bool executeThreaded(const ThreadedSlot* pc,
+                            size_t stackDepth,
+                            ExecutionContext* context,
+                            const void* const** handlers) {
+#ifdef HAVE_COMPUTED_GOTO
+  // In the order of `ThreadedOp`.
+  static const void* const kHandlers[] = {
+      &&Load, &&Pop, &&StoreVar, &&LoadVar, &&ClearVar, &&Add, &&Subtract,
+      &&Mul, &&Div, &&CallFunction, &&Unsupported, &&Halt,
+  };
+  static_assert(sizeof(kHandlers) / sizeof(*kHandlers) ==
+                    size_t(ThreadedOp::Count),
+                "Missing handlers");
+  if (handlers) {
+    *handlers = kHandlers;
+    return true;
+  }
+#else
+  assert(!handlers);
+#endif
+  ExecutionContext& ctx = *context;
+  Value* const base = ctx.growStack(stackDepth + 1);
+  Value* sp = base;
+  Value top = Value::createInt(0);
+
+  // Leaves the values of the program on the stack of `ctx`.
+  auto finish = [&](bool result) {
+    if (sp == base) {
+      ctx.trimStack(base);
+      return result;
     }
-    case Instruction::LoadVar: {
-      LabelId id = expectLabelAt(1);
-      Value val = m_ctx.getVariable(id);
-      m_ctx.push(std::move(val));
-      advance(2);
-      return true;
+    *sp = top;
+    std::copy(base + 1, sp + 1, base);
+    ctx.trimStack(sp);
+    return result;
+  };
+
+#ifdef HAVE_COMPUTED_GOTO
+#define HANDLER(op_) op_:
+#define DISPATCH() goto*(pc++)->handler
+#else
+#define HANDLER(op_) case ThreadedOp::op_:
+#define DISPATCH() continue
+#endif
+
+#define PUSH(value_) \
+  do {                \
+    *sp++ = top;      \
+    top = value_;     \
+  } while (0)
+#define POP() (top = *--sp)
+
+#define ARITHMETIC(op_)                                        \
+  HANDLER(op_) {                                               \
+    const Value rhs = top;                                     \
+    POP();                                                     \
+    if (!arithmetic(Instruction::op_, top, rhs, top)) {        \
+      ctx.noteError("Mismatched types in binary operation");   \
+      return finish(false);                                    \
+    }                                                          \
+    DISPATCH();                                                \
+  }
+
+  // The arguments of the function being called.
+  std::vector<Value> arguments;
+
+#ifdef HAVE_COMPUTED_GOTO
+  DISPATCH();
+#else
+  while (true) {
+    switch (ThreadedOp((pc++)->operand)) {
+#endif
+
+  HANDLER(Load) {
+    PUSH(*(pc++)->constant);
+    DISPATCH();
+  }
+  HANDLER(Pop) {
+    assert(sp != base);
+    POP();
+    DISPATCH();
+  }
+  HANDLER(StoreVar) {
+    assert(sp != base);
+    ctx.setVariable((pc++)->operand, top);
+    DISPATCH();
+  }
+  HANDLER(LoadVar) {
+    PUSH(ctx.getVariable((pc++)->operand));
+    DISPATCH();
+  }
+  HANDLER(ClearVar) {
+    ctx.clearVariable((pc++)->operand);
+    DISPATCH();
+  }
+  ARITHMETIC(Add)
+  ARITHMETIC(Subtract)
+  ARITHMETIC(Mul)
+  ARITHMETIC(Div)
+  HANDLER(CallFunction) {
+    BuiltinFunction id = BuiltinFunction((pc++)->operand);
+    size_t count = (pc++)->operand;
+    // The first argument is on top of the stack.
+    arguments.clear();
+    for (size_t i = 0; i < count; ++i) {
+      arguments.push_back(top);
+      POP();
     }
-    case Instruction::CallFunction: {
-      BuiltinFunction id = expectFunctionAt(1);
-      size_t args = expectArgumentCountAt(2);
-      if (!executeFunction(id, args))
-        return error("Error in function evaluation");
-      advance(3);
-      return true;
+    Value result = Value::createInt(0);
+    if (!callFunction(id, arguments.data(), count, result)) {
+      ctx.noteError("Error in function evaluation");
+      return finish(false);
     }
-
-    default:
-      std::cerr << "Found unknown (yet) instruction: " << ins << std::endl;
-      return false;
+    PUSH(result);
+    DISPATCH();
+  }
+  HANDLER(Unsupported) {
+    std::cerr << "Found unknown (yet) instruction: "
+              << Instruction((pc++)->operand) << std::endl;
+    return finish(false);
+  }
+  HANDLER(Halt) {
+    return finish(true);
   }
-  return false;
-}
 
-bool ProgramExecutionState::executeFunction(BuiltinFunction id, size_t args) {
-  switch (id) {
-    case BuiltinFunction::Abs:
-      return executeAbs(args);
-    case BuiltinFunction::Pow:
-      return executePow(args);
-    case BuiltinFunction::Cos:
-      return executeCos(args);
-    case BuiltinFunction::Sin:
-      return executeSin(args);
-    case BuiltinFunction::Sqrt:
-      return executeSqrt(args);
+#ifndef HAVE_COMPUTED_GOTO
+      case ThreadedOp::Count:
+        break;
+    }
+    assert(false && "Unknown handler");
+    return finish(false);
   }
-  assert(false && "unknown function!");
-  return false;
+#endif
+
+#undef ARITHMETIC
+#undef POP
+#undef PUSH
+#undef DISPATCH
+#undef HANDLER
 }
+#ifdef HAVE_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
 
 template<typename IntFunction, typename DoubleFunction>
-static bool simpleIntFunction(ExecutionContext& ctx,
+static bool simpleIntFunction(const Value* args,
                               size_t argCount,
+                              Value& result,
                               bool intReturnsDouble,
                               IntFunction intFn,
                               DoubleFunction doubleFn) {
   if (argCount != 1)
     return false;
-  Value val = ctx.pop();
+  const Value& val = args[0];
   switch (val.type()) {
     case ValueType::Bool:
       return false;
     case ValueType::Float:
-      ctx.push(Value::createDouble(doubleFn(val.doubleValue())));
+      result = Value::createDouble(doubleFn(val.doubleValue()));
       return true;
     case ValueType::Integer:
       if (intReturnsDouble)
-        ctx.push(Value::createDouble(intFn(val.intValue())));
+        result = Value::createDouble(intFn(val.intValue()));
       else
-        ctx.push(Value::createInt(intFn(val.intValue())));
+        result = Value::createInt(intFn(val.intValue()));
       return true;
   }
 
@@ -263,28 +514,12 @@ static bool simpleIntFunction(ExecutionContext& ctx,
   return false;
 }
 
-bool ProgramExecutionState::executeAbs(size_t args) {
-  return simpleIntFunction(m_ctx, args, false, abs, fabs);
-}
-
-bool ProgramExecutionState::executeCos(size_t args) {
-  return simpleIntFunction(m_ctx, args, true, cos, cos);
-}
-
-bool ProgramExecutionState::executeSin(size_t args) {
-  return simpleIntFunction(m_ctx, args, true, sin, sin);
-}
-
-bool ProgramExecutionState::executeSqrt(size_t args) {
-  return simpleIntFunction(m_ctx, args, true, sqrt, sqrt);
-}
-
-bool ProgramExecutionState::executePow(size_t args) {
-  if (args != 2)
+static bool callPow(const Value* args, size_t count, Value& result) {
+  if (count != 2)
     return false;
 
-  Value lhs = m_ctx.pop();
-  Value rhs = m_ctx.pop();
+  const Value& lhs = args[0];
+  const Value& rhs = args[1];
 
   if (lhs.type() != rhs.type())
     return false;
@@ -293,13 +528,96 @@ bool ProgramExecutionState::executePow(size_t args) {
     case ValueType::Bool:
       return false;
     case ValueType::Integer:
-      m_ctx.push(Value::createInt(std::pow(lhs.intValue(), rhs.intValue())));
+      result = Value::createInt(std::pow(lhs.intValue(), rhs.intValue()));
       return true;
     case ValueType::Float:
-      m_ctx.push(Value::createDouble(std::pow(lhs.doubleValue(), rhs.doubleValue())));
+      result = Value::createDouble(std::pow(lhs.doubleValue(), rhs.doubleValue()));
       return true;
   }
 
   assert(false && "Invalid value!");
   return false;
 }
+
+// Calls a builtin function, with the first argument first.
+static bool callFunction(BuiltinFunction id,
+                         const Value* args,
+                         size_t count,
+                         Value& result) {
+  switch (id) {
+    case BuiltinFunction::Abs:
+      return simpleIntFunction(args, count, result, false, abs, fabs);
+    case BuiltinFunction::Pow:
+      return callPow(args, count, result);
+    case BuiltinFunction::Cos:
+      return simpleIntFunction(args, count, result, true, cos, cos);
+    case BuiltinFunction::Sin:
+      return simpleIntFunction(args, count, result, true, sin, sin);
+    case BuiltinFunction::Sqrt:
+      return simpleIntFunction(args, count, result, true, sqrt, sqrt);
+  }
+  assert(false && "unknown function!");
+  return false;
+}
+
+// Runs a program on the register machine. The result of the program, if any,
+// is left on the stack of `ctx`, like the stack machine does.
+static bool executeRegisters(const RegisterCode& code, ExecutionContext& ctx) {
+  std::vector<Value> registers(code.registerCount(), Value::createInt(0));
+  std::copy(code.constants().begin(), code.constants().end(),
+            registers.begin());
+  std::vector<Value> arguments;
+
+  const uint8_t* pc = code.code().data();
+  const uint8_t* end = pc + code.code().size();
+  auto read = [&]() -> Value& {
+    return registers[readVarint(pc)];
+  };
+  while (pc < end) {
+    const RegisterInstruction ins = RegisterInstruction(*pc++);
+    Value& dst = read();
+    Instruction op;
+    switch (ins) {
+      case RegisterInstruction::Move:
+        dst = read();
+        continue;
+      case RegisterInstruction::CallFunction: {
+        const BuiltinFunction id = BuiltinFunction(*pc++);
+        const size_t count = readVarint(pc);
+        arguments.clear();
+        for (size_t i = 0; i < count; ++i)
+          arguments.push_back(read());
+        if (!callFunction(id, arguments.data(), count, dst)) {
+          ctx.noteError("Error in function evaluation");
+          return false;
+        }
+        continue;
+      }
+      case RegisterInstruction::Add:
+        op = Instruction::Add;
+        break;
+      case RegisterInstruction::Subtract:
+        op = Instruction::Subtract;
+        break;
+      case RegisterInstruction::Mul:
+        op = Instruction::Mul;
+        break;
+      case RegisterInstruction::Div:
+        op = Instruction::Div;
+        break;
+      default:
+        assert(false && "Unknown register instruction");
+        return false;
+    }
+    const Value& lhs = read();
+    const Value& rhs = read();
+    if (!arithmetic(op, lhs, rhs, dst)) {
+      ctx.noteError("Mismatched types in binary operation");
+      return false;
+    }
+  }
+
+  if (code.result() != RegisterCode::kNoRegister)
+    ctx.push(Value(registers[code.result()]));
+  return true;
+}
@@ -3,12 +3,16 @@
 #include <memory>
 #include <vector>
 #include "Bytecode.h"
+#include "RegisterCode.h"
 #include "Result.h"
 
 class Environment;
 class ExecutionContext;
 
+class Parser;
+
 namespace ast {
+class FlatTree;
 class Node;
 }
 
@@ -21,8 +25,29 @@ class ProgramCreationError {
   const std::string& message() const { return m_message; }
 };
 
+/**
+ * The machine a program runs on: either a stack machine, executing the
+ * bytecode the compiler emits directly, or a register machine, executing the
+ * same bytecode translated to `RegisterCode`.
+ */
+enum class ExecutionEngine : uint8_t {
+  Stack,
+  Register,
+};
+
+// An instruction handler or an operand of the threaded code the stack machine
+// runs, which gets decoded from the bytecode when the program is created.
+union ThreadedSlot {
+  const void* handler;
+  uint64_t operand;
+  const Value* constant;
+};
+
 /**
  * A program is a compiled array of bytecode, compiled from a given AST node.
+ *
+ * The bytecode is stored and executed in its compact form, see
+ * `CompactBytecode`.
  */
 class Program {
  public:
@@ -30,14 +55,50 @@ class Program {
    * TODO(emilio): Need to figure out a nice interface for external functions.
    */
   static Result<std::unique_ptr<Program>, ProgramCreationError> fromAST(
-      const ast::Node&);
+      const ast::Node&,
+      ExecutionEngine = ExecutionEngine::Stack);
+
+  /**
+   * Same as `fromAST`, from a flat copy of the tree, which may have been
+   * mapped from a file, see `ast::FlatTree::map`.
+   */
+  static Result<std::unique_ptr<Program>, ProgramCreationError> fromFlatTree(
+      const ast::FlatTree&,
+      ExecutionEngine = ExecutionEngine::Stack);
+
+  /**
+   * Parses and compiles a program one top-level statement at a time, without
+   * ever having the whole tree in memory, see `Parser::parseStreaming`.
+   *
+   * On parse errors, the actual error is reported by the parser.
+   */
+  static Result<std::unique_ptr<Program>, ProgramCreationError>
+  compileStreaming(Parser&, ExecutionEngine = ExecutionEngine::Stack);
 
   bool execute(ExecutionContext& ctx);
 
+  ExecutionEngine engine() const { return m_engine; }
+  // The bytecode of the program, which register programs are translated
+  // from.
+  const CompactBytecode& bytecode() const { return m_bytecode; }
+  // The code the register machine runs, for register programs.
+  const RegisterCode& registerCode() const { return m_registerCode; }
+
  private:
-  Program(std::vector<Bytecode>&& bytecode) : m_bytecode(std::move(bytecode)) {}
+  static Result<std::unique_ptr<Program>, ProgramCreationError> create(
+      const std::vector<Bytecode>&,
+      ExecutionEngine);
+
+  Program(CompactBytecode&& bytecode, ExecutionEngine engine)
+      : m_engine(engine), m_bytecode(std::move(bytecode)) {}
 
-  std::vector<Bytecode> m_bytecode;
+  ExecutionEngine m_engine;
+  CompactBytecode m_bytecode;
+  RegisterCode m_registerCode;
+  // The code the stack machine runs, for stack programs, and how many values
+  // it needs on the stack at most.
+  std::vector<ThreadedSlot> m_threadedCode;
+  size_t m_stackDepth{0};
 
   friend std::ostream& operator<<(std::ostream& os, const Program&);
 };
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "RegisterCode.h"
+
+#include <unordered_map>
+
+#include "Varint.h"
+
+std::ostream& operator<<(std::ostream& os, const RegisterInstruction& ins) {
+  switch (ins) {
+    case RegisterInstruction::Move:
+      return os << "Move";
+    case RegisterInstruction::Add:
+      return os << "Add";
+    case RegisterInstruction::Subtract:
+      return os << "Subtract";
+    case RegisterInstruction::Mul:
+      return os << "Mul";
+    case RegisterInstruction::Div:
+      return os << "Div";
+    case RegisterInstruction::CallFunction:
+      return os << "CallFunction";
+  }
+
+  assert(false);
+  return os;
+}
+
+// Simulates the stack of the stack machine, keeping track of the register
+// that holds each of its slots.
+class RegisterAllocator final {
+ public:
+  Result<RegisterCode, std::string> translate(const CompactBytecode&);
+
+ private:
+  // Registers are numbered separately for constants and for everything else
+  // until we know how many constants there are.
+  static constexpr uint32_t kConstant = 1u << 31;
+
+  struct PendingInstruction {
+    RegisterInstruction op;
+    uint32_t dst;
+    uint32_t lhs;
+    uint32_t rhs;
+    // For function calls, the function and where the arguments start in
+    // `m_arguments`. `rhs` is the argument count.
+    BuiltinFunction function;
+    uint32_t arguments;
+  };
+
+  uint32_t variable(LabelId);
+  // The register for the stack slot at `depth`.
+  uint32_t temporary(std::size_t depth);
+  void emit(RegisterInstruction op, uint32_t dst, uint32_t lhs, uint32_t rhs) {
+    m_instructions.push_back({op, dst, lhs, rhs, BuiltinFunction::Abs, 0});
+  }
+  void store(uint32_t variable);
+  void encode(RegisterCode&) const;
+
+  std::vector<PendingInstruction> m_instructions;
+  std::vector<uint32_t> m_arguments;
+  // The register holding each stack slot.
+  std::vector<uint32_t> m_stack;
+  std::unordered_map<LabelId, uint32_t> m_variables;
+  std::vector<uint32_t> m_temporaries;
+  uint32_t m_registerCount{0};
+};
+
+uint32_t RegisterAllocator::variable(LabelId label) {
+  auto entry = m_variables.emplace(label, m_registerCount);
+  if (entry.second)
+    m_registerCount++;
+  return entry.first->second;
+}
+
+uint32_t RegisterAllocator::temporary(std::size_t depth) {
+  while (m_temporaries.size() <= depth)
+    m_temporaries.push_back(m_registerCount++);
+  return m_temporaries[depth];
+}
+
+// Assigns the top of the stack to `variable`, leaving the variable there.
+void RegisterAllocator::store(uint32_t variable) {
+  assert(!m_stack.empty());
+  const std::size_t top = m_stack.size() - 1;
+
+  // Slots that still refer to the old value of the variable need their own
+  // copy now.
+  bool aliased = false;
+  for (std::size_t i = 0; i < top; ++i) {
+    if (m_stack[i] == variable) {
+      emit(RegisterInstruction::Move, temporary(i), variable, 0);
+      m_stack[i] = temporary(i);
+      aliased = true;
+    }
+  }
+
+  if (m_stack[top] == variable) {
+    // Assigning a variable to itself.
+  } else if (!aliased && m_stack[top] == temporary(top) &&
+             !m_instructions.empty() &&
+             m_instructions.back().dst == m_stack[top]) {
+    // The value was just computed, compute it into the variable instead.
+    m_instructions.back().dst = variable;
+  } else {
+    emit(RegisterInstruction::Move, variable, m_stack[top], 0);
+  }
+  m_stack[top] = variable;
+}
+
+Result<RegisterCode, std::string> RegisterAllocator::translate(
+    const CompactBytecode& bytecode) {
+  const uint8_t* cursor = bytecode.code().data();
+  const uint8_t* end = cursor + bytecode.code().size();
+  while (cursor < end) {
+    const Instruction ins = Instruction(*cursor++);
+    switch (ins) {
+      case Instruction::Load:
+        m_stack.push_back(kConstant | readVarint(cursor));
+        break;
+      case Instruction::Pop:
+        assert(!m_stack.empty());
+        m_stack.pop_back();
+        break;
+      case Instruction::StoreVar:
+        store(variable(readVarint(cursor)));
+        break;
+      case Instruction::LoadVar:
+        m_stack.push_back(variable(readVarint(cursor)));
+        break;
+      case Instruction::ClearVar:
+        // Variables are resolved when compiling, so nothing can see a
+        // cleared variable.
+        readVarint(cursor);
+        break;
+      case Instruction::Add:
+      case Instruction::Subtract:
+      case Instruction::Mul:
+      case Instruction::Div: {
+        assert(m_stack.size() >= 2);
+        const uint32_t rhs = m_stack.back();
+        m_stack.pop_back();
+        const uint32_t lhs = m_stack.back();
+        const uint32_t dst = temporary(m_stack.size() - 1);
+        const RegisterInstruction op =
+            ins == Instruction::Add        ? RegisterInstruction::Add
+            : ins == Instruction::Subtract ? RegisterInstruction::Subtract
+            : ins == Instruction::Mul      ? RegisterInstruction::Mul
+                                           : RegisterInstruction::Div;
+        emit(op, dst, lhs, rhs);
+        m_stack.back() = dst;
+        break;
+      }
+      case Instruction::CallFunction: {
+        const BuiltinFunction function = BuiltinFunction(*cursor++);
+        const uint32_t count = readVarint(cursor);
+        assert(m_stack.size() >= count);
+        // The first argument is on top of the stack.
+        const uint32_t arguments = m_arguments.size();
+        for (uint32_t i = 0; i < count; ++i)
+          m_arguments.push_back(m_stack[m_stack.size() - 1 - i]);
+        m_stack.resize(m_stack.size() - count);
+        const uint32_t dst = temporary(m_stack.size());
+        m_instructions.push_back({RegisterInstruction::CallFunction, dst, 0,
+                                  count, function, arguments});
+        m_stack.push_back(dst);
+        break;
+      }
+      case Instruction::Jump:
+      case Instruction::JumpIfZero:
+        return std::string("Jumps are not supported by the register machine");
+    }
+  }
+
+  RegisterCode code;
+  code.m_constants = bytecode.constants();
+  code.m_registerCount = code.m_constants.size() + m_registerCount;
+  encode(code);
+  if (!m_stack.empty())
+    code.m_result = m_stack.back() & kConstant
+                        ? m_stack.back() & ~kConstant
+                        : code.m_constants.size() + m_stack.back();
+  return std::move(code);
+}
+
+void RegisterAllocator::encode(RegisterCode& code) const {
+  const uint32_t constantCount = code.m_constants.size();
+  auto reg = [&](uint32_t operand) -> uint32_t {
+    return operand & kConstant ? operand & ~kConstant
+                               : constantCount + operand;
+  };
+
+  std::vector<uint8_t>& out = code.m_code;
+  for (const PendingInstruction& ins : m_instructions) {
+    out.push_back(uint8_t(ins.op));
+    writeVarint(out, reg(ins.dst));
+    switch (ins.op) {
+      case RegisterInstruction::Move:
+        writeVarint(out, reg(ins.lhs));
+        break;
+      case RegisterInstruction::Add:
+      case RegisterInstruction::Subtract:
+      case RegisterInstruction::Mul:
+      case RegisterInstruction::Div:
+        writeVarint(out, reg(ins.lhs));
+        writeVarint(out, reg(ins.rhs));
+        break;
+      case RegisterInstruction::CallFunction:
+        out.push_back(uint8_t(ins.function));
+        writeVarint(out, ins.rhs);
+        for (uint32_t i = 0; i < ins.rhs; ++i)
+          writeVarint(out,
+                                       reg(m_arguments[ins.arguments + i]));
+        break;
+    }
+  }
+  code.m_instructionCount = m_instructions.size();
+}
+
+Result<RegisterCode, std::string> RegisterCode::fromBytecode(
+    const CompactBytecode& bytecode) {
+  RegisterAllocator allocator;
+  return allocator.translate(bytecode);
+}
+
+std::ostream& operator<<(std::ostream& os, const RegisterCode& code) {
+  os << "RegisterCode(" << code.registerCount() << " registers\n";
+  for (std::size_t i = 0; i < code.constants().size(); ++i)
+    os << "  r" << i << " = " << code.constants()[i] << '\n';
+
+  const uint8_t* cursor = code.code().data();
+  const uint8_t* end = cursor + code.code().size();
+  while (cursor < end) {
+    const RegisterInstruction ins = RegisterInstruction(*cursor++);
+    os << "  " << ins << " r" << readVarint(cursor);
+    switch (ins) {
+      case RegisterInstruction::Move:
+        os << ", r" << readVarint(cursor);
+        break;
+      case RegisterInstruction::Add:
+      case RegisterInstruction::Subtract:
+      case RegisterInstruction::Mul:
+      case RegisterInstruction::Div:
+        os << ", r" << readVarint(cursor);
+        os << ", r" << readVarint(cursor);
+        break;
+      case RegisterInstruction::CallFunction: {
+        os << ", " << BuiltinFunction(*cursor++);
+        for (uint64_t i = readVarint(cursor); i--;)
+          os << ", r" << readVarint(cursor);
+        break;
+      }
+    }
+    os << '\n';
+  }
+  if (code.result() != RegisterCode::kNoRegister)
+    os << "  result r" << code.result() << '\n';
+  return os << ")";
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Bytecode.h"
+#include "Result.h"
+
+/**
+ * The instructions of the register machine, see `RegisterCode`.
+ */
+enum class RegisterInstruction : uint8_t {
+  /** `dst = src`. */
+  Move,
+  /** `dst = lhs op rhs`, like the stack instructions of the same name. */
+  Add,
+  Subtract,
+  Mul,
+  Div,
+  /**
+   * `dst = function(args...)`. Followed by the destination, the function as a
+   * byte, the argument count, and the register of each argument.
+   */
+  CallFunction,
+};
+
+std::ostream& operator<<(std::ostream&, const RegisterInstruction&);
+
+/**
+ * A program for a register machine: three-address instructions over a
+ * register file, rather than instructions that push and pop values.
+ *
+ * The first registers hold the constants of the program, and get initialized
+ * from `constants()` before running it. The rest hold variables and
+ * temporaries.
+ *
+ * The code is encoded like `CompactBytecode`: an opcode byte followed by its
+ * operands as varints, destination first.
+ */
+class RegisterCode final {
+ public:
+  static constexpr uint32_t kNoRegister = std::numeric_limits<uint32_t>::max();
+
+  RegisterCode() = default;
+
+  /**
+   * Translates the bytecode of the stack machine, allocating a register for
+   * each variable and for each stack slot, and keeping constants and
+   * variables in their own registers rather than copying them to the stack.
+   */
+  static Result<RegisterCode, std::string> fromBytecode(
+      const CompactBytecode&);
+
+  const std::vector<uint8_t>& code() const { return m_code; }
+  const std::vector<Value>& constants() const { return m_constants; }
+  uint32_t registerCount() const { return m_registerCount; }
+  // The register that holds the value of the program when it's done, if any.
+  uint32_t result() const { return m_result; }
+  std::size_t instructionCount() const { return m_instructionCount; }
+
+ private:
+  friend class RegisterAllocator;
+
+  std::vector<uint8_t> m_code;
+  std::vector<Value> m_constants;
+  uint32_t m_registerCount{0};
+  uint32_t m_result{kNoRegister};
+  std::size_t m_instructionCount{0};
+};
+
+std::ostream& operator<<(std::ostream&, const RegisterCode&);
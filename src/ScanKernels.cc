@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ScanKernels.h"
+
+#include <atomic>
+#include <cassert>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SCAN_KERNELS
+#include <immintrin.h>
+#endif
+
+static inline bool isWhitespace(char which) {
+  return which == '\n' || which == '\t' || which == ' ';
+}
+
+static inline bool isDigit(char which) {
+  return which >= '0' && which <= '9';
+}
+
+static inline bool isIdentPart(char which) {
+  char lower = which | 0x20;
+  return (lower >= 'a' && lower <= 'z') || isDigit(which) || which == '_';
+}
+
+static const char* skipWhitespaceScalar(const char* begin, const char* end) {
+  while (begin != end && isWhitespace(*begin))
+    begin++;
+  return begin;
+}
+
+static const char* skipIdentPartScalar(const char* begin, const char* end) {
+  while (begin != end && isIdentPart(*begin))
+    begin++;
+  return begin;
+}
+
+static const char* skipDigitsScalar(const char* begin, const char* end) {
+  while (begin != end && isDigit(*begin))
+    begin++;
+  return begin;
+}
+
+#ifdef HAVE_X86_SCAN_KERNELS
+
+// For each kernel, `Classify` returns a mask of the bytes that belong to the
+// run. Once some byte doesn't, we return its position, otherwise we finish
+// the tail of the buffer with the scalar version.
+
+// Bytes in the [lo, hi] range, as unsigned.
+static inline __m128i inRange16(__m128i chars, char lo, char hi) {
+  __m128i aboveLo = _mm_cmpeq_epi8(_mm_max_epu8(chars, _mm_set1_epi8(lo)), chars);
+  __m128i belowHi = _mm_cmpeq_epi8(_mm_min_epu8(chars, _mm_set1_epi8(hi)), chars);
+  return _mm_and_si128(aboveLo, belowHi);
+}
+
+struct WhitespaceSSE2 {
+  static __m128i classify(__m128i chars) {
+    __m128i space = _mm_cmpeq_epi8(chars, _mm_set1_epi8(' '));
+    __m128i tab = _mm_cmpeq_epi8(chars, _mm_set1_epi8('\t'));
+    __m128i newline = _mm_cmpeq_epi8(chars, _mm_set1_epi8('\n'));
+    return _mm_or_si128(space, _mm_or_si128(tab, newline));
+  }
+  static const char* tail(const char* begin, const char* end) {
+    return skipWhitespaceScalar(begin, end);
+  }
+};
+
+struct DigitsSSE2 {
+  static __m128i classify(__m128i chars) { return inRange16(chars, '0', '9'); }
+  static const char* tail(const char* begin, const char* end) {
+    return skipDigitsScalar(begin, end);
+  }
+};
+
+struct IdentPartSSE2 {
+  static __m128i classify(__m128i chars) {
+    __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+    __m128i alpha = inRange16(lower, 'a', 'z');
+    __m128i underscore = _mm_cmpeq_epi8(chars, _mm_set1_epi8('_'));
+    return _mm_or_si128(alpha,
+                        _mm_or_si128(underscore, inRange16(chars, '0', '9')));
+  }
+  static const char* tail(const char* begin, const char* end) {
+    return skipIdentPartScalar(begin, end);
+  }
+};
+
+template <typename Kernel>
+static const char* scanSSE2(const char* begin, const char* end) {
+  while (end - begin >= 16) {
+    __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    unsigned mask = _mm_movemask_epi8(Kernel::classify(chars));
+    if (mask != 0xffff)
+      return begin + __builtin_ctz(~mask);
+    begin += 16;
+  }
+  return Kernel::tail(begin, end);
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i inRange32(__m256i chars, char lo, char hi) {
+  __m256i aboveLo =
+      _mm256_cmpeq_epi8(_mm256_max_epu8(chars, _mm256_set1_epi8(lo)), chars);
+  __m256i belowHi =
+      _mm256_cmpeq_epi8(_mm256_min_epu8(chars, _mm256_set1_epi8(hi)), chars);
+  return _mm256_and_si256(aboveLo, belowHi);
+}
+
+struct WhitespaceAVX2 : WhitespaceSSE2 {
+  using WhitespaceSSE2::classify;
+  AVX2 static __m256i classify(__m256i chars) {
+    __m256i space = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8(' '));
+    __m256i tab = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('\t'));
+    __m256i newline = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('\n'));
+    return _mm256_or_si256(space, _mm256_or_si256(tab, newline));
+  }
+};
+
+struct DigitsAVX2 : DigitsSSE2 {
+  using DigitsSSE2::classify;
+  AVX2 static __m256i classify(__m256i chars) {
+    return inRange32(chars, '0', '9');
+  }
+};
+
+struct IdentPartAVX2 : IdentPartSSE2 {
+  using IdentPartSSE2::classify;
+  AVX2 static __m256i classify(__m256i chars) {
+    __m256i lower = _mm256_or_si256(chars, _mm256_set1_epi8(0x20));
+    __m256i alpha = inRange32(lower, 'a', 'z');
+    __m256i underscore = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('_'));
+    return _mm256_or_si256(
+        alpha, _mm256_or_si256(underscore, inRange32(chars, '0', '9')));
+  }
+};
+
+template <typename Kernel>
+AVX2 static const char* scanAVX2(const char* begin, const char* end) {
+  while (end - begin >= 32) {
+    __m256i chars =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    unsigned mask = _mm256_movemask_epi8(Kernel::classify(chars));
+    if (mask != 0xffffffff)
+      return begin + __builtin_ctz(~mask);
+    begin += 32;
+  }
+  return scanSSE2<Kernel>(begin, end);
+}
+
+#undef AVX2
+
+#endif  // HAVE_X86_SCAN_KERNELS
+
+static const ScanKernels kScalarKernels = {
+    ScanKernelKind::Scalar,
+    skipWhitespaceScalar,
+    skipIdentPartScalar,
+    skipDigitsScalar,
+};
+
+#ifdef HAVE_X86_SCAN_KERNELS
+static const ScanKernels kSSE2Kernels = {
+    ScanKernelKind::SSE2,
+    scanSSE2<WhitespaceSSE2>,
+    scanSSE2<IdentPartSSE2>,
+    scanSSE2<DigitsSSE2>,
+};
+
+static const ScanKernels kAVX2Kernels = {
+    ScanKernelKind::AVX2,
+    scanAVX2<WhitespaceAVX2>,
+    scanAVX2<IdentPartAVX2>,
+    scanAVX2<DigitsAVX2>,
+};
+#endif
+
+bool scanKernelsSupported(ScanKernelKind kind) {
+  switch (kind) {
+    case ScanKernelKind::Scalar:
+      return true;
+#ifdef HAVE_X86_SCAN_KERNELS
+    case ScanKernelKind::SSE2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("sse2");
+    case ScanKernelKind::AVX2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+#else
+    case ScanKernelKind::SSE2:
+    case ScanKernelKind::AVX2:
+      return false;
+#endif
+  }
+  assert(false);
+  return false;
+}
+
+static const ScanKernels* kernelsFor(ScanKernelKind kind) {
+  assert(scanKernelsSupported(kind));
+  switch (kind) {
+#ifdef HAVE_X86_SCAN_KERNELS
+    case ScanKernelKind::AVX2:
+      return &kAVX2Kernels;
+    case ScanKernelKind::SSE2:
+      return &kSSE2Kernels;
+#endif
+    default:
+      return &kScalarKernels;
+  }
+}
+
+static const ScanKernels* bestKernels() {
+  if (scanKernelsSupported(ScanKernelKind::AVX2))
+    return kernelsFor(ScanKernelKind::AVX2);
+  if (scanKernelsSupported(ScanKernelKind::SSE2))
+    return kernelsFor(ScanKernelKind::SSE2);
+  return &kScalarKernels;
+}
+
+// Every tokenizer reads this, including the ones on the threads of the
+// parallel tokenizer, so it's atomic.
+static std::atomic<const ScanKernels*> sKernels{nullptr};
+
+const ScanKernels& scanKernels() {
+  const ScanKernels* kernels = sKernels.load(std::memory_order_acquire);
+  if (!kernels) {
+    // Don't override a concurrent `setScanKernels`.
+    const ScanKernels* best = bestKernels();
+    if (sKernels.compare_exchange_strong(kernels, best,
+                                         std::memory_order_acq_rel))
+      kernels = best;
+  }
+  return *kernels;
+}
+
+void setScanKernels(ScanKernelKind kind) {
+  sKernels.store(kernelsFor(kind), std::memory_order_release);
+}
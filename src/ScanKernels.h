@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+/**
+ * Kernels used by the tokenizer to skip over runs of characters of the same
+ * class.
+ *
+ * Each of them returns the first position in [begin, end) that doesn't belong
+ * to the run, or `end`.
+ *
+ * On x86 there are SSE2 and AVX2 versions that look at 16 or 32 bytes at a
+ * time, and the best one the CPU supports is picked at runtime.
+ */
+typedef const char* (*ScanFunction)(const char* begin, const char* end);
+
+enum class ScanKernelKind {
+  Scalar,
+  SSE2,
+  AVX2,
+};
+
+struct ScanKernels {
+  ScanKernelKind kind;
+  // Spaces, tabs and newlines.
+  ScanFunction skipWhitespace;
+  // [a-zA-Z0-9_]
+  ScanFunction skipIdentPart;
+  // [0-9]
+  ScanFunction skipDigits;
+};
+
+// The kernels the tokenizer uses.
+const ScanKernels& scanKernels();
+
+// Whether this build and CPU can run the given kernels.
+bool scanKernelsSupported(ScanKernelKind);
+
+// Makes the tokenizer use the given kernels, which must be supported. Mostly
+// useful for testing and benchmarking.
+void setScanKernels(ScanKernelKind);
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "StreamingTokenizer.h"
+
+#include "TokenizerTables.h"
+
+void StreamingTokenizer::feed(const char* data, std::size_t size) {
+  assert(needsInput());
+  m_chunkOffset = offsetOf(m_end);
+  m_chunk = m_position = m_tokenBegin = data;
+  m_end = data + size;
+}
+
+void StreamingTokenizer::finish() {
+  m_finished = true;
+}
+
+Optional<Token> StreamingTokenizer::nextToken() {
+  if (m_error)
+    return None;
+
+  while (true) {
+    // Skip runs in bulk, same as `Tokenizer`.
+    if (m_state == lexer::kStart) {
+      if (m_position != m_end &&
+          lexer::classify(*m_position) == lexer::CharClass::Whitespace)
+        m_position = m_kernels.skipWhitespace(m_position + 1, m_end);
+      m_tokenBegin = m_position;
+      m_tokenOffset = offsetOf(m_position);
+    } else if (m_state == lexer::kIdentifier) {
+      m_position = m_kernels.skipIdentPart(m_position, m_end);
+    } else if (m_state == lexer::kInteger || m_state == lexer::kFraction) {
+      m_position = m_kernels.skipDigits(m_position, m_end);
+    }
+
+    if (m_position == m_end && !m_finished) {
+      if (m_state != lexer::kStart)
+        m_partial.append(m_tokenBegin, m_end);
+      return None;
+    }
+
+    const char c = m_position == m_end ? '\0' : *m_position;
+    const lexer::State next = lexer::transition(m_state, c);
+    if (lexer::isFinal(next)) {
+      m_state = lexer::kStart;
+      return finishToken(lexer::finalStateInfo(next));
+    }
+    m_position++;
+    m_state = next;
+  }
+}
+
+Optional<Token> StreamingTokenizer::finishToken(
+    const lexer::FinalState& final) {
+  if (final.consume) {
+    assert(m_position != m_end);
+    m_position++;
+  }
+
+  if (final.error) {
+    m_error = final.error;
+    return None;
+  }
+
+  if (offsetOf(m_position) > kMaxSourceSize) {
+    m_error = kSourceTooLarge;
+    return None;
+  }
+
+  std::string_view text(m_tokenBegin, m_position - m_tokenBegin);
+  if (!m_partial.empty()) {
+    m_partial.append(text);
+    text = m_partial;
+  }
+
+  Token token = Token::createOfType(TokenType::Eof, Span());
+  const char* error = lexer::makeToken(
+      final, text, Span(m_tokenOffset, text.size()), m_symbols, token);
+  m_partial.clear();
+  if (error) {
+    m_error = error;
+    return None;
+  }
+  return Some(token);
+}
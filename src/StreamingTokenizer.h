@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+#include "Optional.h"
+#include "ScanKernels.h"
+#include "SymbolTable.h"
+#include "Tokenizer.h"
+
+// A tokenizer that is pushed its input in chunks of arbitrary size, instead of
+// pulling it from a `Reader`.
+//
+// It is a resumable version of the `Tokenizer` state machine: a chunk can end
+// at any byte, including in the middle of a token, in which case the partial
+// token is carried over to the next chunk. Chunks don't need to outlive the
+// next call to `feed()` or `finish()`, so arbitrarily big streams can be lexed
+// in constant memory.
+//
+// Span offsets are counted from the beginning of the stream. Streams longer
+// than `kMaxSourceSize` fail with `kSourceTooLarge`, like with `Tokenizer`.
+class StreamingTokenizer {
+ public:
+  explicit StreamingTokenizer(SymbolTable& symbols = SymbolTable::global())
+      : m_symbols(symbols), m_kernels(scanKernels()) {}
+
+  // Provides the next chunk of input. The previous chunk must have been
+  // consumed, that is, `needsInput()` must be true.
+  void feed(const char* data, std::size_t size);
+
+  // Signals that there's no more input.
+  void finish();
+
+  // Returns the next token, or None if either more input is needed, or there
+  // was an error.
+  Optional<Token> nextToken();
+
+  bool needsInput() const {
+    return !m_error && !m_finished && m_position == m_end;
+  }
+  const char* errorMessage() const { return m_error; }
+  // The current position in the stream, which is where the error is after a
+  // failed `nextToken()` call.
+  Span location() const {
+    return Span(std::min(offsetOf(m_position), kMaxSourceSize), 0);
+  }
+
+ private:
+  Optional<Token> finishToken(const lexer::FinalState&);
+  std::size_t offsetOf(const char* position) const {
+    return m_chunkOffset + (position - m_chunk);
+  }
+
+  SymbolTable& m_symbols;
+  const ScanKernels& m_kernels;
+
+  const char* m_chunk{nullptr};
+  const char* m_position{nullptr};
+  const char* m_end{nullptr};
+  // The stream offset of the beginning of the current chunk, which is not
+  // truncated like spans are, to notice when the input gets too large.
+  std::size_t m_chunkOffset{0};
+  bool m_finished{false};
+
+  // The state of the token being lexed, and where its text starts in the
+  // current chunk. Text from previous chunks, if any, is in `m_partial`.
+  uint8_t m_state{0};  // A `lexer::State`.
+  const char* m_tokenBegin{nullptr};
+  std::size_t m_tokenOffset{0};
+  std::string m_partial;
+
+  const char* m_error{nullptr};
+};
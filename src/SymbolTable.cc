@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SymbolTable.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace {
+
+const std::size_t kBlockSize = 64 * 1024;
+
+constexpr std::array<std::string_view, kWellKnownSymbolCount> kWellKnownNames =
+    {{"for", "while", "if", "else", "cos", "sin", "abs", "sqrt", "pow"}};
+
+const std::size_t kPerfectHashSize = 16;
+
+// Cheap enough to compute for every identifier, and collision-free for the
+// well-known names (which is checked below).
+constexpr std::size_t perfectHash(std::string_view name) {
+  return (name.size() + std::size_t(name[0]) +
+          2 * std::size_t(name[name.size() - 1])) &
+         (kPerfectHashSize - 1);
+}
+
+constexpr std::array<int8_t, kPerfectHashSize> buildPerfectHashTable() {
+  std::array<int8_t, kPerfectHashSize> table{};
+  for (auto& slot : table)
+    slot = -1;
+  for (std::size_t i = 0; i < kWellKnownNames.size(); ++i) {
+    std::size_t hash = perfectHash(kWellKnownNames[i]);
+    // A collision here makes this function not be a constant expression, and
+    // thus fail to compile below.
+    if (table[hash] != -1)
+      throw "Perfect hash collision";
+    table[hash] = int8_t(i);
+  }
+  return table;
+}
+
+constexpr std::array<int8_t, kPerfectHashSize> kPerfectHashTable =
+    buildPerfectHashTable();
+
+const std::size_t kMaxWellKnownLength = 5;
+
+}  // namespace
+
+SymbolTable::SymbolTable() {
+  for (std::string_view name : kWellKnownNames)
+    m_names.push_back(name);
+}
+
+SymbolTable& SymbolTable::global() {
+  static SymbolTable sTable;
+  return sTable;
+}
+
+const char* SymbolTable::store(std::string_view name) {
+  if (name.size() > m_blockRemaining) {
+    std::size_t size = std::max(kBlockSize, name.size());
+    m_blocks.emplace_back(new char[size]);
+    m_cursor = m_blocks.back().get();
+    m_blockRemaining = size;
+  }
+  char* dest = m_cursor;
+  memcpy(dest, name.data(), name.size());
+  m_cursor += name.size();
+  m_blockRemaining -= name.size();
+  return dest;
+}
+
+SymbolId SymbolTable::intern(std::string_view name) {
+  assert(!name.empty());
+  if (name.size() <= kMaxWellKnownLength) {
+    int8_t index = kPerfectHashTable[perfectHash(name)];
+    if (index >= 0 && kWellKnownNames[index] == name)
+      return SymbolId(index);
+  }
+
+  auto it = m_ids.find(name);
+  if (it != m_ids.end())
+    return it->second;
+
+  std::string_view stored(store(name), name.size());
+  SymbolId id = m_names.size();
+  m_names.push_back(stored);
+  m_ids.emplace(stored, id);
+  return id;
+}
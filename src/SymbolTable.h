@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+typedef uint32_t SymbolId;
+
+/**
+ * Symbols that are always present in a symbol table, with fixed ids.
+ *
+ * Keywords come first, in the same order as the `Keyword` enum, followed by
+ * the builtin functions, in the same order as the `BuiltinFunction` enum, so
+ * that converting between them is just arithmetic.
+ */
+enum class WellKnownSymbol : SymbolId {
+  For,
+  While,
+  If,
+  Else,
+  Cos,
+  Sin,
+  Abs,
+  Sqrt,
+  Pow,
+};
+
+const SymbolId kFirstKeywordSymbol = SymbolId(WellKnownSymbol::For);
+const SymbolId kKeywordSymbolCount = 4;
+const SymbolId kFirstBuiltinSymbol = SymbolId(WellKnownSymbol::Cos);
+const SymbolId kBuiltinSymbolCount = 5;
+const SymbolId kWellKnownSymbolCount = kFirstBuiltinSymbol + kBuiltinSymbolCount;
+
+/**
+ * Maps each distinct identifier to a dense `SymbolId`.
+ *
+ * Identifiers are interned once, when lexed, so that everything after the
+ * tokenizer can compare and index by integer instead of hashing strings.
+ *
+ * Well-known symbols are looked up through a perfect hash computed at compile
+ * time, without touching the hash map.
+ */
+class SymbolTable {
+ public:
+  SymbolTable();
+
+  // The symbol table the tokenizer interns identifiers into by default.
+  //
+  // It's also the only one symbols are ever named from: printing tokens,
+  // dumping trees, code generation errors and flat AST files all look names
+  // up here. Ids interned into another table (other than the well-known ones,
+  // which are the same in every table) can only be printed by whoever owns
+  // that table.
+  static SymbolTable& global();
+
+  SymbolId intern(std::string_view);
+  std::string_view name(SymbolId id) const {
+    assert(id < m_names.size());
+    return m_names[id];
+  }
+  std::size_t size() const { return m_names.size(); }
+
+  static bool isKeyword(SymbolId id) {
+    return id - kFirstKeywordSymbol < kKeywordSymbolCount;
+  }
+
+  static bool isBuiltin(SymbolId id) {
+    return id - kFirstBuiltinSymbol < kBuiltinSymbolCount;
+  }
+
+ private:
+  const char* store(std::string_view);
+
+  std::vector<std::string_view> m_names;
+  // Keys point into m_blocks, and so do m_names.
+  std::unordered_map<std::string_view, SymbolId> m_ids;
+  std::vector<std::unique_ptr<char[]>> m_blocks;
+  char* m_cursor{nullptr};
+  std::size_t m_blockRemaining{0};
+};
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "TokenBuffer.h"
+
+#include <algorithm>
+
+TokenBuffer TokenBuffer::lexAll(Tokenizer& tokenizer) {
+  TokenBuffer buffer;
+  buffer.lexFrom(tokenizer);
+  return buffer;
+}
+
+bool TokenBuffer::lexFrom(Tokenizer& tokenizer, std::size_t maxTokens) {
+  for (std::size_t i = 0; i < maxTokens; ++i) {
+    Optional<Token> token = tokenizer.nextToken();
+    if (!token) {
+      setError(tokenizer.errorMessage(), tokenizer.location());
+      return false;
+    }
+    push(*token);
+    if (token->type() == TokenType::Eof)
+      return false;
+  }
+  return true;
+}
+
+void TokenBuffer::push(const Token& token) {
+  m_types.push_back(token.type());
+  m_spans.push_back(token.span());
+  m_payloads.push_back(token.payload());
+}
+
+void TokenBuffer::append(const TokenBuffer& other) {
+  m_types.insert(m_types.end(), other.m_types.begin(), other.m_types.end());
+  m_spans.insert(m_spans.end(), other.m_spans.begin(), other.m_spans.end());
+  m_payloads.insert(m_payloads.end(), other.m_payloads.begin(),
+                    other.m_payloads.end());
+  if (other.m_error)
+    setError(other.m_error, other.m_errorLocation);
+}
+
+template <typename T>
+static void replaceRange(std::vector<T>& items,
+                         std::size_t begin,
+                         std::size_t end,
+                         const std::vector<T>& replacement) {
+  const std::size_t common = std::min(end - begin, replacement.size());
+  std::copy_n(replacement.begin(), common, items.begin() + begin);
+  if (common < replacement.size())
+    items.insert(items.begin() + end, replacement.begin() + common,
+                 replacement.end());
+  else
+    items.erase(items.begin() + begin + common, items.begin() + end);
+}
+
+void TokenBuffer::splice(std::size_t begin,
+                         std::size_t end,
+                         const TokenBuffer& replacement,
+                         uint32_t offset,
+                         int64_t delta) {
+  assert(begin <= end && end <= size());
+  replaceRange(m_types, begin, end, replacement.m_types);
+  replaceRange(m_payloads, begin, end, replacement.m_payloads);
+  replaceRange(m_spans, begin, end, replacement.m_spans);
+
+  const std::size_t replacedEnd = begin + replacement.size();
+  for (std::size_t i = begin; i < replacedEnd; ++i)
+    m_spans[i].offset += offset;
+  if (delta) {
+    for (std::size_t i = replacedEnd; i < m_spans.size(); ++i)
+      m_spans[i].offset += delta;
+  }
+}
+
+void TokenBuffer::clear() {
+  m_types.clear();
+  m_spans.clear();
+  m_payloads.clear();
+  setError(nullptr, Span());
+}
+
+void TokenBuffer::reserve(std::size_t count) {
+  m_types.reserve(count);
+  m_spans.reserve(count);
+  m_payloads.reserve(count);
+}
+
+void TokenBuffer::resize(std::size_t count) {
+  m_types.resize(count, TokenType::Eof);
+  m_spans.resize(count);
+  m_payloads.resize(count);
+}
+
+void TokenBuffer::copyRelocated(std::size_t at,
+                                const TokenBuffer& other,
+                                std::size_t count,
+                                uint32_t offset,
+                                const std::vector<SymbolId>& symbolMap) {
+  assert(at + count <= size() && count <= other.size());
+  std::copy_n(other.m_types.begin(), count, m_types.begin() + at);
+  for (std::size_t i = 0; i < count; ++i) {
+    const Span& span = other.m_spans[i];
+    m_spans[at + i] = Span(span.offset + offset, span.length);
+  }
+
+  for (std::size_t i = 0; i < count; ++i) {
+    if (other.m_types[i] != TokenType::Identifier) {
+      m_payloads[at + i] = other.m_payloads[i];
+      continue;
+    }
+    SymbolId symbol = symbolMap[other.at(i).symbol()];
+    m_payloads[at + i] = Token::createIdent(symbol, Span()).payload();
+  }
+}
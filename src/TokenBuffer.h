@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Tokenizer.h"
+
+// A list of tokens stored as a struct of arrays: types, spans and payloads
+// live in separate packed vectors, so that walking the token
+// types, which is what the parser does most of the time, touches as little
+// memory as possible.
+//
+// A buffer can hold the whole token stream of a program (see `lexAll`), or just
+// a window of it that gets refilled as needed (see the streaming `Parser`).
+class TokenBuffer {
+ public:
+  TokenBuffer() = default;
+
+  // Lexes the whole input of the tokenizer, up to and including the Eof
+  // token, or until the first error, which is recorded in the buffer.
+  static TokenBuffer lexAll(Tokenizer&);
+
+  // Appends at most `maxTokens` tokens from the tokenizer. Stops after the Eof
+  // token or at the first error. Returns whether there may be more tokens to
+  // lex afterwards.
+  bool lexFrom(Tokenizer&, std::size_t maxTokens = SIZE_MAX);
+
+  void push(const Token&);
+  // Appends all the tokens of `other`, and its error, if any.
+  void append(const TokenBuffer& other);
+  // Replaces the tokens in [begin, end) with the tokens of `replacement`,
+  // whose spans are relative to `offset`, and moves the spans of the tokens
+  // after them `delta` bytes. The error, if any, is left alone.
+  void splice(std::size_t begin,
+              std::size_t end,
+              const TokenBuffer& replacement,
+              uint32_t offset,
+              int64_t delta);
+  void clear();
+  void reserve(std::size_t count);
+  void resize(std::size_t count);
+
+  // Copies the first `count` tokens of `other` to [at, at + count), which must
+  // be in bounds, relocating them as if `other` was lexed from `offset` bytes
+  // into the source buffer onwards. Identifiers are translated through
+  // `symbolMap`, if `other` was lexed with a different symbol table.
+  void copyRelocated(std::size_t at,
+                     const TokenBuffer& other,
+                     std::size_t count,
+                     uint32_t offset,
+                     const std::vector<SymbolId>& symbolMap);
+
+  void setError(const char* message, Span location) {
+    m_error = message;
+    m_errorLocation = location;
+  }
+
+  std::size_t size() const { return m_types.size(); }
+  bool isEmpty() const { return m_types.empty(); }
+
+  TokenType type(std::size_t i) const { return m_types[i]; }
+  const Span& span(std::size_t i) const { return m_spans[i]; }
+  uint64_t payload(std::size_t i) const { return m_payloads[i]; }
+  Token at(std::size_t i) const {
+    return Token::fromParts(m_types[i], m_spans[i], m_payloads[i]);
+  }
+
+  // Whether the buffer ends with the Eof token, that is, whether it contains
+  // the whole (rest of the) token stream.
+  bool isComplete() const {
+    return !m_types.empty() && m_types.back() == TokenType::Eof;
+  }
+
+  // The lexing error that stopped the buffer from being complete, if any.
+  const char* errorMessage() const { return m_error; }
+  const Span& errorLocation() const { return m_errorLocation; }
+
+ private:
+  std::vector<TokenType> m_types;
+  std::vector<Span> m_spans;
+  std::vector<uint64_t> m_payloads;
+
+  const char* m_error{nullptr};
+  Span m_errorLocation;
+};
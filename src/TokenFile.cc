@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "TokenFile.h"
+
+#include <cstring>
+
+#include "Varint.h"
+
+TokenFileWriter::TokenFileWriter(std::ostream& stream,
+                                 const SymbolTable& symbols)
+    : m_stream(stream), m_symbols(symbols) {
+  m_buffer.append(kTokenFileMagic, sizeof(kTokenFileMagic));
+}
+
+void TokenFileWriter::write(const Token& token) {
+  const Span& span = token.span();
+  m_buffer.push_back(char(token.type()));
+  // Tokens come in order, and the tokenizers don't produce offsets that
+  // would wrap around.
+  assert(span.offset >= m_lastEnd);
+  writeVarint(m_buffer, span.offset - m_lastEnd);
+  writeVarint(m_buffer, span.length);
+  m_lastEnd = span.end();
+
+  switch (token.type()) {
+    case TokenType::Number:
+      writeVarint(m_buffer, token.number());
+      break;
+    case TokenType::Float: {
+      const uint64_t bits = token.payload();
+      m_buffer.append(reinterpret_cast<const char*>(&bits), sizeof(bits));
+      break;
+    }
+    case TokenType::Operator:
+      m_buffer.push_back(char(token.op()));
+      break;
+    case TokenType::Keyword:
+      m_buffer.push_back(char(token.keyword()));
+      break;
+    case TokenType::Identifier: {
+      const SymbolId symbol = token.symbol();
+      if (symbol >= m_ids.size())
+        m_ids.resize(symbol + 1, 0);
+      const bool isNew = !m_ids[symbol];
+      if (isNew)
+        m_ids[symbol] = ++m_symbolCount;
+      writeVarint(m_buffer, m_ids[symbol] - 1);
+      if (isNew) {
+        std::string_view name = m_symbols.name(symbol);
+        writeVarint(m_buffer, name.size());
+        m_buffer.append(name.data(), name.size());
+      }
+      break;
+    }
+    default:
+      break;
+  }
+
+  if (m_buffer.size() >= 64 * 1024)
+    flush();
+}
+
+void TokenFileWriter::writeError(const char* message, Span location) {
+  m_buffer.push_back(char(kTokenFileError));
+  const std::size_t length = strlen(message);
+  writeVarint(m_buffer, length);
+  m_buffer.append(message, length);
+  writeVarint(m_buffer, location.offset);
+  writeVarint(m_buffer, location.length);
+}
+
+void TokenFileWriter::write(const TokenBuffer& tokens) {
+  for (std::size_t i = 0; i < tokens.size(); ++i)
+    write(tokens.at(i));
+  if (const char* error = tokens.errorMessage())
+    writeError(error, tokens.errorLocation());
+}
+
+void TokenFileWriter::flush() {
+  m_stream.write(m_buffer.data(), m_buffer.size());
+  m_buffer.clear();
+}
+
+namespace {
+
+class TokenFileReader {
+ public:
+  TokenFileReader(const char* data, std::size_t size)
+      : m_cursor(data), m_end(data + size) {}
+
+  bool atEnd() const { return m_cursor == m_end; }
+
+  bool readByte(uint8_t& out) {
+    if (atEnd())
+      return false;
+    out = uint8_t(*m_cursor++);
+    return true;
+  }
+
+  bool readVarint(uint64_t& out) {
+    return ::readVarint(m_cursor, m_end, out);
+  }
+
+  bool readBytes(std::size_t count, const char*& out) {
+    if (std::size_t(m_end - m_cursor) < count)
+      return false;
+    out = m_cursor;
+    m_cursor += count;
+    return true;
+  }
+
+ private:
+  const char* m_cursor;
+  const char* m_end;
+};
+
+}  // namespace
+
+Result<std::unique_ptr<TokenFile>, std::string> TokenFile::read(
+    const char* data,
+    std::size_t size,
+    SymbolTable& symbols) {
+  const char* kMalformed = "Malformed token file";
+  if (size < sizeof(kTokenFileMagic) ||
+      memcmp(data, kTokenFileMagic, sizeof(kTokenFileMagic)))
+    return std::string("Not a token file");
+
+  std::unique_ptr<TokenFile> file(new TokenFile());
+  TokenBuffer& tokens = file->m_tokens;
+  // Roughly what generated code takes per token.
+  tokens.reserve(size / 3);
+  TokenFileReader reader(data + sizeof(kTokenFileMagic),
+                         size - sizeof(kTokenFileMagic));
+  // The symbol of each id in the file.
+  std::vector<SymbolId> symbolMap;
+  uint32_t lastEnd = 0;
+  while (true) {
+    uint8_t type;
+    if (!reader.readByte(type))
+      return std::string(kMalformed);
+
+    uint64_t distance, length;
+    if (type == kTokenFileError) {
+      const char* message;
+      if (!reader.readVarint(length) || !reader.readBytes(length, message))
+        return std::string(kMalformed);
+      file->m_errorMessage.assign(message, length);
+      uint64_t offset;
+      if (!reader.readVarint(offset) || !reader.readVarint(length))
+        return std::string(kMalformed);
+      tokens.setError(file->m_errorMessage.c_str(),
+                      Span(uint32_t(offset), uint32_t(length)));
+      break;
+    }
+
+    if (type > uint8_t(TokenType::Eof) || !reader.readVarint(distance) ||
+        !reader.readVarint(length))
+      return std::string(kMalformed);
+    const Span span(uint32_t(lastEnd + distance), uint32_t(length));
+    lastEnd = span.end();
+
+    uint64_t payload = 0;
+    switch (TokenType(type)) {
+      case TokenType::Number:
+        if (!reader.readVarint(payload))
+          return std::string(kMalformed);
+        break;
+      case TokenType::Float: {
+        const char* bits;
+        if (!reader.readBytes(sizeof(payload), bits))
+          return std::string(kMalformed);
+        memcpy(&payload, bits, sizeof(payload));
+        break;
+      }
+      case TokenType::Operator: {
+        uint8_t op;
+        if (!reader.readByte(op) || op > uint8_t(Operator::Ge))
+          return std::string(kMalformed);
+        payload = Token::createOp(Operator(op), span).payload();
+        break;
+      }
+      case TokenType::Keyword: {
+        uint8_t keyword;
+        if (!reader.readByte(keyword) || keyword > uint8_t(Keyword::Else))
+          return std::string(kMalformed);
+        payload = Token::createKeyword(Keyword(keyword), span).payload();
+        break;
+      }
+      case TokenType::Identifier: {
+        uint64_t id;
+        if (!reader.readVarint(id) || id > symbolMap.size())
+          return std::string(kMalformed);
+        if (id == symbolMap.size()) {
+          const char* name;
+          if (!reader.readVarint(length) || !reader.readBytes(length, name))
+            return std::string(kMalformed);
+          symbolMap.push_back(symbols.intern(std::string_view(name, length)));
+        }
+        payload = Token::createIdent(symbolMap[id], span).payload();
+        break;
+      }
+      default:
+        break;
+    }
+
+    tokens.push(Token::fromParts(TokenType(type), span, payload));
+    if (TokenType(type) == TokenType::Eof)
+      break;
+  }
+
+  if (!reader.atEnd())
+    return std::string(kMalformed);
+  return std::move(file);
+}
+
+Result<std::unique_ptr<TokenFile>, std::string> TokenFile::read(
+    Reader& reader,
+    SymbolTable& symbols) {
+  while (reader.fill()) {
+  }
+  return read(reader.data(), reader.size(), symbols);
+}
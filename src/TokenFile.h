@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Result.h"
+#include "TokenBuffer.h"
+#include "Tokenizer.h"
+
+/**
+ * A compact binary format for token streams, so that big inputs can be lexed
+ * once and parsed many times.
+ *
+ * The file starts with `kTokenFileMagic`, followed by one record per token:
+ *
+ *  - The token type, as a byte.
+ *  - The distance from the end of the previous token to the start of this one,
+ *    and the length of the token, as varints.
+ *  - The payload, depending on the type: a varint for numbers, the raw bits
+ *    for floats, a byte for operators and keywords, and a varint id for
+ *    identifiers. Identifiers get ids in the order they first appear in the
+ *    file, and the first occurrence of each is followed by the length and
+ *    bytes of its name.
+ *
+ * The stream ends with the Eof token, or with a `kTokenFileError` byte,
+ * followed by the length and bytes of the lexer error message, and the offset
+ * and length of its location, as varints.
+ *
+ * Multi-byte values that aren't varints are in native byte order, these files
+ * are a cache, not an interchange format.
+ */
+constexpr char kTokenFileMagic[8] = {'t', 'o', 'k', 'e', 'n', 's', '\0', '\1'};
+constexpr uint8_t kTokenFileError = 0xff;
+
+class TokenFileWriter {
+ public:
+  explicit TokenFileWriter(std::ostream&,
+                           const SymbolTable& = SymbolTable::global());
+  ~TokenFileWriter() { flush(); }
+
+  void write(const Token&);
+  // Ends the stream with a lexer error, instead of the Eof token.
+  void writeError(const char* message, Span location);
+  void write(const TokenBuffer&);
+
+  void flush();
+
+ private:
+  std::ostream& m_stream;
+  const SymbolTable& m_symbols;
+  // The id of each symbol in the file plus one, or zero if not written yet.
+  std::vector<uint32_t> m_ids;
+  uint32_t m_symbolCount{0};
+  uint32_t m_lastEnd{0};
+  std::string m_buffer;
+};
+
+// A token stream read from a token file, which the parser can consume instead
+// of lexing the source again.
+class TokenFile {
+ public:
+  // Reads a token file, interning identifiers into `symbols`.
+  static Result<std::unique_ptr<TokenFile>, std::string> read(
+      const char* data,
+      std::size_t size,
+      SymbolTable& = SymbolTable::global());
+
+  // Reads the whole input of `reader` as a token file.
+  static Result<std::unique_ptr<TokenFile>, std::string> read(
+      Reader&,
+      SymbolTable& = SymbolTable::global());
+
+  TokenFile(const TokenFile&) = delete;
+  TokenFile& operator=(const TokenFile&) = delete;
+
+  const TokenBuffer& tokens() const { return m_tokens; }
+
+ private:
+  TokenFile() = default;
+
+  TokenBuffer m_tokens;
+  // The lexer error of `m_tokens` points here.
+  std::string m_errorMessage;
+};
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "TokenPipeline.h"
+
+TokenPipeline::TokenPipeline(Tokenizer& tokenizer) : m_tokenizer(tokenizer) {
+  for (TokenBuffer& batch : m_ring)
+    batch.reserve(kBatchSize);
+  m_thread = std::thread([this] { lex(); });
+}
+
+TokenPipeline::~TokenPipeline() {
+  m_stop.store(true, std::memory_order_relaxed);
+  m_thread.join();
+}
+
+void TokenPipeline::addTime(std::atomic<uint64_t>& counter,
+                            Clock::duration elapsed) {
+  counter.fetch_add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+      std::memory_order_relaxed);
+}
+
+void TokenPipeline::lex() {
+  uint64_t produced = 0;
+  bool more = true;
+  while (more && !m_stop.load(std::memory_order_relaxed)) {
+    auto start = Clock::now();
+    while (produced - m_consumed.load(std::memory_order_acquire) ==
+           kRingSize) {
+      if (m_stop.load(std::memory_order_relaxed))
+        return;
+      std::this_thread::yield();
+    }
+    addTime(m_lexerWaitNanos, Clock::now() - start);
+
+    start = Clock::now();
+    TokenBuffer& batch = m_ring[produced % kRingSize];
+    batch.clear();
+    more = batch.lexFrom(m_tokenizer, kBatchSize);
+    addTime(m_lexNanos, Clock::now() - start);
+    m_tokens.fetch_add(batch.size(), std::memory_order_relaxed);
+    m_bytes.store(m_tokenizer.location().offset, std::memory_order_relaxed);
+
+    m_produced.store(++produced, std::memory_order_release);
+  }
+}
+
+bool TokenPipeline::takeBatch(TokenBuffer& out) {
+  if (m_done)
+    return false;
+
+  const uint64_t consumed = m_consumed.load(std::memory_order_relaxed);
+  auto start = Clock::now();
+  if (consumed)
+    addTime(m_consumeNanos, start - m_lastBatchTaken);
+
+  while (m_produced.load(std::memory_order_acquire) == consumed)
+    std::this_thread::yield();
+  addTime(m_consumerWaitNanos, Clock::now() - start);
+
+  const TokenBuffer& batch = m_ring[consumed % kRingSize];
+  out.append(batch);
+  m_done = batch.isComplete() || batch.errorMessage();
+  m_consumed.store(consumed + 1, std::memory_order_release);
+  m_lastBatchTaken = Clock::now();
+  return true;
+}
+
+TokenPipeline::Stats TokenPipeline::stats() const {
+  Stats stats;
+  stats.bytes = m_bytes.load(std::memory_order_relaxed);
+  stats.tokens = m_tokens.load(std::memory_order_relaxed);
+  stats.batches = m_produced.load(std::memory_order_relaxed);
+  stats.lexSeconds = m_lexNanos.load(std::memory_order_relaxed) * 1e-9;
+  stats.lexerWaitSeconds =
+      m_lexerWaitNanos.load(std::memory_order_relaxed) * 1e-9;
+  stats.consumeSeconds = m_consumeNanos.load(std::memory_order_relaxed) * 1e-9;
+  stats.consumerWaitSeconds =
+      m_consumerWaitNanos.load(std::memory_order_relaxed) * 1e-9;
+  return stats;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#include "TokenBuffer.h"
+#include "Tokenizer.h"
+
+// Lexes on a separate thread, handing batches of tokens to a consumer (usually
+// a `Parser`) through a bounded single-producer single-consumer ring, so that
+// lexing and parsing overlap.
+//
+// The tokenizer, its reader and its symbol table belong to the lexer thread
+// until the pipeline is destroyed, or has handed out the last batch.
+class TokenPipeline {
+ public:
+  // How many tokens are lexed at once.
+  static constexpr std::size_t kBatchSize = 4096;
+  // How many batches the lexer can get ahead of the consumer.
+  static constexpr std::size_t kRingSize = 8;
+
+  // Counters for both stages, to find out which one is the bottleneck.
+  struct Stats {
+    uint64_t bytes{0};
+    uint64_t tokens{0};
+    uint64_t batches{0};
+    // Time spent lexing, and waiting for the consumer to free up a slot.
+    double lexSeconds{0};
+    double lexerWaitSeconds{0};
+    // Time spent by the consumer between batches, and waiting for the lexer.
+    double consumeSeconds{0};
+    double consumerWaitSeconds{0};
+  };
+
+  // Starts lexing right away.
+  explicit TokenPipeline(Tokenizer&);
+  ~TokenPipeline();
+
+  TokenPipeline(const TokenPipeline&) = delete;
+  TokenPipeline& operator=(const TokenPipeline&) = delete;
+
+  // Appends the next batch of tokens to `out`, waiting for it if needed, along
+  // with the lexer error, if the batch ended with one. Returns false if the
+  // whole token stream has already been handed out.
+  bool takeBatch(TokenBuffer& out);
+
+  // The counters so far, which are only final once the last batch has been
+  // taken.
+  Stats stats() const;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  void lex();
+
+  static void addTime(std::atomic<uint64_t>& counter, Clock::duration);
+
+  Tokenizer& m_tokenizer;
+  std::array<TokenBuffer, kRingSize> m_ring;
+  // The number of batches produced and consumed so far. Slots in
+  // [m_consumed, m_produced) belong to the consumer, the rest to the lexer.
+  std::atomic<uint64_t> m_produced{0};
+  std::atomic<uint64_t> m_consumed{0};
+  std::atomic<bool> m_stop{false};
+  // Whether the consumer has seen the last batch.
+  bool m_done{false};
+  Clock::time_point m_lastBatchTaken;
+
+  std::atomic<uint64_t> m_bytes{0};
+  std::atomic<uint64_t> m_tokens{0};
+  std::atomic<uint64_t> m_lexNanos{0};
+  std::atomic<uint64_t> m_lexerWaitNanos{0};
+  std::atomic<uint64_t> m_consumeNanos{0};
+  std::atomic<uint64_t> m_consumerWaitNanos{0};
+
+  std::thread m_thread;
+};
@@ -16,117 +16,19 @@
  */
 
 #include "Tokenizer.h"
+#include <charconv>
+#include <cstdlib>
 #include <string>
+#include "TokenizerTables.h"
 
-static bool isWhitespace(char which) {
-  // Well, unicode people won't love it, but for a simple school assignment,
-  // this can be enough.
-  return which == '\n' || which == '\t' || which == ' ';
-}
-
-static bool isNumeric(char which) {
-  return which >= '0' && which <= '9';
-}
-
-static bool isAlphabetic(char which) {
-  return (which >= 'a' && which <= 'z') || (which >= 'A' && which <= 'Z');
-}
-
-static bool isIdentifierStart(char which) {
-  return which == '_' || isAlphabetic(which);
-}
-
-static bool isIdentPart(char which) {
-  return isIdentifierStart(which) || isNumeric(which);
-}
-
-template <typename... Args>
-bool isAnyOf(char which, char one, Args... args) {
-  return which == one || isAnyOf(which, args...);
-}
-
-template <>
-bool isAnyOf(char which, char one) {
-  return which == one;
-}
-
-static Optional<Operator> toOperator(char first,
-                                     char second,
-                                     bool& consumedSecond) {
-  consumedSecond = false;
-#define SIMPLE_CASE(op_, single_, double_, equals_) \
-  case op_:                                         \
-    if (second == op_) {                            \
-      consumedSecond = true;                        \
-      return Some(Operator::double_);               \
-    }                                               \
-    if (second == '=') {                            \
-      consumedSecond = true;                        \
-      return Some(Operator::equals_);               \
-    }                                               \
-    return Some(Operator::single_);
-
-#define SIMPLE_CASE2(op_, single_, equals_) \
-  case op_:                                 \
-    if (second == '=') {                    \
-      consumedSecond = true;                \
-      return Some(Operator::equals_);       \
-    }                                       \
-    return Some(Operator::single_);
-
-  switch (first) {
-    SIMPLE_CASE('+', Plus, PlusPlus, PlusEquals)
-    SIMPLE_CASE('-', Minus, MinusMinus, MinusEquals)
-    SIMPLE_CASE('<', Lt, Shl, Le)
-    SIMPLE_CASE('>', Gt, Shr, Ge)
-    SIMPLE_CASE('&', And, AndAnd, AndEquals)
-    SIMPLE_CASE('|', Or, OrOr, OrEquals)
-    SIMPLE_CASE2('*', Star, StarEquals)
-    SIMPLE_CASE2('/', Slash, SlashEquals)
-    SIMPLE_CASE2('=', Equals, EqualsEquals)
-    default:
-      return None;
-  }
-}
-
-static bool isSingleCharOperator(char which) {
-  bool unused;
-  return bool(toOperator(which, '\0', unused));
-}
-
-static bool isTokenSeparator(char which) {
-  return isWhitespace(which) || isSingleCharOperator(which) ||
-         isAnyOf(which, '(', ',', ')', '{', '}', ';', '\0');
-}
-
-static Optional<Keyword> isKeyword(const std::string& which) {
-  if (which == "for")
-    return Some(Keyword::For);
-  if (which == "while")
-    return Some(Keyword::While);
-  if (which == "if")
-    return Some(Keyword::If);
-  if (which == "else")
-    return Some(Keyword::Else);
-  return None;
-}
+static_assert(SymbolId(WellKnownSymbol::Else) - kFirstKeywordSymbol ==
+                  SymbolId(Keyword::Else),
+              "Keyword and well-known symbol order should match");
 
 char Tokenizer::peekChar() {
-  if (!m_lastChar)
-    m_lastChar.set(m_reader.next());
-  return *m_lastChar;
-}
-
-char Tokenizer::nextChar() {
-  char which = peekChar();
-  m_lastChar.clear();
-  if (which)
-    m_location.column += 1;
-  if (which == '\n') {
-    m_location.column = 0;
-    m_location.line += 1;
-  }
-  return which;
+  if (m_position == m_reader.size() && !m_reader.fill())
+    return '\0';
+  return m_reader.data()[m_position];
 }
 
 Optional<Token> Tokenizer::nextToken() {
@@ -135,79 +37,115 @@ Optional<Token> Tokenizer::nextToken() {
   return nextTokenInternal();
 }
 
-Optional<Token> Tokenizer::nextTokenInternal() {
-again:
-  Span location = m_location;
-  char next = nextChar();
-  if (!next)
-    return Some(Token::createOfType(TokenType::Eof, location));
-
-  if (isWhitespace(next))
-    goto again;
-
-  bool consumedSecond;
-  if (Optional<Operator> op = toOperator(next, peekChar(), consumedSecond)) {
-    if (consumedSecond)
-      nextChar();
-    return Some(Token::createOp(*op, location));
+void Tokenizer::skipRun(ScanFunction scan) {
+  while (true) {
+    const char* data = m_reader.data();
+    m_position = scan(data + m_position, data + m_reader.size()) - data;
+    if (m_position != m_reader.size() || !m_reader.fill())
+      return;
   }
+}
 
-  if (next == ';')
-    return Some(Token::createOfType(TokenType::SemiColon, location));
-
-  if (next == ')')
-    return Some(Token::createOfType(TokenType::RightParen, location));
-
-  if (next == '(')
-    return Some(Token::createOfType(TokenType::LeftParen, location));
-
-  if (next == '}')
-    return Some(Token::createOfType(TokenType::RightBrace, location));
-
-  if (next == '{')
-    return Some(Token::createOfType(TokenType::LeftBrace, location));
-
-  if (next == ',')
-    return Some(Token::createOfType(TokenType::Comma, location));
-
-  if (isNumeric(next)) {
-    std::string number;
-    number.push_back(next);
-    // TODO(emilio): We could look for hexadecimal bases and similar here, but
-    // meh.
-    while (isNumeric(peekChar()))
-      number.push_back(nextChar());
-    if (peekChar() == '.') {
-      number.push_back(nextChar());
-      while (isNumeric(peekChar()))
-        number.push_back(nextChar());
-      if (!isTokenSeparator(peekChar()))
-        return error("Invalid token separator after floating point number");
-      if (number[number.size() - 1] == '.')
-        number.push_back('0');
-      return Some(
-          Token::createFloat(std::strtod(number.c_str(), nullptr), location));
-    }
-    if (!isTokenSeparator(peekChar()))
-      return error("Invalid token separator after number");
-    return Some(Token::createNumber(std::stoull(number), location));
+void Tokenizer::skipWhitespace() {
+  // Most whitespace runs are a single space between tokens, which is not
+  // worth calling into the kernels for.
+  if (lexer::classify(peekChar()) != lexer::CharClass::Whitespace)
+    return;
+  m_position += 1;
+  if (m_position < m_reader.size() &&
+      lexer::classify(m_reader.data()[m_position]) !=
+          lexer::CharClass::Whitespace) {
+    return;
   }
+  skipRun(m_kernels.skipWhitespace);
+}
 
-  if (isIdentifierStart(next)) {
-    std::string ident;
-    ident.push_back(next);
+Optional<Token> Tokenizer::nextTokenInternal() {
+  skipWhitespace();
+  const std::size_t start = m_position;
+
+  lexer::State state = lexer::kStart;
+  while (true) {
+    const lexer::State next = lexer::transition(state, peekChar());
+    if (lexer::isFinal(next))
+      return finishToken(lexer::finalStateInfo(next), start);
+
+    m_position += 1;
+    state = next;
+
+    if (state == lexer::kIdentifier)
+      skipRun(m_kernels.skipIdentPart);
+    else if (state == lexer::kInteger || state == lexer::kFraction)
+      skipRun(m_kernels.skipDigits);
+  }
+}
 
-    while (isIdentPart(peekChar()))
-      ident.push_back(nextChar());
+Optional<Token> Tokenizer::finishToken(const lexer::FinalState& final,
+                                       std::size_t start) {
+  if (final.consume)
+    m_position += 1;
 
-    if (!isTokenSeparator(peekChar()))
-      return error("Invalid token separator after identifier");
+  if (final.error)
+    return error(final.error);
 
-    if (Optional<Keyword> keyword = isKeyword(ident))
-      return Some(Token::createKeyword(*keyword, location));
+  if (m_position > kMaxSourceSize) {
+    m_position = kMaxSourceSize;
+    return error(kSourceTooLarge);
+  }
 
-    return Some(Token::createIdent(ident.c_str(), location));
+  const char* text = m_reader.data() + start;
+  const std::size_t length = m_position - start;
+  Token token = Token::createOfType(TokenType::Eof, Span());
+  if (const char* message = lexer::makeToken(
+          final, std::string_view(text, length), Span(start, length),
+          m_symbols, token)) {
+    return error(message);
   }
+  return Some(token);
+}
 
-  return error("unknown token");
+const char* lexer::makeToken(const FinalState& final,
+                             std::string_view text,
+                             Span span,
+                             SymbolTable& symbols,
+                             Token& out) {
+  assert(!final.error);
+  switch (final.type) {
+    case TokenType::Number: {
+      // The DFA only lets digits through, so the only possible error is an
+      // out of range literal.
+      int64_t number = 0;
+      auto result =
+          std::from_chars(text.data(), text.data() + text.size(), number);
+      if (result.ec != std::errc())
+        return "Integer literal too large";
+      out = Token::createNumber(number, span);
+      return nullptr;
+    }
+    case TokenType::Float: {
+      double number = 0;
+      auto result =
+          std::from_chars(text.data(), text.data() + text.size(), number);
+      // Out of range literals are fine, and become infinity or zero like they
+      // did with strtod.
+      if (result.ec == std::errc::result_out_of_range)
+        number = std::strtod(std::string(text).c_str(), nullptr);
+      out = Token::createFloat(number, span);
+      return nullptr;
+    }
+    case TokenType::Identifier: {
+      SymbolId symbol = symbols.intern(text);
+      if (SymbolTable::isKeyword(symbol))
+        out = Token::createKeyword(Keyword(symbol - kFirstKeywordSymbol), span);
+      else
+        out = Token::createIdent(symbol, span);
+      return nullptr;
+    }
+    case TokenType::Operator:
+      out = Token::createOp(final.op, span);
+      return nullptr;
+    default:
+      out = Token::createOfType(final.type, span);
+      return nullptr;
+  }
 }
@@ -18,11 +18,15 @@
 #pragma once
 
 #include <cassert>
-#include <cstring>
+#include <cstdint>
 #include <ostream>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
 #include "Optional.h"
+#include "ScanKernels.h"
+#include "SymbolTable.h"
 
 enum class Operator : uint8_t {
   Plus,
@@ -107,6 +111,7 @@ inline std::ostream& operator<<(std::ostream& os, const Operator& op) {
   return os;
 }
 
+// Keywords are interned as well-known symbols, in this same order.
 enum class Keyword : uint8_t {
   For,
   While,
@@ -176,71 +181,52 @@ inline std::ostream& operator<<(std::ostream& os, TokenType type) {
   return os;
 }
 
+// A range of bytes in the source buffer.
+//
+// Line and column numbers are not tracked while lexing, see `LineTable` for
+// that.
+//
+// Offsets are 32-bit, so the tokenizers refuse inputs bigger than
+// `kMaxSourceSize` instead of letting them wrap around.
 struct Span {
-  std::size_t line;
-  std::size_t column;
+  uint32_t offset;
+  uint32_t length;
 
-  Span(std::size_t line, std::size_t column) : line(line), column(column) {}
+  Span(uint32_t offset, uint32_t length) : offset(offset), length(length) {}
   Span() : Span(0, 0) {}
+
+  uint32_t end() const { return offset + length; }
 };
 
-inline std::ostream& operator<<(std::ostream& os, const Span& span) {
-  return os << "Span(" << span.line << ", " << span.column << ")";
-}
+constexpr std::size_t kMaxSourceSize = UINT32_MAX;
+constexpr const char* kSourceTooLarge = "Input too large (4 GiB at most)";
 
-inline bool typeHoldsIdentifier(TokenType type) {
-  return type == TokenType::Identifier;
+inline std::ostream& operator<<(std::ostream& os, const Span& span) {
+  return os << "Span(" << span.offset << ", " << span.length << ")";
 }
 
+// A token is a small, trivially-copyable value. Identifiers don't own their
+// text, they are interned into a `SymbolTable` instead. Every token remembers
+// the range of the buffer it was lexed from.
 class Token {
-  TokenType m_type;
   Span m_span;
   union {
-    char* m_ident;
-    unsigned m_number;
+    SymbolId m_symbol;
+    int64_t m_number;
     double m_float;
     Operator m_op;
     Keyword m_keyword;
+    uint64_t m_raw;
   } m_value;
+  TokenType m_type;
 
-  explicit Token(TokenType type, Span span) : m_type(type), m_span(span){};
-
-  bool typeHoldsIdentifier() const { return ::typeHoldsIdentifier(type()); }
-
-  static Token createIdentHolderOfType(TokenType type,
-                                       const char* string,
-                                       std::size_t length,
-                                       Span span) {
-    assert(::typeHoldsIdentifier(type));
-    Token tok(type, span);
-    tok.m_value.m_ident = static_cast<char*>(malloc(length + 1));
-    memcpy(tok.m_value.m_ident, string, length);
-    tok.m_value.m_ident[length] = '\0';
-    return tok;
+  explicit Token(TokenType type, Span span) : m_span(span), m_type(type) {
+    m_value.m_raw = 0;
   }
 
  public:
-  Token& operator=(const Token& other) {
-    m_type = other.m_type;
-    m_span = other.m_span;
-    m_value = other.m_value;
-    if (typeHoldsIdentifier())
-      m_value.m_ident = strdup(other.m_value.m_ident);
-    return *this;
-  }
-
-  Token(Token&& other) {
-    m_type = other.m_type;
-    m_value = other.m_value;
-    m_span = other.m_span;
-    if (typeHoldsIdentifier())
-      other.m_value.m_ident = nullptr;
-  }
-
-  ~Token() {
-    if (typeHoldsIdentifier() && m_value.m_ident)
-      free(m_value.m_ident);
-  }
+  static_assert(sizeof(m_value) == sizeof(uint64_t),
+                "The payload should fit in a word, see payload()");
 
   static Token createOp(Operator op, Span location) {
     Token tok(TokenType::Operator, location);
@@ -248,7 +234,7 @@ class Token {
     return tok;
   }
 
-  static Token createNumber(unsigned num, Span location) {
+  static Token createNumber(int64_t num, Span location) {
     Token tok(TokenType::Number, location);
     tok.m_value.m_number = num;
     return tok;
@@ -267,16 +253,10 @@ class Token {
     return Token(type, span);
   }
 
-  static Token createIdent(const char* string, std::size_t length, Span span) {
-    return createIdentHolderOfType(TokenType::Identifier, string, length, span);
-  }
-
-  static Token createIdent(const std::string& str, Span span) {
-    return createIdent(str.c_str(), str.length(), span);
-  }
-
-  static Token createIdent(const char* string, Span span) {
-    return createIdent(string, strlen(string), span);
+  static Token createIdent(SymbolId symbol, Span span) {
+    Token tok(TokenType::Identifier, span);
+    tok.m_value.m_symbol = symbol;
+    return tok;
   }
 
   static Token createKeyword(Keyword kw, Span span) {
@@ -285,10 +265,18 @@ class Token {
     return tok;
   }
 
+  // Rebuilds a token from the pieces returned by the accessors below. This is
+  // what allows to store tokens in a more compact form, see `TokenBuffer`.
+  static Token fromParts(TokenType type, Span span, uint64_t payload) {
+    Token tok(type, span);
+    tok.m_value.m_raw = payload;
+    return tok;
+  }
+
   TokenType type() const { return m_type; }
   const Span& span() const { return m_span; }
 
-  unsigned number() const {
+  int64_t number() const {
     assert(type() == TokenType::Number);
     return m_value.m_number;
   }
@@ -308,12 +296,22 @@ class Token {
     return m_value.m_keyword;
   }
 
-  const char* ident() const {
-    assert(typeHoldsIdentifier());
-    return m_value.m_ident;
+  SymbolId symbol() const {
+    assert(type() == TokenType::Identifier);
+    return m_value.m_symbol;
   }
+
+  // The raw value of the token (the number, symbol, operator...), whose
+  // meaning depends on the type.
+  uint64_t payload() const { return m_value.m_raw; }
 };
 
+static_assert(std::is_trivially_copyable<Token>::value,
+              "Tokens are supposed to be cheap to copy around");
+static_assert(sizeof(Token) <= 24, "Tokens are supposed to be small");
+
+// Identifiers are named from `SymbolTable::global()`, so tokens lexed into
+// another table print the wrong names, if any.
 inline std::ostream& operator<<(std::ostream& os, const Token& token) {
   os << "Token(" << token.type() << " @ " << token.span();
   switch (token.type()) {
@@ -327,7 +325,7 @@ inline std::ostream& operator<<(std::ostream& os, const Token& token) {
       os << ", " << token.op();
       break;
     case TokenType::Identifier:
-      os << ", \"" << token.ident() << "\"";
+      os << ", \"" << SymbolTable::global().name(token.symbol()) << "\"";
       break;
     default:
       break;
@@ -335,34 +333,73 @@ inline std::ostream& operator<<(std::ostream& os, const Token& token) {
   return os << ")";
 }
 
-// Reader must provide a method `next()`, that returns a `char`, or `'\0'` at
-// EOF.
+// A source of input for the tokenizer.
 //
-// FIXME(emilio): This is a quite shitty abstraction.
+// The input is exposed as a single contiguous buffer that grows in blocks as
+// the tokenizer asks for more via `fill()`, so that the tokenizer can scan it
+// directly instead of going through a virtual call per character.
+//
+// Offsets into the buffer are stable, but `data()` may change after a call to
+// `fill()`.
 class Reader {
  public:
   virtual ~Reader() = default;
-  virtual char next() = 0;
+
+  const char* data() const { return m_data; }
+  std::size_t size() const { return m_size; }
+
+  // Makes at least one more byte of input available, or returns false at EOF.
+  virtual bool fill() = 0;
+
+ protected:
+  const char* m_data{nullptr};
+  std::size_t m_size{0};
 };
 
+// A reader over input that is already in memory, which may contain null
+// bytes. The buffer must outlive the reader.
+class BufferReader final : public Reader {
+ public:
+  BufferReader(const char* data, std::size_t size) {
+    m_data = data;
+    m_size = size;
+  }
+  explicit BufferReader(std::string_view input)
+      : BufferReader(input.data(), input.size()) {}
+
+  bool fill() override { return false; }
+};
+
+namespace lexer {
+struct FinalState;
+}
+
 class Tokenizer {
  public:
-  Span location() const { return m_location; }
+  // The current position in the input, which is where the error is after a
+  // failed `nextToken()` call.
+  Span location() const { return Span(m_position, 0); }
   const char* errorMessage() const { return m_error; }
-  Tokenizer(Reader& reader) : m_reader(reader){};
+  explicit Tokenizer(Reader& reader,
+                     SymbolTable& symbols = SymbolTable::global())
+      : m_reader(reader), m_symbols(symbols), m_kernels(scanKernels()) {}
   Optional<Token> nextToken();
 
  private:
   Optional<Token> nextTokenInternal();
+  Optional<Token> finishToken(const lexer::FinalState&, std::size_t start);
   Optional<Token> error(const char* message) {
     m_error = message;
     return None;
   }
   char peekChar();
-  char nextChar();
+  // Skips the run of characters matched by `scan`.
+  void skipRun(ScanFunction scan);
+  void skipWhitespace();
 
   Reader& m_reader;
-  Span m_location;
+  SymbolTable& m_symbols;
+  const ScanKernels& m_kernels;
+  std::size_t m_position{0};
   const char* m_error{nullptr};
-  Optional<char> m_lastChar;
 };
@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include "Tokenizer.h"
+
+/**
+ * The tables driving the tokenizer, all generated at compile time.
+ *
+ * Every byte is mapped to a `CharClass`, and the tokenizer is a DFA whose
+ * transitions are indexed by the current state and the class of the next
+ * byte, so lexing is one table lookup per byte.
+ *
+ * Reaching a final state finishes the current token (or errors), and the
+ * final state determines whether the byte that caused the transition is part
+ * of the token or not.
+ */
+namespace lexer {
+
+enum class CharClass : uint8_t {
+  Invalid,
+  Whitespace,
+  Digit,
+  IdentStart,
+  Dot,
+  // Operator characters, in the same order as the operator states below.
+  Plus,
+  Minus,
+  Lt,
+  Gt,
+  And,
+  Or,
+  Star,
+  Slash,
+  Equals,
+  LeftParen,
+  RightParen,
+  LeftBrace,
+  RightBrace,
+  Comma,
+  SemiColon,
+  // The null character, which is also what the tokenizer sees at EOF.
+  Eof,
+};
+
+const std::size_t kCharClassCount = std::size_t(CharClass::Eof) + 1;
+
+constexpr std::array<CharClass, 256> buildCharClasses() {
+  std::array<CharClass, 256> classes{};
+  for (auto& c : classes)
+    c = CharClass::Invalid;
+  // Well, unicode people won't love it, but for a simple school assignment,
+  // this can be enough.
+  classes[uint8_t(' ')] = CharClass::Whitespace;
+  classes[uint8_t('\t')] = CharClass::Whitespace;
+  classes[uint8_t('\n')] = CharClass::Whitespace;
+  for (char c = '0'; c <= '9'; ++c)
+    classes[uint8_t(c)] = CharClass::Digit;
+  for (char c = 'a'; c <= 'z'; ++c) {
+    classes[uint8_t(c)] = CharClass::IdentStart;
+    classes[uint8_t(c - 'a' + 'A')] = CharClass::IdentStart;
+  }
+  classes[uint8_t('_')] = CharClass::IdentStart;
+  classes[uint8_t('.')] = CharClass::Dot;
+  classes[uint8_t('+')] = CharClass::Plus;
+  classes[uint8_t('-')] = CharClass::Minus;
+  classes[uint8_t('<')] = CharClass::Lt;
+  classes[uint8_t('>')] = CharClass::Gt;
+  classes[uint8_t('&')] = CharClass::And;
+  classes[uint8_t('|')] = CharClass::Or;
+  classes[uint8_t('*')] = CharClass::Star;
+  classes[uint8_t('/')] = CharClass::Slash;
+  classes[uint8_t('=')] = CharClass::Equals;
+  classes[uint8_t('(')] = CharClass::LeftParen;
+  classes[uint8_t(')')] = CharClass::RightParen;
+  classes[uint8_t('{')] = CharClass::LeftBrace;
+  classes[uint8_t('}')] = CharClass::RightBrace;
+  classes[uint8_t(',')] = CharClass::Comma;
+  classes[uint8_t(';')] = CharClass::SemiColon;
+  classes[0] = CharClass::Eof;
+  return classes;
+}
+
+constexpr std::array<CharClass, 256> kCharClasses = buildCharClasses();
+
+inline CharClass classify(char c) {
+  return kCharClasses[uint8_t(c)];
+}
+
+// Whether a character can follow a number or identifier.
+constexpr bool isTokenSeparator(CharClass c) {
+  return c != CharClass::Invalid && c != CharClass::Digit &&
+         c != CharClass::IdentStart && c != CharClass::Dot;
+}
+
+constexpr bool isOperatorClass(CharClass c) {
+  return c >= CharClass::Plus && c <= CharClass::Equals;
+}
+
+typedef uint8_t State;
+
+const State kStart = 0;
+const State kInteger = 1;
+const State kFraction = 2;
+const State kIdentifier = 3;
+// One state per operator character, after having seen it.
+const State kFirstOperatorState = 4;
+const std::size_t kOperatorStateCount =
+    std::size_t(CharClass::Equals) - std::size_t(CharClass::Plus) + 1;
+
+constexpr State operatorState(CharClass c) {
+  return kFirstOperatorState + State(c) - State(CharClass::Plus);
+}
+
+const State kFirstFinalState = kFirstOperatorState + kOperatorStateCount;
+
+struct FinalState {
+  TokenType type;
+  // Whether the byte that led to this state is part of the token.
+  bool consume;
+  // Only meaningful for operators.
+  Operator op;
+  // If non-null, this final state is an error.
+  const char* error;
+};
+
+// Final states, relative to kFirstFinalState.
+enum class Final : State {
+  Eof,
+  LeftParen,
+  RightParen,
+  LeftBrace,
+  RightBrace,
+  Comma,
+  SemiColon,
+  Number,
+  Float,
+  Identifier,
+  UnknownToken,
+  InvalidAfterNumber,
+  InvalidAfterFloat,
+  InvalidAfterIdentifier,
+  // Followed by one final state per operator, in `Operator` order.
+  FirstOperator,
+};
+
+const std::size_t kOperatorCount = std::size_t(Operator::Ge) + 1;
+const std::size_t kFinalStateCount =
+    std::size_t(Final::FirstOperator) + kOperatorCount;
+const std::size_t kStateCount = kFirstFinalState + kFinalStateCount;
+static_assert(kStateCount <= 256, "States should fit in a byte");
+
+constexpr State finalState(Final f) {
+  return kFirstFinalState + State(f);
+}
+
+constexpr State operatorFinalState(Operator op) {
+  return finalState(Final::FirstOperator) + State(op);
+}
+
+constexpr bool isFinal(State state) {
+  return state >= kFirstFinalState;
+}
+
+// The two-character operators: after seeing `first`, `twice` is what we get
+// if the next character is the same, and `equals` if it's an equals sign.
+struct OperatorRule {
+  CharClass first;
+  Operator single;
+  bool hasTwice;
+  Operator twice;
+  Operator equals;
+};
+
+constexpr OperatorRule kOperatorRules[] = {
+    {CharClass::Plus, Operator::Plus, true, Operator::PlusPlus,
+     Operator::PlusEquals},
+    {CharClass::Minus, Operator::Minus, true, Operator::MinusMinus,
+     Operator::MinusEquals},
+    {CharClass::Lt, Operator::Lt, true, Operator::Shl, Operator::Le},
+    {CharClass::Gt, Operator::Gt, true, Operator::Shr, Operator::Ge},
+    {CharClass::And, Operator::And, true, Operator::AndAnd,
+     Operator::AndEquals},
+    {CharClass::Or, Operator::Or, true, Operator::OrOr, Operator::OrEquals},
+    {CharClass::Star, Operator::Star, false, Operator::Star,
+     Operator::StarEquals},
+    {CharClass::Slash, Operator::Slash, false, Operator::Slash,
+     Operator::SlashEquals},
+    {CharClass::Equals, Operator::Equals, false, Operator::Equals,
+     Operator::EqualsEquals},
+};
+
+constexpr bool isCompoundOperator(Operator op) {
+  for (const OperatorRule& rule : kOperatorRules) {
+    if (rule.single == op)
+      return false;
+  }
+  return true;
+}
+
+constexpr std::array<FinalState, kFinalStateCount> buildFinalStates() {
+  std::array<FinalState, kFinalStateCount> finals{};
+  auto set = [&](Final f, TokenType type, bool consume,
+                 const char* error = nullptr) {
+    finals[std::size_t(f)] = FinalState{type, consume, Operator::Plus, error};
+  };
+  set(Final::Eof, TokenType::Eof, false);
+  set(Final::LeftParen, TokenType::LeftParen, true);
+  set(Final::RightParen, TokenType::RightParen, true);
+  set(Final::LeftBrace, TokenType::LeftBrace, true);
+  set(Final::RightBrace, TokenType::RightBrace, true);
+  set(Final::Comma, TokenType::Comma, true);
+  set(Final::SemiColon, TokenType::SemiColon, true);
+  set(Final::Number, TokenType::Number, false);
+  set(Final::Float, TokenType::Float, false);
+  set(Final::Identifier, TokenType::Identifier, false);
+  set(Final::UnknownToken, TokenType::Eof, true, "unknown token");
+  set(Final::InvalidAfterNumber, TokenType::Eof, false,
+      "Invalid token separator after number");
+  set(Final::InvalidAfterFloat, TokenType::Eof, false,
+      "Invalid token separator after floating point number");
+  set(Final::InvalidAfterIdentifier, TokenType::Eof, false,
+      "Invalid token separator after identifier");
+  for (std::size_t i = 0; i < kOperatorCount; ++i) {
+    Operator op = Operator(i);
+    // Single-character operators are only known to be finished once we see
+    // the next character, which is not part of them.
+    finals[std::size_t(Final::FirstOperator) + i] =
+        FinalState{TokenType::Operator, isCompoundOperator(op), op, nullptr};
+  }
+  return finals;
+}
+
+constexpr std::array<FinalState, kFinalStateCount> kFinalStates =
+    buildFinalStates();
+
+typedef std::array<std::array<State, kCharClassCount>, kFirstFinalState>
+    TransitionTable;
+
+constexpr TransitionTable buildTransitions() {
+  TransitionTable table{};
+
+  for (std::size_t c = 0; c < kCharClassCount; ++c) {
+    const CharClass klass = CharClass(c);
+    const bool separator = isTokenSeparator(klass);
+
+    State& start = table[kStart][c];
+    if (klass == CharClass::Whitespace)
+      start = kStart;
+    else if (klass == CharClass::Digit)
+      start = kInteger;
+    else if (klass == CharClass::IdentStart)
+      start = kIdentifier;
+    else if (isOperatorClass(klass))
+      start = operatorState(klass);
+    else if (klass == CharClass::LeftParen)
+      start = finalState(Final::LeftParen);
+    else if (klass == CharClass::RightParen)
+      start = finalState(Final::RightParen);
+    else if (klass == CharClass::LeftBrace)
+      start = finalState(Final::LeftBrace);
+    else if (klass == CharClass::RightBrace)
+      start = finalState(Final::RightBrace);
+    else if (klass == CharClass::Comma)
+      start = finalState(Final::Comma);
+    else if (klass == CharClass::SemiColon)
+      start = finalState(Final::SemiColon);
+    else if (klass == CharClass::Eof)
+      start = finalState(Final::Eof);
+    else
+      start = finalState(Final::UnknownToken);
+
+    State& integer = table[kInteger][c];
+    if (klass == CharClass::Digit)
+      integer = kInteger;
+    else if (klass == CharClass::Dot)
+      integer = kFraction;
+    else if (separator)
+      integer = finalState(Final::Number);
+    else
+      integer = finalState(Final::InvalidAfterNumber);
+
+    State& fraction = table[kFraction][c];
+    if (klass == CharClass::Digit)
+      fraction = kFraction;
+    else if (separator)
+      fraction = finalState(Final::Float);
+    else
+      fraction = finalState(Final::InvalidAfterFloat);
+
+    State& identifier = table[kIdentifier][c];
+    if (klass == CharClass::Digit || klass == CharClass::IdentStart)
+      identifier = kIdentifier;
+    else if (separator)
+      identifier = finalState(Final::Identifier);
+    else
+      identifier = finalState(Final::InvalidAfterIdentifier);
+  }
+
+  for (const OperatorRule& rule : kOperatorRules) {
+    for (std::size_t c = 0; c < kCharClassCount; ++c) {
+      State next = operatorFinalState(rule.single);
+      if (rule.hasTwice && CharClass(c) == rule.first)
+        next = operatorFinalState(rule.twice);
+      else if (CharClass(c) == CharClass::Equals)
+        next = operatorFinalState(rule.equals);
+      table[operatorState(rule.first)][c] = next;
+    }
+  }
+
+  return table;
+}
+
+constexpr TransitionTable kTransitions = buildTransitions();
+
+inline State transition(State state, char c) {
+  return kTransitions[state][std::size_t(classify(c))];
+}
+
+inline const FinalState& finalStateInfo(State state) {
+  return kFinalStates[state - kFirstFinalState];
+}
+
+// Builds into `out` the token for the non-error final state `final`, given
+// the token text, interning identifiers into `symbols`. Returns an error
+// message if the token turns out to be invalid.
+const char* makeToken(const FinalState& final,
+                      std::string_view text,
+                      Span span,
+                      SymbolTable& symbols,
+                      Token& out);
+
+}  // namespace lexer
@@ -19,6 +19,7 @@
 
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <ostream>
 
 enum class ValueType : uint8_t {
@@ -27,6 +28,94 @@ enum class ValueType : uint8_t {
   Bool,
 };
 
+#ifdef NAN_BOXED_VALUES
+
+// A value packed in a single word, see the `NAN_BOXED_VALUES` option.
+//
+// Doubles are stored as themselves, with all the NaNs folded into a single
+// positive one. The other values live in the payload of the negative quiet
+// NaNs, which doubles never use then, with the type in the top 16 bits:
+//
+//   0xfff9 | 48-bit integer
+//   0xfffa | bool
+//
+// Integers that don't fit in 48 bits are promoted to floats instead, which
+// keeps them exact up to 2^53 in magnitude, and rounds them to the nearest
+// double past that. Boxing them exactly would need values to own memory, which
+// they can't, since they're copied around freely and live in AST arenas.
+class Value {
+ public:
+  static Value createInt(int64_t integer) {
+    const uint64_t payload = uint64_t(integer) & kPayloadMask;
+    if (__builtin_expect(int64_t(payload << 16) >> 16 != integer, false))
+      return createDouble(double(integer));
+    return Value(kIntTag | payload);
+  }
+
+  static Value createBool(bool value) {
+    return Value(kBoolTag | uint64_t(value));
+  }
+
+  static Value createDouble(double value) {
+    if (value != value)
+      return Value(kCanonicalNaN);
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return Value(bits);
+  }
+
+  ValueType type() const {
+    if (m_bits < kIntTag)
+      return ValueType::Float;
+    return (m_bits & kTagMask) == kBoolTag ? ValueType::Bool
+                                           : ValueType::Integer;
+  }
+
+  bool boolValue() const {
+    assert(type() == ValueType::Bool);
+    return m_bits & 1;
+  }
+
+  int64_t intValue() const {
+    assert(type() == ValueType::Integer);
+    // Sign-extend the payload.
+    return int64_t(m_bits << 16) >> 16;
+  }
+
+  double doubleValue() const {
+    assert(type() == ValueType::Float);
+    double value;
+    memcpy(&value, &m_bits, sizeof(value));
+    return value;
+  }
+
+  ~Value() = default;
+
+  bool operator==(const Value& other) const {
+    // Equal integers and bools have the same bits, but equal doubles may not
+    // (0 and -0).
+    if (m_bits == other.m_bits)
+      return true;
+    return type() == ValueType::Float && other.type() == ValueType::Float &&
+           doubleValue() == other.doubleValue();
+  }
+
+ private:
+  explicit Value(uint64_t bits) : m_bits(bits){};
+
+  static constexpr uint64_t kCanonicalNaN = 0x7ff8000000000000ULL;
+  static constexpr uint64_t kTagMask = 0xffff000000000000ULL;
+  static constexpr uint64_t kPayloadMask = ~kTagMask;
+  static constexpr uint64_t kIntTag = 0xfff9000000000000ULL;
+  static constexpr uint64_t kBoolTag = 0xfffa000000000000ULL;
+
+  uint64_t m_bits;
+};
+
+static_assert(sizeof(Value) == sizeof(uint64_t), "NaN-boxed values are words");
+
+#else
+
 class Value {
  public:
   static Value createInt(int64_t integer) {
@@ -92,5 +181,7 @@ class Value {
   };
 };
 
+#endif
+
 std::ostream& operator<<(std::ostream&, const Value&);
 std::ostream& operator<<(std::ostream& os, const ValueType& type);
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2017 Emilio Cobos Álvarez <emilio@crisal.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// Unsigned LEB128 varints, used by the compact bytecode, the register code
+// and token files: seven bits per byte, least significant first, with the
+// high bit of each byte set if more follow.
+
+// Appends `value` to `out`, a container of bytes.
+template <typename Bytes>
+void writeVarint(Bytes& out, uint64_t value) {
+  using Byte = typename Bytes::value_type;
+  while (value >= 0x80) {
+    out.push_back(Byte(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(Byte(value));
+}
+
+// Reads a varint written by `writeVarint` from trusted input, advancing
+// `cursor` past it.
+inline uint64_t readVarint(const uint8_t*& cursor) {
+  uint64_t result = *cursor & 0x7f;
+  for (unsigned shift = 7; *cursor++ & 0x80; shift += 7)
+    result |= uint64_t(*cursor & 0x7f) << shift;
+  return result;
+}
+
+// Like the above, but for untrusted input: fails instead of reading past
+// `end` or more than 64 bits. `cursor` is only advanced on success.
+template <typename Byte>
+bool readVarint(const Byte*& cursor, const Byte* end, uint64_t& out) {
+  static_assert(sizeof(Byte) == 1, "Varints are read from bytes");
+  uint64_t result = 0;
+  const Byte* position = cursor;
+  for (unsigned shift = 0; shift < 64 && position != end; shift += 7) {
+    const uint8_t byte = uint8_t(*position++);
+    result |= uint64_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      cursor = position;
+      out = result;
+      return true;
+    }
+  }
+  return false;
+}
@@ -15,6 +15,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <sstream>
 #include "ExecutionContext.h"
 #include "Program.h"
 #include "TestUtils.h"
@@ -31,9 +32,50 @@ void assertExprValue(const char* expr, const Value& val) {
     EXPECT_TRUE(result);
     EXPECT_TRUE(ctx->stackTop());
     EXPECT_EQ(val, *ctx->stackTop());
+
+    // Compiling as we parse should give the same program.
+    BufferReader reader(expr);
+    Tokenizer tokenizer(reader);
+    Parser parser(tokenizer);
+    auto streamedResult = Program::compileStreaming(parser);
+    ASSERT_TRUE(streamedResult);
+    std::ostringstream expected, streamed;
+    expected << *program;
+    streamed << *streamedResult.unwrap();
+    EXPECT_EQ(expected.str(), streamed.str());
+
+    // And so should the register machine.
+    auto registerResult = Program::fromAST(*node, ExecutionEngine::Register);
+    ASSERT_TRUE(registerResult);
+    ctx = ExecutionContext::createDefault();
+    EXPECT_TRUE(registerResult.unwrap()->execute(*ctx));
+    ASSERT_TRUE(ctx->stackTop());
+    EXPECT_EQ(val, *ctx->stackTop());
   });
 }
 
+static std::string registerCodeOf(const char* expr) {
+  std::string code;
+  parse(expr, [&](ast::Node* node, const ParseError* error) {
+    ASSERT_TRUE(node);
+    auto result = Program::fromAST(*node, ExecutionEngine::Register);
+    ASSERT_TRUE(result);
+    std::ostringstream out;
+    out << *result.unwrap();
+    code = out.str();
+  });
+  return code;
+}
+
+static std::string streamingCompileError(const char* input) {
+  BufferReader reader(input);
+  Tokenizer tokenizer(reader);
+  Parser parser(tokenizer);
+  auto result = Program::compileStreaming(parser);
+  EXPECT_FALSE(result);
+  return result ? std::string() : result.unwrapErr().message();
+}
+
 TEST(Evaluator, Basic) {
   assertExprValue("1 + 1 + 5", Value::createInt(7));
 }
@@ -55,6 +97,109 @@ TEST(Evaluator, SimpleVarsAndPrecedence) {
   assertExprValue(kProgram, Value::createInt(75));
 }
 
+TEST(Evaluator, Variables) {
+  // Assigning to a variable that's still on the stack.
+  assertExprValue("{ a = 2; a + (a = 5) * a }", Value::createInt(27));
+  assertExprValue("{ a = 2; b = a; a = 3; b = b * 10 + a; b }",
+                  Value::createInt(23));
+  assertExprValue("{ a = 2; a = a; { b = a + 1; a = b * b }; a }",
+                  Value::createInt(9));
+  // Arguments are evaluated last to first.
+  assertExprValue("{ a = 2; pow(a, a = 3) + a }", Value::createInt(30));
+}
+
+// The result of integer arithmetic that went past 48 bits, which NaN-boxed
+// values promote to floats.
+static Value wideInt(int64_t integer) {
+#ifdef NAN_BOXED_VALUES
+  return Value::createDouble(double(integer));
+#else
+  return Value::createInt(integer);
+#endif
+}
+
+TEST(Evaluator, WideIntegers) {
+  // Crossing 2^47 and back, with odd operands, so that dropping low bits
+  // would show.
+  assertExprValue("140737488355327 + 1", wideInt(140737488355328));
+  assertExprValue("140737488355329 + 2", wideInt(140737488355331));
+  assertExprValue("140737488355329 * 3", wideInt(422212465065987));
+  assertExprValue("{ a = 140737488355329; b = a + 65; b - 67 }",
+                  wideInt(140737488355327));
+  assertExprValue("{ a = 0 - 140737488355329; b = a - 97; b }",
+                  wideInt(-140737488355426));
+  assertExprValue("{ a = 0 - 140737488355329; b = a - 97; b + 99 }",
+                  wideInt(-140737488355327));
+  assertExprValue("{ a = 4294967297; a * 100000 - a * 99999 }",
+                  wideInt(4294967297));
+  EXPECT_FALSE(Value::createInt(1 << 20) == Value::createInt(1 << 21));
+  EXPECT_TRUE(Value::createDouble(0.) == Value::createDouble(-0.));
+
+#ifdef NAN_BOXED_VALUES
+  EXPECT_EQ(Value::createInt(140737488355328).type(), ValueType::Float);
+  EXPECT_EQ(Value::createInt(-140737488355329).doubleValue(),
+            -140737488355329.);
+  // Past 2^53, they round like any other double.
+  EXPECT_EQ(Value::createInt(9007199254740993).doubleValue(),
+            9007199254740992.);
+#else
+  assertExprValue("9007199254740993 + 2", Value::createInt(9007199254740995));
+  EXPECT_EQ(Value::createInt(INT64_MIN).intValue(), INT64_MIN);
+#endif
+}
+
+TEST(Evaluator, MixedArithmetic) {
+  // Integers meeting floats become floats.
+  assertExprValue("1 + 2.5", Value::createDouble(3.5));
+  assertExprValue("2.5 * 2", Value::createDouble(5.0));
+  assertExprValue("{ a = 3; b = 0.5; a / b }", Value::createDouble(6.0));
+}
+
+TEST(Evaluator, StackAcrossRuns) {
+  parse("{ a = 2; a * 3 }", [&](ast::Node* node, const ParseError* error) {
+    ASSERT_TRUE(node);
+    auto programResult = Program::fromAST(*node);
+    ASSERT_TRUE(programResult);
+    auto program = programResult.unwrap();
+    std::unique_ptr<ExecutionContext> ctx = ExecutionContext::createDefault();
+    // Each run leaves its value on top of the ones of previous runs.
+    ctx->push(Value::createInt(1));
+    EXPECT_TRUE(program->execute(*ctx));
+    EXPECT_TRUE(program->execute(*ctx));
+    ASSERT_TRUE(ctx->stackTop());
+    EXPECT_EQ(*ctx->stackTop(), Value::createInt(6));
+    EXPECT_EQ(ctx->pop(), Value::createInt(6));
+    EXPECT_EQ(ctx->pop(), Value::createInt(6));
+    EXPECT_EQ(ctx->pop(), Value::createInt(1));
+    EXPECT_FALSE(ctx->stackTop());
+  });
+}
+
+TEST(Evaluator, RegisterCode) {
+  // Values get computed straight into variables, and constants and variables
+  // are used in place.
+  EXPECT_EQ(registerCodeOf("{ a = 1; b = a + 2; b = pow(b, a) * b; b }"),
+            "RegisterCode(5 registers\n"
+            "  r0 = Value(Integer, 1)\n"
+            "  r1 = Value(Integer, 2)\n"
+            "  Move r2, r0\n"
+            "  Add r4, r2, r1\n"
+            "  CallFunction r3, Pow, r4, r2\n"
+            "  Mul r4, r3, r4\n"
+            "  result r4\n"
+            ")");
+  EXPECT_EQ(registerCodeOf("{ a = 1; a + (a = 2) }"),
+            "RegisterCode(4 registers\n"
+            "  r0 = Value(Integer, 1)\n"
+            "  r1 = Value(Integer, 2)\n"
+            "  Move r2, r0\n"
+            "  Move r3, r2\n"
+            "  Move r2, r1\n"
+            "  Add r3, r3, r2\n"
+            "  result r3\n"
+            ")");
+}
+
 TEST(Evaluator, Cos) {
   assertExprValue("1. + cos(0)", Value::createDouble(2.0));
 }
@@ -72,6 +217,72 @@ TEST(Evaluator, Sqr) {
   assertExprValue("sqrt(pow(10, 2))", Value::createDouble(10.0));
 }
 
+TEST(Evaluator, StreamingCompileErrors) {
+  EXPECT_EQ(streamingCompileError("{ a = 1; b + 1; }"), "Unresolved variable: b");
+  EXPECT_EQ(streamingCompileError("{ a = 1; a + }"), "Unbalanced block");
+  EXPECT_EQ(streamingCompileError("{ a = 1; a a }"),
+            "Unbalanced block, or expected semicolon");
+  EXPECT_EQ(streamingCompileError("{ a = 1 } 2"),
+            "Found unexpected token after program");
+}
+
+TEST(Evaluator, StreamingCompileMemory) {
+  std::string input = "{ a = 0;";
+  for (size_t i = 0; i < 20000; ++i)
+    input += " a = a + " + std::to_string(i) + " * 2;";
+  input += " a }";
+
+  BufferReader reader(input.c_str());
+  Tokenizer tokenizer(reader);
+  Parser parser(tokenizer);
+  auto result = Program::compileStreaming(parser);
+  ASSERT_TRUE(result);
+  // A single block's worth of memory, rather than megabytes of nodes.
+  EXPECT_LE(parser.arena().peakCapacity(), 64u * 1024);
+
+  std::unique_ptr<ExecutionContext> ctx = ExecutionContext::createDefault();
+  ASSERT_TRUE(result.unwrap()->execute(*ctx));
+  ASSERT_TRUE(ctx->stackTop());
+  EXPECT_EQ(*ctx->stackTop(), Value::createInt(19999LL * 20000));
+}
+
+static std::string dumpOf(const std::vector<Bytecode>& bytecode) {
+  std::ostringstream out;
+  for (const Bytecode& b : bytecode)
+    out << b << '\n';
+  return out.str();
+}
+
+TEST(Evaluator, CompactBytecode) {
+  std::vector<Bytecode> bytecode = {
+      Bytecode(Instruction::Load),
+      Bytecode(Value::createInt(300)),
+      Bytecode(Instruction::StoreVar),
+      Bytecode::label(1000),
+      Bytecode(Instruction::JumpIfZero),
+      Bytecode::offset(8),
+      Bytecode(Instruction::Load),
+      Bytecode(Value::createDouble(-0.)),
+      Bytecode(Instruction::Load),
+      Bytecode(Value::createDouble(0.)),
+      Bytecode(Instruction::Jump),
+      Bytecode::offset(-10),
+      Bytecode(Instruction::Load),
+      Bytecode(Value::createInt(300)),
+      Bytecode(Instruction::CallFunction),
+      Bytecode::function(BuiltinFunction::Pow),
+      Bytecode::argumentCount(2),
+      Bytecode(Instruction::Pop),
+  };
+  CompactBytecode compact = CompactBytecode::encode(bytecode);
+  EXPECT_EQ(dumpOf(bytecode), dumpOf(compact.decode()));
+  // Zero and negative zero are different constants, but equal values aren't.
+  EXPECT_EQ(compact.constants().size(), 3u);
+  // Opcodes, plus two bytes for the label, one per constant index, four per
+  // offset, and two for the function call.
+  EXPECT_EQ(compact.code().size(), 9u + 2 + 4 + 8 + 2);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -15,6 +15,16 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cstddef>
+#include <cstring>
+#include <sstream>
+#include <utility>
+#include <vector>
+#include "BytecodeCollector.h"
+#include "ExecutionContext.h"
+#include "FlatAST.h"
+#include "IncrementalParser.h"
+#include "Program.h"
 #include "TestUtils.h"
 #include "gtest/gtest.h"
 
@@ -59,6 +69,462 @@ TEST(Parser, For) {
   assertParses("while (rofl()) {}");
 }
 
+static std::string dumpOf(ast::Node* node) {
+  std::ostringstream out;
+  ast::ASTDumper dumper(out);
+  node->dump(dumper);
+  return out.str();
+}
+
+// Parses `input` lexing up front, lexing as we go, and lexing on another
+// thread, and checks that all the parsers agree.
+static void assertSameParse(const char* input) {
+  std::string streamed;
+  parse(input, [&](ast::Node* node, const ParseError* error) {
+    ASSERT_FALSE(error);
+    streamed = dumpOf(node);
+  });
+
+  BufferReader reader(input);
+  Tokenizer tokenizer(reader);
+  TokenBuffer tokens = TokenBuffer::lexAll(tokenizer);
+  ASSERT_TRUE(tokens.isComplete());
+  Parser parser(tokens);
+  ast::Node* node = parser.parse();
+  ASSERT_TRUE(node);
+  EXPECT_EQ(streamed, dumpOf(node));
+
+  BufferReader pipelinedReader(input);
+  Tokenizer pipelinedTokenizer(pipelinedReader);
+  TokenPipeline pipeline(pipelinedTokenizer);
+  Parser pipelinedParser(pipeline);
+  node = pipelinedParser.parse();
+  ASSERT_TRUE(node);
+  EXPECT_EQ(streamed, dumpOf(node));
+  EXPECT_EQ(pipeline.stats().tokens, tokens.size());
+}
+
+TEST(Parser, TokenBuffer) {
+  assertSameParse("{ a = 1; b = 2.5; if (a < b) { cos(a) } else b }");
+  assertSameParse("for (i = 0; i < 10; ++i) { pow(i, 2) + -i * 3 }");
+
+  // Enough tokens to need a few refills of the streaming window.
+  std::string big = "{";
+  for (size_t i = 0; i < 2000; ++i)
+    big += " foo = foo + " + std::to_string(i) + ";";
+  big += " foo }";
+  assertSameParse(big.c_str());
+}
+
+TEST(Parser, TokenBufferContents) {
+  BufferReader reader("foo(1, 2.5)");
+  Tokenizer tokenizer(reader);
+  TokenBuffer tokens = TokenBuffer::lexAll(tokenizer);
+  ASSERT_EQ(tokens.size(), 7u);
+  EXPECT_EQ(tokens.type(0), TokenType::Identifier);
+  EXPECT_EQ(tokens.span(0).offset, 0u);
+  EXPECT_EQ(tokens.span(0).length, 3u);
+  EXPECT_EQ(tokens.type(2), TokenType::Number);
+  EXPECT_EQ(tokens.at(2).number(), 1);
+  EXPECT_EQ(tokens.span(4).offset, 7u);
+  EXPECT_EQ(tokens.at(4).doubleValue(), 2.5);
+  EXPECT_EQ(tokens.type(6), TokenType::Eof);
+}
+
+TEST(Parser, LexerErrors) {
+  const char* input = "{ foo; bar + 1a }";
+  parse(input, [](ast::Node* node, const ParseError* error) {
+    ASSERT_TRUE(error);
+    EXPECT_FALSE(node);
+  });
+
+  BufferReader reader(input);
+  Tokenizer tokenizer(reader);
+  TokenBuffer tokens = TokenBuffer::lexAll(tokenizer);
+  EXPECT_FALSE(tokens.isComplete());
+  EXPECT_TRUE(tokens.errorMessage());
+  Parser parser(tokens);
+  EXPECT_FALSE(parser.parse());
+  ASSERT_TRUE(parser.error());
+  EXPECT_EQ(parser.error()->message(), tokens.errorMessage());
+
+  BufferReader pipelinedReader(input);
+  Tokenizer pipelinedTokenizer(pipelinedReader);
+  TokenPipeline pipeline(pipelinedTokenizer);
+  Parser pipelinedParser(pipeline);
+  EXPECT_FALSE(pipelinedParser.parse());
+  ASSERT_TRUE(pipelinedParser.error());
+  EXPECT_EQ(pipelinedParser.error()->message(), tokens.errorMessage());
+  EXPECT_EQ(pipelinedParser.error()->location().offset,
+            parser.error()->location().offset);
+}
+
+// Nesting way deeper than what the native stack could handle recursively.
+TEST(Parser, DeepNesting) {
+  const std::size_t kDepth = 200000;
+
+  std::string parens(kDepth, '(');
+  parens += "a";
+  parens.append(kDepth, ')');
+  parse(parens.c_str(), [&](ast::Node* node, const ParseError* error) {
+    ASSERT_FALSE(error);
+    const ast::Node* current = node;
+    std::size_t depth = 0;
+    while (ast::isParenthesizedExpression(current)) {
+      current = &ast::toParenthesizedExpression(current)->inner();
+      depth++;
+    }
+    EXPECT_EQ(depth, kDepth);
+    EXPECT_TRUE(ast::isVariableBinding(current));
+  });
+
+  parens.pop_back();
+  parse(parens.c_str(), [](ast::Node* node, const ParseError* error) {
+    ASSERT_TRUE(error);
+    EXPECT_EQ(error->message(), "Unbalanced paren");
+  });
+
+  // Unary operators apply to everything that follows them, so this nests too.
+  std::string sum = "a";
+  for (std::size_t i = 0; i < kDepth; ++i)
+    sum += " + -1";
+  parse(sum.c_str(), [&](ast::Node* node, const ParseError* error) {
+    ASSERT_FALSE(error);
+    const ast::Node* current = node;
+    std::size_t terms = 1;
+    while (true) {
+      if (ast::isBinaryOperation(current)) {
+        current = &ast::toBinaryOperation(current)->rhs();
+        terms++;
+      } else if (ast::isUnaryOperation(current)) {
+        current = &ast::toUnaryOperation(current)->operand();
+      } else {
+        break;
+      }
+    }
+    EXPECT_EQ(terms, kDepth + 1);
+  });
+}
+
+// Generating code for, dumping and freeing a tree way deeper than what the
+// native stack could handle recursively.
+TEST(Parser, DeepTreeTraversal) {
+  const std::size_t kDepth = 1000000;
+  std::string input;
+  for (std::size_t i = 0; i < kDepth; ++i)
+    input += "- ";
+  input += "1";
+
+  parse(input.c_str(), [&](ast::Node* node, const ParseError* error) {
+    ASSERT_FALSE(error);
+    BytecodeCollector collector;
+    auto result = node->toByteCode(collector);
+    ASSERT_TRUE(result);
+    EXPECT_EQ(result.unwrap(), ast::BytecodeCollectionStatus::PushedToStack);
+
+    // A stream without a buffer ignores the output, which would otherwise be
+    // quadratic due to the indentation.
+    std::ostream sink(nullptr);
+    node->dump(ast::ASTDumper(sink));
+
+    EXPECT_EQ(ast::FlatTree::build(*node).size(), kDepth + 1);
+  });
+}
+
+TEST(Parser, AstArena) {
+  ast::AstArena arena;
+  char* byte = arena.make<char>('a');
+  double* number = arena.make<double>(2.5);
+  EXPECT_EQ(*byte, 'a');
+  EXPECT_EQ(*number, 2.5);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(number) % alignof(double), 0u);
+
+  // Bigger than a block.
+  uint64_t* big = arena.allocateArray<uint64_t>(100000);
+  big[99999] = 42;
+  uint64_t* next = arena.make<uint64_t>(1);
+  EXPECT_NE(big + 99999, next);
+  EXPECT_GE(arena.capacity(), 100000 * sizeof(uint64_t));
+}
+
+static std::string bytecodeOf(ast::BytecodeCollectionResult result,
+                              BytecodeCollector& collector) {
+  if (!result)
+    return result.unwrapErr();
+  std::ostringstream out;
+  for (const auto& bytecode : collector.takeBytecode())
+    out << bytecode << "\n";
+  return out.str();
+}
+
+static void assertSameFlatTree(ast::Node* node,
+                               const ast::FlatTree& tree) {
+  std::ostringstream out;
+  ast::ASTDumper dumper(out);
+  tree.dump(dumper);
+  EXPECT_EQ(dumpOf(node), out.str());
+
+  BytecodeCollector expected;
+  BytecodeCollector actual;
+  EXPECT_EQ(bytecodeOf(node->toByteCode(expected), expected),
+            bytecodeOf(tree.toByteCode(actual), actual));
+}
+
+// Checks that the flat copy of the tree dumps and compiles like the original,
+// and so does the same copy written to a file and mapped back.
+static void assertSameFlatTree(const char* input) {
+  parse(input, [](ast::Node* node, const ParseError* error) {
+    ASSERT_FALSE(error);
+    ast::FlatTree tree = ast::FlatTree::build(*node);
+    ASSERT_TRUE(tree.size());
+    assertSameFlatTree(node, tree);
+
+    std::ostringstream stream;
+    tree.write(stream);
+    const std::string file = stream.str();
+    // Like a mapping, suitably aligned.
+    std::vector<uint64_t> buffer(file.size() / sizeof(uint64_t) + 1);
+    memcpy(buffer.data(), file.data(), file.size());
+    const char* data = reinterpret_cast<const char*>(buffer.data());
+
+    auto mapped = ast::FlatTree::map(data, file.size());
+    ASSERT_TRUE(mapped) << mapped.unwrapErr();
+    ast::FlatTree mappedTree = mapped.unwrap();
+    EXPECT_EQ(tree.size(), mappedTree.size());
+    assertSameFlatTree(node, mappedTree);
+
+    EXPECT_FALSE(ast::FlatTree::map(data, file.size() - 1));
+    EXPECT_FALSE(ast::FlatTree::map(data + 1, file.size() - 1));
+
+    // Corrupting any field of any node is caught when mapping the file,
+    // rather than when walking the tree. The nodes come right after the
+    // 32-byte header.
+    const std::size_t kHeaderSize = 32;
+    for (std::size_t node = 0; node < tree.size(); ++node) {
+      const std::size_t offset =
+          kHeaderSize + node * sizeof(ast::FlatTree::Node);
+      const std::pair<std::size_t, std::size_t> fields[] = {
+          {offsetof(ast::FlatTree::Node, kind), 1},
+          {offsetof(ast::FlatTree::Node, op), 1},
+          {offsetof(ast::FlatTree::Node, padding), 1},
+          {offsetof(ast::FlatTree::Node, a), 4},
+          {offsetof(ast::FlatTree::Node, b), 4},
+          {offsetof(ast::FlatTree::Node, c), 4},
+      };
+      for (const auto& field : fields) {
+        std::vector<uint64_t> corrupted(buffer);
+        char* bytes = reinterpret_cast<char*>(corrupted.data());
+        memset(bytes + offset + field.first, 0xfe, field.second);
+        auto result = ast::FlatTree::map(bytes, file.size());
+        ASSERT_FALSE(result) << "node " << node << ", offset " << field.first;
+        EXPECT_EQ(result.unwrapErr(), "Malformed flat AST file");
+      }
+    }
+  });
+}
+
+// Like `DeepTreeTraversal`, but for a flat tree mapped from a file, which
+// doesn't have the original tree around.
+TEST(Parser, DeepFlatTree) {
+  const std::size_t kDepth = 1000000;
+  std::string input(kDepth, '(');
+  input += "1";
+  input.append(kDepth, ')');
+
+  parse(input.c_str(), [&](ast::Node* node, const ParseError* error) {
+    ASSERT_FALSE(error);
+    std::ostringstream stream;
+    ast::FlatTree::build(*node).write(stream);
+    const std::string file = stream.str();
+    std::vector<uint64_t> buffer(file.size() / sizeof(uint64_t) + 1);
+    memcpy(buffer.data(), file.data(), file.size());
+
+    auto mapped = ast::FlatTree::map(
+        reinterpret_cast<const char*>(buffer.data()), file.size());
+    ASSERT_TRUE(mapped);
+    ast::FlatTree tree = mapped.unwrap();
+    EXPECT_EQ(tree.size(), kDepth + 1);
+
+    std::ostream sink(nullptr);
+    tree.dump(ast::ASTDumper(sink));
+
+    auto program = Program::fromFlatTree(tree);
+    ASSERT_TRUE(program);
+    std::unique_ptr<ExecutionContext> ctx = ExecutionContext::createDefault();
+    EXPECT_TRUE(program.unwrap()->execute(*ctx));
+    ASSERT_TRUE(ctx->stackTop());
+    EXPECT_EQ(*ctx->stackTop(), Value::createInt(1));
+  });
+}
+
+TEST(Parser, FlatTree) {
+  assertSameFlatTree("{ a = 1; b = 2.5; { c = a * -b; }; pow(a, cos(b)) }");
+  assertSameFlatTree("{ a = 1; (a + 2) * +a; }");
+  assertSameFlatTree("{ a = 1; if (a < 2) { a } else if (a) 3 else 4 }");
+  assertSameFlatTree("for (i = 0; i < 10; ++i) { pow(i, 2) }");
+  assertSameFlatTree("for (;;) {}");
+  assertSameFlatTree("{ unknown(1) }");
+  assertSameFlatTree("{ a + 1 }");
+  assertSameFlatTree("{ 1 = 2 }");
+}
+
+// Checks that parsing nested blocks lazily compiles to the same bytecode.
+static void assertSameLazyBytecode(const char* input) {
+  std::string expected;
+  parse(input, [&](ast::Node* node, const ParseError* error) {
+    ASSERT_FALSE(error);
+    BytecodeCollector collector;
+    expected = bytecodeOf(node->toByteCode(collector), collector);
+  });
+
+  BufferReader reader(input);
+  Tokenizer tokenizer(reader);
+  TokenBuffer tokens = TokenBuffer::lexAll(tokenizer);
+  Parser parser(tokens);
+  parser.setLazyBlocks(true);
+  ast::Node* node = parser.parse();
+  ASSERT_TRUE(node);
+  BytecodeCollector collector;
+  EXPECT_EQ(expected, bytecodeOf(node->toByteCode(collector), collector));
+  EXPECT_FALSE(parser.error());
+}
+
+TEST(Parser, LazyBlocks) {
+  const char* input = "{ a = 1; { b = a; { b * 2 } } }";
+  BufferReader reader(input);
+  Tokenizer tokenizer(reader);
+  TokenBuffer tokens = TokenBuffer::lexAll(tokenizer);
+  Parser parser(tokens);
+  parser.setLazyBlocks(true);
+  ast::Node* node = parser.parse();
+  ASSERT_TRUE(ast::isBlock(node));
+  const ast::Expression* last = ast::toBlock(node)->lastExpression();
+  ASSERT_TRUE(ast::isLazyBlock(last));
+  const ast::LazyBlock& lazy = ast::toLazyBlock(*last);
+  EXPECT_FALSE(lazy.isParsed());
+  EXPECT_EQ(tokens.type(lazy.firstToken()), TokenType::LeftBrace);
+  EXPECT_EQ(tokens.type(lazy.endToken() - 1), TokenType::RightBrace);
+
+  // Parsing a lazy block only parses one more level.
+  ASSERT_TRUE(lazy.block());
+  EXPECT_TRUE(ast::isLazyBlock(lazy.block()->lastExpression()));
+  EXPECT_FALSE(
+      ast::toLazyBlock(lazy.block()->lastExpression())->isParsed());
+
+  assertSameLazyBytecode(input);
+  assertSameLazyBytecode("{ a = 1; {}; { a + 1; }; { a = a * 3; }; a }");
+  assertSameLazyBytecode("{ a = 2; { b = { a }; { c = b; }; b } + 1 }");
+  assertSameLazyBytecode("{ a = 1; { b = 2; }; b }");
+}
+
+TEST(Parser, LazyBlockErrors) {
+  // Errors inside lazy blocks are only found once they're needed.
+  const char* input = "{ a = 1; { a = a + ; }; a }";
+  BufferReader reader(input);
+  Tokenizer tokenizer(reader);
+  TokenBuffer tokens = TokenBuffer::lexAll(tokenizer);
+  Parser parser(tokens);
+  parser.setLazyBlocks(true);
+  ast::Node* node = parser.parse();
+  ASSERT_TRUE(node);
+  EXPECT_FALSE(parser.error());
+  BytecodeCollector collector;
+  EXPECT_EQ(bytecodeOf(node->toByteCode(collector), collector),
+            "Couldn't parse block");
+  ASSERT_TRUE(parser.error());
+  EXPECT_EQ(parser.error()->message(), "Stray semicolon");
+  EXPECT_EQ(parser.error()->location().offset, 19u);
+
+  // But unbalanced braces aren't.
+  BufferReader unbalancedReader("{ a = 1; { a; { a }");
+  Tokenizer unbalancedTokenizer(unbalancedReader);
+  tokens = TokenBuffer::lexAll(unbalancedTokenizer);
+  Parser unbalanced(tokens);
+  unbalanced.setLazyBlocks(true);
+  EXPECT_FALSE(unbalanced.parse());
+  ASSERT_TRUE(unbalanced.error());
+  EXPECT_EQ(unbalanced.error()->message(), "Unfinished block");
+}
+
+// Checks that the incremental parser ends up with the same tokens, tree and
+// error as lexing and parsing its source from scratch.
+static void assertSameAsFreshParse(const IncrementalParser& incremental) {
+  BufferReader reader(incremental.source().c_str());
+  Tokenizer tokenizer(reader);
+  TokenBuffer tokens = TokenBuffer::lexAll(tokenizer);
+  const TokenBuffer& actual = incremental.tokens();
+  ASSERT_EQ(tokens.size(), actual.size());
+  for (std::size_t i = 0; i < tokens.size(); ++i) {
+    EXPECT_EQ(tokens.type(i), actual.type(i));
+    EXPECT_EQ(tokens.span(i).offset, actual.span(i).offset);
+    EXPECT_EQ(tokens.span(i).length, actual.span(i).length);
+    EXPECT_EQ(tokens.payload(i), actual.payload(i));
+  }
+  EXPECT_EQ(!!tokens.errorMessage(), !!actual.errorMessage());
+  if (tokens.errorMessage()) {
+    EXPECT_EQ(tokens.errorLocation().offset, actual.errorLocation().offset);
+  }
+
+  Parser parser(tokens);
+  ast::Node* node = parser.parse();
+  ASSERT_EQ(!!node, !!incremental.root());
+  if (node) {
+    EXPECT_EQ(dumpOf(node), dumpOf(incremental.root()));
+  }
+  ASSERT_EQ(!!parser.error(), !!incremental.error());
+  if (parser.error()) {
+    EXPECT_EQ(parser.error()->message(), incremental.error()->message());
+    EXPECT_EQ(parser.error()->location().offset,
+              incremental.error()->location().offset);
+  }
+}
+
+TEST(Parser, IncrementalReparse) {
+  IncrementalParser parser("{ a = 1; b = { c = 2; c * 3 }; d = a + b; d }");
+  assertSameAsFreshParse(parser);
+  const std::size_t nodes = parser.stats().parsedNodes;
+
+  // Tweaking a constant only relexes that one token, and reuses the other
+  // statements of the outer block.
+  parser.edit(19, 1, "20");
+  assertSameAsFreshParse(parser);
+  EXPECT_EQ(parser.stats().relexedTokens, 1u);
+  EXPECT_EQ(parser.stats().reusedNodes, 10u);
+  EXPECT_EQ(parser.stats().parsedNodes, nodes - 10u);
+
+  // Tokens that grow into their neighbours.
+  parser.edit(3, 0, "a");
+  assertSameAsFreshParse(parser);
+  parser.edit(4, 1, "");
+  assertSameAsFreshParse(parser);
+  EXPECT_EQ(parser.source(), "{ aa= 1; b = { c = 20; c * 3 }; d = a + b; d }");
+}
+
+TEST(Parser, IncrementalReparseEdits) {
+  std::string source;
+  for (std::size_t i = 0; i < 50; ++i)
+    source += "x" + std::to_string(i % 7) + " = { y = " + std::to_string(i) +
+              "; y * 2 } + 1;\n";
+  IncrementalParser parser("{\n" + source + "x0 }");
+  assertSameAsFreshParse(parser);
+
+  // Edits that break and fix the program, and change the token count.
+  const char* kInsertions[] = {"1", "", "{", "}", ";", " ", "a", "1a", "+ ("};
+  uint32_t seed = 7;
+  for (std::size_t i = 0; i < 300; ++i) {
+    seed = seed * 1103515245 + 12345;
+    const std::size_t size = parser.source().size();
+    const std::size_t offset = (seed >> 8) % size;
+    const std::size_t removed = std::min<std::size_t>(seed % 3, size - offset);
+    parser.edit(offset, removed, kInsertions[(seed >> 4) % 9]);
+    assertSameAsFreshParse(parser);
+    if (::testing::Test::HasFailure()) {
+      ADD_FAILURE() << "After edit " << i << ": " << parser.source();
+      break;
+    }
+  }
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -18,11 +18,11 @@
 #pragma once
 
 #include "Parser.h"
-#include "TestReader.h"
+#include "Tokenizer.h"
 
 template <typename Callback>
 void parse(const char* str, Callback cb) {
-  TestReader reader(str);
+  BufferReader reader(str);
   Tokenizer tokenizer(reader);
   Parser parser(tokenizer);
   ast::Node* result = parser.parse();
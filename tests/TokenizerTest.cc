@@ -15,8 +15,454 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "LineTable.h"
+#include "ParallelTokenizer.h"
+#include "ScanKernels.h"
+#include "StreamingTokenizer.h"
+#include "TokenFile.h"
+#include "Tokenizer.h"
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static std::atomic<std::size_t> sAllocationCount{0};
+
+void* operator new(std::size_t size) {
+  sAllocationCount++;
+  if (void* ptr = malloc(size))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  free(ptr);
+}
+
+// Exposes its input a few bytes at a time, like a reader over a pipe would.
+class ChunkedTestReader final : public Reader {
+ public:
+  ChunkedTestReader(const char* str, std::size_t chunkSize)
+      : m_input(str), m_length(strlen(str)), m_chunkSize(chunkSize) {
+    m_data = m_input;
+  }
+
+  bool fill() override {
+    if (m_size == m_length)
+      return false;
+    m_size = std::min(m_length, m_size + m_chunkSize);
+    return true;
+  }
+
+ private:
+  const char* m_input;
+  std::size_t m_length;
+  std::size_t m_chunkSize;
+};
+
+static std::vector<TokenType> tokenTypes(Reader& reader) {
+  Tokenizer tokenizer(reader);
+  std::vector<TokenType> types;
+  while (true) {
+    Optional<Token> token = tokenizer.nextToken();
+    EXPECT_TRUE(token);
+    if (!token)
+      break;
+    types.push_back(token->type());
+    if (token->type() == TokenType::Eof)
+      break;
+  }
+  return types;
+}
+
+TEST(Tokenizer, Basic) {
+  BufferReader reader("foo = 6 + 60.5 * cos(0);");
+  std::vector<TokenType> expected = {
+      TokenType::Identifier, TokenType::Operator,  TokenType::Number,
+      TokenType::Operator,   TokenType::Float,     TokenType::Operator,
+      TokenType::Identifier, TokenType::LeftParen, TokenType::Number,
+      TokenType::RightParen, TokenType::SemiColon, TokenType::Eof,
+  };
+  EXPECT_EQ(expected, tokenTypes(reader));
+}
+
+TEST(Tokenizer, Operators) {
+  BufferReader reader("a++ b-=c<<=d>e&&f|g*=h/i==j+-k");
+  Tokenizer tokenizer(reader);
+  std::vector<Operator> ops;
+  while (true) {
+    Optional<Token> token = tokenizer.nextToken();
+    ASSERT_TRUE(token);
+    if (token->type() == TokenType::Eof)
+      break;
+    if (token->type() == TokenType::Operator)
+      ops.push_back(token->op());
+  }
+  std::vector<Operator> expected = {
+      Operator::PlusPlus, Operator::MinusEquals,  Operator::Shl,
+      Operator::Equals,   Operator::Gt,           Operator::AndAnd,
+      Operator::Or,       Operator::StarEquals,   Operator::Slash,
+      Operator::EqualsEquals, Operator::Plus,     Operator::Minus,
+  };
+  EXPECT_EQ(expected, ops);
+}
+
+TEST(Tokenizer, Errors) {
+  const char* kInvalid[] = {"12ab",    "1.2.3", "foo.bar",
+                            "#",       "1.5x",  "9223372036854775808",
+                            "99999999999999999999999"};
+  for (const char* input : kInvalid) {
+    BufferReader reader(input);
+    Tokenizer tokenizer(reader);
+    Optional<Token> token = tokenizer.nextToken();
+    EXPECT_FALSE(token) << input;
+    EXPECT_TRUE(tokenizer.errorMessage()) << input;
+  }
+}
+
+TEST(Tokenizer, Numbers) {
+  BufferReader reader(
+      "0 42 9223372036854775807 0.5 3.25 1. "
+      "0.1000000000000000055511151231257827021181583404541015625 "
+      "123456789012345678901234567890123456789012345678901234567890123456.5");
+  Tokenizer tokenizer(reader);
+  std::vector<int64_t> integers;
+  std::vector<double> floats;
+  while (true) {
+    Optional<Token> token = tokenizer.nextToken();
+    ASSERT_TRUE(token);
+    if (token->type() == TokenType::Eof)
+      break;
+    if (token->type() == TokenType::Number)
+      integers.push_back(token->number());
+    else
+      floats.push_back(token->doubleValue());
+  }
+  std::vector<int64_t> expectedIntegers = {0, 42, INT64_MAX};
+  std::vector<double> expectedFloats = {
+      0.5, 3.25, 1., 0.1,
+      123456789012345678901234567890123456789012345678901234567890123456.5};
+  EXPECT_EQ(expectedIntegers, integers);
+  EXPECT_EQ(expectedFloats, floats);
+}
+
+TEST(Tokenizer, ChunkedInput) {
+  const char* kInput = "{ foobar += 12345; baz <= 3.25 }";
+  BufferReader reader(kInput);
+  std::vector<TokenType> expected = tokenTypes(reader);
+  for (std::size_t chunkSize = 1; chunkSize < 8; ++chunkSize) {
+    ChunkedTestReader chunked(kInput, chunkSize);
+    EXPECT_EQ(expected, tokenTypes(chunked));
+  }
+}
+
+TEST(Tokenizer, NoAllocationsPerToken) {
+  std::string input;
+  for (std::size_t i = 0; i < 10000; ++i)
+    input += "foo_bar = baz * 1234 + 3.75; if (qux) { quux -= 1 } else { ";
+
+  // Interning an identifier for the first time allocates, so lex everything
+  // once before counting.
+  BufferReader warmupReader(input.c_str());
+  tokenTypes(warmupReader);
+
+  BufferReader reader(input.c_str());
+  Tokenizer tokenizer(reader);
+  std::size_t tokens = 0;
+  const std::size_t allocationsBefore = sAllocationCount;
+  while (true) {
+    Optional<Token> token = tokenizer.nextToken();
+    if (!token || token->type() == TokenType::Eof)
+      break;
+    tokens++;
+  }
+  EXPECT_EQ(allocationsBefore, sAllocationCount);
+  EXPECT_EQ(tokens, 10000u * 19);
+}
+
+TEST(Tokenizer, Interning) {
+  SymbolTable symbols;
+  BufferReader reader("foo bar foo while cos");
+  Tokenizer tokenizer(reader, symbols);
+  std::vector<Token> tokens;
+  for (std::size_t i = 0; i < 5; ++i)
+    tokens.push_back(*tokenizer.nextToken());
+
+  EXPECT_EQ(tokens[0].symbol(), tokens[2].symbol());
+  EXPECT_NE(tokens[0].symbol(), tokens[1].symbol());
+  EXPECT_EQ("bar", symbols.name(tokens[1].symbol()));
+  EXPECT_EQ(TokenType::Keyword, tokens[3].type());
+  EXPECT_EQ(Keyword::While, tokens[3].keyword());
+  EXPECT_EQ(SymbolId(WellKnownSymbol::Cos), tokens[4].symbol());
+  EXPECT_EQ(kWellKnownSymbolCount + 2, symbols.size());
+}
+
+TEST(Tokenizer, ScanKernels) {
+  std::string input;
+  for (std::size_t i = 0; i < 200; ++i)
+    input += "  \n\t" + std::string(i % 37, 'a') + std::string(i % 41, '7') +
+             "_Zz09(";
+
+  const ScanKernelKind previous = scanKernels().kind;
+  for (ScanKernelKind kind : {ScanKernelKind::SSE2, ScanKernelKind::AVX2}) {
+    if (!scanKernelsSupported(kind))
+      continue;
+    setScanKernels(kind);
+    const ScanKernels& simd = scanKernels();
+    setScanKernels(ScanKernelKind::Scalar);
+    const ScanKernels& scalar = scanKernels();
+    const char* end = input.data() + input.size();
+    for (const char* begin = input.data(); begin != end; ++begin) {
+      EXPECT_EQ(scalar.skipWhitespace(begin, end),
+                simd.skipWhitespace(begin, end));
+      EXPECT_EQ(scalar.skipIdentPart(begin, end),
+                simd.skipIdentPart(begin, end));
+      EXPECT_EQ(scalar.skipDigits(begin, end), simd.skipDigits(begin, end));
+    }
+  }
+  // Don't make the rest of the tests run on the scalar kernels.
+  setScanKernels(previous);
+  EXPECT_EQ(scanKernels().kind, previous);
+}
+
+static void expectSameTokens(const std::string& input) {
+  SymbolTable sequentialSymbols;
+  BufferReader sequentialReader(input);
+  Tokenizer tokenizer(sequentialReader, sequentialSymbols);
+  TokenBuffer expected = TokenBuffer::lexAll(tokenizer);
+
+  // Tiny chunks, so that they split the input all over the place.
+  SymbolTable parallelSymbols;
+  BufferReader parallelReader(input);
+  TokenBuffer tokens =
+      tokenizeInParallel(parallelReader, parallelSymbols, 4, 5);
+
+  ASSERT_EQ(expected.size(), tokens.size()) << input;
+  for (std::size_t i = 0; i < tokens.size(); ++i) {
+    EXPECT_EQ(expected.type(i), tokens.type(i)) << i;
+    EXPECT_EQ(expected.span(i).offset, tokens.span(i).offset) << i;
+    EXPECT_EQ(expected.span(i).length, tokens.span(i).length) << i;
+    EXPECT_EQ(expected.payload(i), tokens.payload(i)) << i;
+  }
+  EXPECT_EQ(expected.isComplete(), tokens.isComplete());
+  EXPECT_EQ(expected.errorMessage(), tokens.errorMessage());
+  EXPECT_EQ(expected.errorLocation().offset, tokens.errorLocation().offset);
+  EXPECT_EQ(sequentialSymbols.size(), parallelSymbols.size());
+}
+
+TEST(Tokenizer, Parallel) {
+  expectSameTokens("");
+  expectSameTokens("   \n  ");
+  expectSameTokens("foo");
+  expectSameTokens(
+      "{\n  foo = 6 + 60.5 * cos(0);\n\n  bar = foo; baz = bar + foo;"
+      "\n    if (baz >= 10) { pow(baz, 2) } else { qux }\n}\n");
+  expectSameTokens("a = 1;\nb = 2;\n  c = a +\n b;;;\n d = 12ab;\n e = 1;");
+  const char kWithNull[] = "a = 1;\nb = 2;\0 c = 3;\n d = 4";
+  expectSameTokens(std::string(kWithNull, sizeof(kWithNull) - 1));
+
+  std::string big;
+  for (std::size_t i = 0; i < 1000; ++i)
+    big += "variable_" + std::to_string(i % 37) + " = " + std::to_string(i) +
+           (i % 3 ? "; " : ";\n");
+  expectSameTokens(big);
+}
+
+// Feeds `input` to a streaming tokenizer `chunkSize` bytes at a time, checking
+// that it produces the same tokens as the regular one.
+static void expectSameStreamingTokens(const std::string& input,
+                                      std::size_t chunkSize) {
+  SymbolTable expectedSymbols;
+  BufferReader reader(input);
+  Tokenizer tokenizer(reader, expectedSymbols);
+  TokenBuffer expected = TokenBuffer::lexAll(tokenizer);
+
+  SymbolTable symbols;
+  StreamingTokenizer streaming(symbols);
+  TokenBuffer tokens;
+  std::string chunk;
+  std::size_t fed = 0;
+  while (true) {
+    Optional<Token> token = streaming.nextToken();
+    if (token) {
+      tokens.push(*token);
+      if (token->type() == TokenType::Eof)
+        break;
+      continue;
+    }
+    if (!streaming.needsInput())
+      break;
+    // Feed a copy, to check that the tokenizer doesn't hold onto old chunks.
+    chunk = input.substr(fed, chunkSize);
+    fed += chunk.size();
+    streaming.feed(chunk.data(), chunk.size());
+    if (fed == input.size())
+      streaming.finish();
+  }
+
+  ASSERT_EQ(expected.size(), tokens.size()) << input;
+  for (std::size_t i = 0; i < tokens.size(); ++i) {
+    EXPECT_EQ(expected.type(i), tokens.type(i)) << i;
+    EXPECT_EQ(expected.span(i).offset, tokens.span(i).offset) << i;
+    EXPECT_EQ(expected.span(i).length, tokens.span(i).length) << i;
+    EXPECT_EQ(expected.payload(i), tokens.payload(i)) << i;
+  }
+  EXPECT_EQ(expected.errorMessage(), streaming.errorMessage());
+  if (expected.errorMessage()) {
+    EXPECT_EQ(expected.errorLocation().offset, streaming.location().offset);
+  }
+  EXPECT_EQ(expectedSymbols.size(), symbols.size());
+}
+
+// Offsets are 32-bit, so inputs past 4 GiB are an error instead of wrapping
+// around. Streaming the same chunk over and over gets there without actually
+// having that much input in memory.
+TEST(Tokenizer, SourceTooLarge) {
+#ifndef NDEBUG
+  GTEST_SKIP() << "Lexing 4 GiB takes too long without optimizations";
+#endif
+  const std::string chunk = "1" + std::string(64 * 1024 * 1024 - 1, ' ');
+  StreamingTokenizer streaming;
+  std::size_t fed = 0;
+  std::size_t numbers = 0;
+  while (true) {
+    Optional<Token> token = streaming.nextToken();
+    if (token) {
+      EXPECT_EQ(token->type(), TokenType::Number);
+      EXPECT_EQ(token->span().offset, numbers++ * chunk.size());
+      continue;
+    }
+    if (!streaming.needsInput())
+      break;
+    streaming.feed(chunk.data(), chunk.size());
+    fed += chunk.size();
+  }
+  EXPECT_EQ(numbers, kMaxSourceSize / chunk.size() + 1);
+  EXPECT_GT(fed, kMaxSourceSize);
+  ASSERT_TRUE(streaming.errorMessage());
+  EXPECT_STREQ(streaming.errorMessage(), kSourceTooLarge);
+  EXPECT_EQ(streaming.location().offset, kMaxSourceSize);
+}
+
+TEST(Tokenizer, Streaming) {
+  const char* kInputs[] = {
+      "",
+      "   ",
+      "foo = 6 + 60.5 * cos(0);",
+      "{\n  some_long_identifier <<= 12345.678;\n  b &&= c || d\n}\n   ",
+      "a++ b-=c<<=d>e&&f|g*=h/i==j+-k",
+      "foo = 12ab;",
+      "x = 1.2.3",
+  };
+  for (const char* input : kInputs) {
+    for (std::size_t chunkSize : {1, 2, 3, 7, 64}) {
+      SCOPED_TRACE(chunkSize);
+      expectSameStreamingTokens(input, chunkSize);
+    }
+  }
+}
+
+// Writes the tokens of `input` to a token file and reads them back into a
+// different symbol table.
+static void expectTokenFileRoundTrip(const std::string& input) {
+  SymbolTable symbols;
+  BufferReader reader(input);
+  Tokenizer tokenizer(reader, symbols);
+  TokenBuffer expected = TokenBuffer::lexAll(tokenizer);
+
+  std::ostringstream stream;
+  {
+    TokenFileWriter writer(stream, symbols);
+    writer.write(expected);
+  }
+  const std::string file = stream.str();
+
+  // Pre-populate the symbol table so that the ids don't match.
+  SymbolTable readSymbols;
+  readSymbols.intern("unrelated");
+  auto result = TokenFile::read(file.data(), file.size(), readSymbols);
+  ASSERT_TRUE(result) << result.unwrapErr();
+  std::unique_ptr<TokenFile> tokenFile = result.unwrap();
+  const TokenBuffer& tokens = tokenFile->tokens();
+
+  ASSERT_EQ(expected.size(), tokens.size()) << input;
+  for (std::size_t i = 0; i < tokens.size(); ++i) {
+    EXPECT_EQ(expected.type(i), tokens.type(i)) << i;
+    EXPECT_EQ(expected.span(i).offset, tokens.span(i).offset) << i;
+    EXPECT_EQ(expected.span(i).length, tokens.span(i).length) << i;
+    if (expected.type(i) == TokenType::Identifier) {
+      EXPECT_EQ(symbols.name(expected.at(i).symbol()),
+                readSymbols.name(tokens.at(i).symbol()))
+          << i;
+    } else {
+      EXPECT_EQ(expected.payload(i), tokens.payload(i)) << i;
+    }
+  }
+  EXPECT_EQ(expected.isComplete(), tokens.isComplete());
+  if (!expected.isComplete()) {
+    EXPECT_STREQ(expected.errorMessage(), tokens.errorMessage());
+    EXPECT_EQ(expected.errorLocation().offset, tokens.errorLocation().offset);
+    EXPECT_EQ(expected.errorLocation().length, tokens.errorLocation().length);
+  }
+  EXPECT_EQ(symbols.size() + 1, readSymbols.size());
+
+  // Any truncated file is malformed.
+  for (std::size_t size : {std::size_t(0), std::size_t(5), file.size() - 1}) {
+    EXPECT_FALSE(TokenFile::read(file.data(), size, readSymbols)) << size;
+  }
+}
+
+TEST(Tokenizer, TokenFile) {
+  expectTokenFileRoundTrip("");
+  expectTokenFileRoundTrip("   \n  ");
+  expectTokenFileRoundTrip(
+      "{\n  foo = 6 + 60.5 * cos(0);\n\n  bar = foo; baz = bar + foo;"
+      "\n    if (baz >= 10) { pow(baz, 2) } else { qux }\n}\n");
+  expectTokenFileRoundTrip("a++ b-=c<<=d>e&&f|g*=h/i==j+-k 18446744073709551615");
+  expectTokenFileRoundTrip("foo = 1;\n bar = 12ab;");
+  expectTokenFileRoundTrip(std::string(70000, ' ') + "far_away = 1e300;");
+
+  const std::string kGarbage = std::string(kTokenFileMagic, 8) + "\x07\x01";
+  auto result = TokenFile::read(kGarbage.data(), kGarbage.size());
+  ASSERT_FALSE(result);
+  EXPECT_EQ(result.unwrapErr(), "Malformed token file");
+}
+
+TEST(Tokenizer, LineTable) {
+  const char* input = "foo = 1;\n\n  bar(foo,\n      2)";
+  BufferReader reader(input);
+  Tokenizer tokenizer(reader);
+  TokenBuffer tokens = TokenBuffer::lexAll(tokenizer);
+  ASSERT_TRUE(tokens.isComplete());
+
+  LineTable lines(reader);
+  std::vector<std::pair<std::size_t, std::size_t>> locations;
+  for (std::size_t i = 0; i < tokens.size(); ++i) {
+    LineColumn location = lines.locate(tokens.span(i));
+    locations.emplace_back(location.line, location.column);
+  }
+  std::vector<std::pair<std::size_t, std::size_t>> expected = {
+      {0, 0}, {0, 4}, {0, 6}, {0, 7}, {2, 2},
+      {2, 5}, {2, 6}, {2, 9}, {3, 6}, {3, 7}, {3, 8},
+  };
+  EXPECT_EQ(expected, locations);
+
+  // Lookups don't need to be in order, and are clamped to the buffer.
+  EXPECT_EQ(lines.locate(3).line, 0u);
+  EXPECT_EQ(lines.locate(3).column, 3u);
+  EXPECT_EQ(lines.locate(1000).line, 3u);
+  EXPECT_EQ(lines.locate(1000).column, 8u);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();